@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <signal.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <sigrok.h>
@@ -36,6 +37,12 @@
 
 #define DEFAULT_OUTPUT_FORMAT "bits:width=64"
 
+/* Number of events kept per thread with --trace */
+#define TRACE_EVENTS 1000000
+
+/* ms the samples of one device may wait for those of the others */
+#define MERGE_LATENCY 100
+
 extern struct sr_hwcap_option sr_hwcap_options[];
 
 gboolean debug = 0;
@@ -54,7 +61,7 @@ static gboolean opt_list_devices = FALSE;
 static gboolean opt_wait_trigger = FALSE;
 static gchar *opt_input_file = NULL;
 static gchar *opt_output_file = NULL;
-static gchar *opt_device = NULL;
+static gchar **opt_devices = NULL;
 static gchar *opt_probes = NULL;
 static gchar *opt_triggers = NULL;
 static gchar *opt_pds = NULL;
@@ -62,6 +69,15 @@ static gchar *opt_format = NULL;
 static gchar *opt_time = NULL;
 static gchar *opt_samples = NULL;
 static gchar *opt_continuous = NULL;
+static gchar *opt_max_memory = NULL;
+static gboolean opt_compress = FALSE;
+static gchar *opt_ring = NULL;
+static gchar *opt_ring_memory = NULL;
+static gchar *opt_trace = NULL;
+static gboolean opt_stats = FALSE;
+
+/* Set by a trigger or SIGUSR1, to stop and save the flight recorder. */
+static volatile sig_atomic_t freeze_requested = 0;
 
 static GOptionEntry optargs[] = {
 	{"version", 'V', 0, G_OPTION_ARG_NONE, &opt_version, "Show version and support list", NULL},
@@ -69,7 +85,7 @@ static GOptionEntry optargs[] = {
 	{"list-devices", 'D', 0, G_OPTION_ARG_NONE, &opt_list_devices, "List devices", NULL},
 	{"input-file", 'i', 0, G_OPTION_ARG_FILENAME, &opt_input_file, "Load input from file", NULL},
 	{"output-file", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output_file, "Save output to file", NULL},
-	{"device", 'd', 0, G_OPTION_ARG_STRING, &opt_device, "Use device ID", NULL},
+	{"device", 'd', 0, G_OPTION_ARG_STRING_ARRAY, &opt_devices, "Use device ID (repeat to use several devices, whose samples are merged by time if their driver reports a samplerate)", NULL},
 	{"probes", 'p', 0, G_OPTION_ARG_STRING, &opt_probes, "Probes to use", NULL},
 	{"triggers", 't', 0, G_OPTION_ARG_STRING, &opt_triggers, "Trigger configuration", NULL},
 	{"wait-trigger", 'w', 0, G_OPTION_ARG_NONE, &opt_wait_trigger, "Wait for trigger", NULL},
@@ -78,6 +94,12 @@ static GOptionEntry optargs[] = {
 	{"time", 0, 0, G_OPTION_ARG_STRING, &opt_time, "How long to sample (ms)", NULL},
 	{"samples", 0, 0, G_OPTION_ARG_STRING, &opt_samples, "Number of samples to acquire", NULL},
 	{"continuous", 0, 0, G_OPTION_ARG_NONE, &opt_continuous, "Sample continuously", NULL},
+	{"max-memory", 0, 0, G_OPTION_ARG_STRING, &opt_max_memory, "Memory to use for samples before spilling to disk", NULL},
+	{"compress", 0, 0, G_OPTION_ARG_NONE, &opt_compress, "Compress samples held in memory", NULL},
+	{"ring", 0, 0, G_OPTION_ARG_STRING, &opt_ring, "Only keep the last <n> samples", NULL},
+	{"ring-memory", 0, 0, G_OPTION_ARG_STRING, &opt_ring_memory, "Only keep the last <n> bytes of samples", NULL},
+	{"trace", 0, 0, G_OPTION_ARG_FILENAME, &opt_trace, "Save a trace of where the time goes (Chrome trace format)", NULL},
+	{"stats", 0, 0, G_OPTION_ARG_NONE, &opt_stats, "Show throughput while running, and statistics at the end", NULL},
 	{NULL, 0, 0, 0, NULL, NULL, NULL}
 };
 
@@ -178,7 +200,7 @@ static void show_device_detail(void)
 	int cap, *capabilities, i;
 	char *s, *title, *charopts, **stropts;
 
-	device = parse_devicestring(opt_device);
+	device = parse_devicestring(opt_devices[0]);
 	if (!device) {
 		printf("No such device. Use -D to list all devices.\n");
 		return;
@@ -256,40 +278,120 @@ static void show_device_detail(void)
 	}
 }
 
+/* What datafeed_in() keeps for every device, see device_feed(). */
+struct device_feed {
+	struct sr_device *device;
+	uint64_t limit_samples;
+	struct sr_output *o;
+	struct sr_filter_plan *filter;
+	unsigned char *filter_buf;
+	uint64_t filter_buf_size;
+	int probelist[65];
+	uint64_t received_samples;
+	int unitsize;
+	int triggered;
+	int frozen;
+	FILE *outfile;
+	int ended;
+};
+
+static GSList *feeds = NULL;
+
+/* Get the feed of a device, and start one if it has none yet. */
+static struct device_feed *device_feed(struct sr_device *device)
+{
+	struct device_feed *f;
+	GSList *l;
+
+	for (l = feeds; l; l = l->next) {
+		f = l->data;
+		if (f->device == device)
+			return f;
+	}
+
+	if (!(f = g_try_malloc0(sizeof(struct device_feed)))) {
+		printf("Device feed malloc failed.\n");
+		return NULL;
+	}
+	f->device = device;
+	f->limit_samples = limit_samples;
+	feeds = g_slist_append(feeds, f);
+
+	return f;
+}
+
+/* Every device has sent SR_DF_END. */
+static int feeds_ended(void)
+{
+	GSList *l;
+
+	for (l = feeds; l; l = l->next) {
+		if (!((struct device_feed *)l->data)->ended)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void feeds_free(void)
+{
+	GSList *l;
+
+	for (l = feeds; l; l = l->next)
+		g_free(l->data);
+	g_slist_free(feeds);
+	feeds = NULL;
+}
+
 static void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 {
-	static struct sr_output *o = NULL;
-	static int probelist[65] = { 0 };
-	static uint64_t received_samples = 0;
-	static int unitsize = 0;
-	static int triggered = 0;
-	static FILE *outfile = NULL;
+	struct device_feed *f;
 	struct sr_probe *probe;
 	struct sr_datafeed_header *header;
 	struct sr_datafeed_logic *logic;
 	int num_enabled_probes, sample_size, ret, i;
-	uint64_t output_len, filter_out_len, dec_out_size;
-	char *output_buf, *filter_out;
+	uint64_t output_len, filter_out_len, dec_out_size, ring_units, t;
+	const unsigned char *filter_out;
+	char *output_buf;
 	uint8_t *dec_out;
 
+	if (!(f = device_feed(device)))
+		return;
+
 	/* If the first packet to come in isn't a header, don't even try. */
-	if (packet->type != SR_DF_HEADER && o == NULL)
+	if (packet->type != SR_DF_HEADER && f->o == NULL)
+		return;
+
+	/*
+	 * The flight recorder window is kept as it was when the trigger
+	 * fired or SIGUSR1 came in, and saved once the device has stopped.
+	 */
+	if (packet->type == SR_DF_LOGIC && (f->frozen || freeze_requested)) {
+		if (!f->frozen) {
+			printf("Freezing the last %" PRIu64 " samples.\n",
+			       device->datastore->num_units -
+			       sr_datastore_get_first_unit(device->datastore));
+			f->frozen = 1;
+			sr_session_stop();
+		}
 		return;
+	}
 
 	sample_size = -1;
 	switch (packet->type) {
 	case SR_DF_HEADER:
 		g_message("cli: Received SR_DF_HEADER");
+		f->ended = FALSE;
 		/* Initialize the output module. */
-		if (!(o = malloc(sizeof(struct sr_output)))) {
+		if (!(f->o = malloc(sizeof(struct sr_output)))) {
 			printf("Output module malloc failed.\n");
 			exit(1);
 		}
-		o->format = output_format;
-		o->device = device;
-		o->param = output_format_param;
-		if (o->format->init) {
-			if (o->format->init(o) != SR_OK) {
+		f->o->format = output_format;
+		f->o->device = device;
+		f->o->param = output_format_param;
+		if (f->o->format->init) {
+			if (f->o->format->init(f->o) != SR_OK) {
 				printf("Output format initialization failed.\n");
 				exit(1);
 			}
@@ -300,64 +402,102 @@ static void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *pac
 		for (i = 0; i < header->num_logic_probes; i++) {
 			probe = g_slist_nth_data(device->probes, i);
 			if (probe->enabled)
-				probelist[num_enabled_probes++] = probe->index;
+				f->probelist[num_enabled_probes++] = probe->index;
 		}
+		f->probelist[num_enabled_probes] = 0;
 		/* How many bytes we need to store num_enabled_probes bits */
-		unitsize = (num_enabled_probes + 7) / 8;
+		f->unitsize = (num_enabled_probes + 7) / 8;
+
+		sr_filter_plan_destroy(f->filter);
+		if (sr_filter_plan_new((header->num_logic_probes + 7) / 8,
+				f->unitsize, f->probelist, &f->filter) != SR_OK) {
+			printf("Failed to set up probe filter.\n");
+			exit(1);
+		}
 
-		outfile = stdout;
+		f->outfile = stdout;
 		if (opt_output_file) {
 			if (default_output_format) {
 				/* output file is in session format, which means we'll
 				 * dump everything in the datastore as it comes in,
 				 * and save from there after the session. */
-				outfile = NULL;
-				ret = sr_datastore_new(unitsize, &(device->datastore));
+				f->outfile = NULL;
+				if (opt_max_memory)
+					ret = sr_datastore_new_file(f->unitsize, NULL,
+						sr_parse_sizestring(opt_max_memory),
+						&(device->datastore));
+				else if (opt_compress)
+					ret = sr_datastore_new_compressed(f->unitsize,
+						&(device->datastore));
+				else
+					ret = sr_datastore_new(f->unitsize, &(device->datastore));
 				if (ret != SR_OK) {
 					printf("Failed to create datastore.\n");
 					exit(1);
 				}
+				ring_units = 0;
+				if (opt_ring)
+					ring_units = sr_parse_sizestring(opt_ring);
+				else if (opt_ring_memory)
+					ring_units = sr_parse_sizestring(
+						opt_ring_memory) / f->unitsize;
+				if ((opt_ring || opt_ring_memory)
+				    && sr_datastore_set_ring(device->datastore,
+						ring_units) != SR_OK) {
+					printf("Failed to set up flight recorder "
+					       "mode.\n");
+					exit(1);
+				}
 			} else {
 				/* saving to a file in whatever format was set
 				 * with --format, so all we need is a filehandle */
-				outfile = g_fopen(opt_output_file, "wb");
+				f->outfile = g_fopen(opt_output_file, "wb");
 			}
 		}
 		break;
 	case SR_DF_END:
 		g_message("cli: Received SR_DF_END");
-		if (!o) {
+		if (!f->o) {
 			g_message("cli: double end!");
 			break;
 		}
-		if (o->format->event) {
-			o->format->event(o, SR_DF_END, &output_buf, &output_len);
+		if (f->o->format->event) {
+			f->o->format->event(f->o, SR_DF_END, &output_buf, &output_len);
 			if (output_len) {
-				if (outfile)
-					fwrite(output_buf, 1, output_len, outfile);
+				if (f->outfile)
+					fwrite(output_buf, 1, output_len, f->outfile);
 				free(output_buf);
 				output_len = 0;
 			}
 		}
-		if (limit_samples && received_samples < limit_samples)
+		if (f->limit_samples && f->received_samples < f->limit_samples)
 			printf("Device only sent %" PRIu64 " samples.\n",
-			       received_samples);
+			       f->received_samples);
 		if (opt_continuous)
 			printf("Device stopped after %" PRIu64 " samples.\n",
-			       received_samples);
-		sr_session_halt();
-		if (outfile && outfile != stdout)
-			fclose(outfile);
-		free(o);
-		o = NULL;
+			       f->received_samples);
+		f->ended = TRUE;
+		if (feeds_ended())
+			sr_session_halt();
+		if (f->outfile && f->outfile != stdout)
+			fclose(f->outfile);
+		free(f->o);
+		f->o = NULL;
+		sr_filter_plan_destroy(f->filter);
+		f->filter = NULL;
+		g_free(f->filter_buf);
+		f->filter_buf = NULL;
+		f->filter_buf_size = 0;
 		break;
 	case SR_DF_TRIGGER:
 		g_message("cli: received SR_DF_TRIGGER at %"PRIu64" ms",
 				packet->timeoffset / 1000000);
-		if (o->format->event)
-			o->format->event(o, SR_DF_TRIGGER, &output_buf,
+		if (f->o->format->event)
+			f->o->format->event(f->o, SR_DF_TRIGGER, &output_buf,
 					 &output_len);
-		triggered = 1;
+		f->triggered = 1;
+		if (sr_datastore_get_ring_size(device->datastore))
+			freeze_requested = 1;
 		break;
 	case SR_DF_LOGIC:
 		logic = packet->payload;
@@ -376,15 +516,26 @@ static void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *pac
 		return;
 
 	/* Don't store any samples until triggered. */
-	if (opt_wait_trigger && !triggered)
+	if (opt_wait_trigger && !f->triggered)
 		return;
 
-	if (limit_samples && received_samples >= limit_samples)
+	if (f->limit_samples && f->received_samples >= f->limit_samples)
 		return;
 
+	/* The filter output buffer is kept around for the next packet. */
+	if (logic->length > f->filter_buf_size) {
+		g_free(f->filter_buf);
+		if (!(f->filter_buf = g_try_malloc(logic->length))) {
+			f->filter_buf_size = 0;
+			return;
+		}
+		f->filter_buf_size = logic->length;
+	}
+
 	/* TODO: filters only support SR_DF_LOGIC */
-	ret = sr_filter_probes(sample_size, unitsize, probelist,
+	ret = sr_filter_plan_apply(f->filter, sample_size,
 				   logic->data, logic->length,
+				   f->filter_buf, f->filter_buf_size,
 				   &filter_out, &filter_out_len);
 	if (ret != SR_OK)
 		return;
@@ -394,18 +545,18 @@ static void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *pac
 	 * size. however, the driver may have submitted too much -- cut off
 	 * the buffer of the last packet according to the sample limit.
 	 */
-	if (limit_samples && (received_samples + logic->length / sample_size >
-			limit_samples * sample_size))
-		filter_out_len = limit_samples * sample_size - received_samples;
+	if (f->limit_samples && (f->received_samples + logic->length / sample_size >
+			f->limit_samples * sample_size))
+		filter_out_len = f->limit_samples * sample_size - f->received_samples;
 
 	if (device->datastore)
 		sr_datastore_put(device->datastore, filter_out,
-				 filter_out_len, sample_size, probelist);
+				 filter_out_len, sample_size, f->probelist);
 
 	if (opt_output_file && default_output_format)
 		/* saving to a session file, don't need to do anything else
 		 * to this data for now. */
-		goto cleanup;
+		goto done;
 
 	if (decoders) {
 		GSList *d;
@@ -413,7 +564,7 @@ static void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *pac
 			/* TODO: Error handling. */
 			
 			dec_out_size = 0;
-			ret = srd_run_decoder(d->data, (uint8_t*)filter_out,
+			ret = srd_run_decoder(d->data, (uint8_t *)filter_out,
 					filter_out_len, &dec_out, &dec_out_size);
 
 			if (ret != SRD_OK) {
@@ -425,18 +576,196 @@ static void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *pac
 		}
 	} else {
 		output_len = 0;
-		if (o->format->data && packet->type == o->format->df_type)
-			o->format->data(o, filter_out, filter_out_len, &output_buf, &output_len);
+		if (f->o->format->data && packet->type == f->o->format->df_type) {
+			t = sr_trace_begin();
+			f->o->format->data(f->o, (const char *)filter_out,
+					filter_out_len, &output_buf, &output_len);
+			sr_trace_end("output", t, filter_out_len);
+		}
 		if (output_len) {
-			fwrite(output_buf, 1, output_len, outfile);
+			fwrite(output_buf, 1, output_len, f->outfile);
 			free(output_buf);
 		}
 	}
 
-	cleanup:
-	free(filter_out);
-	received_samples += logic->length / sample_size;
+	done:
+	f->received_samples += logic->length / sample_size;
+
+}
+
+#ifdef SIGUSR1
+static void freeze_handler(int sig)
+{
+	/* Avoid compiler warnings. */
+	(void)sig;
+
+	freeze_requested = 1;
+}
+#endif
+
+static void show_datastore_stats(struct sr_device *device)
+{
+	struct sr_datastore_stats stats;
+	struct sr_mempool_stats pool_stats;
+
+	if (!device->datastore
+	    || sr_datastore_get_stats(device->datastore, &stats) != SR_OK)
+		return;
+
+	g_message("cli: datastore holds %" PRIu64 " bytes of samples in %"
+		  PRIu64 " bytes", stats.raw_bytes, stats.stored_bytes);
+	if (stats.encode_usec)
+		g_message("cli: compressed %" PRIu64 " bytes at %.1f MB/s",
+			  stats.encoded_bytes,
+			  (double)stats.encoded_bytes / stats.encode_usec);
+
+	if (sr_mempool_get_stats(&pool_stats) == SR_OK)
+		g_message("cli: buffer pool uses %" PRIu64 " bytes (peak %"
+			  PRIu64 "), %" PRIu64 " of %" PRIu64 " allocations "
+			  "recycled", pool_stats.mapped_bytes,
+			  pool_stats.peak_used_bytes, pool_stats.num_recycled,
+			  pool_stats.num_allocs);
+}
+
+static const char *callback_name(struct sr_callback_stats *cs)
+{
+	if (cs->callback == datafeed_in)
+		return decoders ? "decoders" : "output";
+
+	return cs->async ? "async callback" : "callback";
+}
+
+/* Total samples and bytes all devices sent. */
+static void stats_totals(struct sr_session_stats *stats, uint64_t *samples,
+			 uint64_t *bytes)
+{
+	int i;
+
+	*samples = *bytes = 0;
+	for (i = 0; i < stats->num_devices; i++) {
+		*samples += stats->devices[i].num_samples;
+		*bytes += stats->devices[i].num_bytes;
+	}
+}
+
+/*
+ * Print the throughput once a second, on stderr to keep it out of the data.
+ * Everything is for the last second only, not since the start.
+ */
+static void stats_in(struct sr_device *device,
+		     struct sr_datafeed_packet *packet)
+{
+	static uint64_t last_elapsed = 0, last_samples = 0, last_bytes = 0;
+	static struct sr_callback_stats *last_callbacks = NULL;
+	static int last_num_callbacks = 0;
+	static GTimer *timer = NULL;
+	struct sr_session_stats stats;
+	struct sr_callback_stats *cs, *last;
+	uint64_t samples, bytes, dt, calls;
+	int i;
+
+	/* Avoid compiler warnings. */
+	(void)device;
+
+	if (!timer)
+		timer = g_timer_new();
+
+	if (packet->type == SR_DF_HEADER) {
+		last_elapsed = last_samples = last_bytes = 0;
+		g_free(last_callbacks);
+		last_callbacks = NULL;
+		last_num_callbacks = 0;
+		g_timer_start(timer);
+	}
+
+	/* Only this is done for every packet. */
+	if (g_timer_elapsed(timer, NULL) < 1.0)
+		return;
+	g_timer_start(timer);
+
+	if (sr_session_get_stats(&stats) != SR_OK)
+		return;
+	if (!(dt = stats.elapsed - last_elapsed)) {
+		sr_session_stats_free(&stats);
+		return;
+	}
+
+	stats_totals(&stats, &samples, &bytes);
+	fprintf(stderr, "cli: %.2f MS/s, %.2f MB/s",
+		(double)(samples - last_samples) * 1000 / dt,
+		(double)(bytes - last_bytes) * 1000 / dt);
+	for (i = 0; i < stats.num_callbacks; i++) {
+		cs = &stats.callbacks[i];
+		if (cs->callback == stats_in)
+			continue;
+		/* Callbacks stay in the same order. */
+		last = i < last_num_callbacks ? &last_callbacks[i] : NULL;
+		if (last && last->callback != cs->callback)
+			last = NULL;
+		calls = cs->num_calls - (last ? last->num_calls : 0);
+		if (!calls)
+			continue;
+		fprintf(stderr, ", %s %.3f ms/call", callback_name(cs),
+			(cs->time_total - (last ? last->time_total : 0))
+			/ calls / 1000000.0);
+	}
+	fprintf(stderr, "\n");
+
+	last_elapsed = stats.elapsed;
+	last_samples = samples;
+	last_bytes = bytes;
+	g_free(last_callbacks);
+	last_callbacks = stats.callbacks;
+	last_num_callbacks = stats.num_callbacks;
+	stats.callbacks = NULL;
+	sr_session_stats_free(&stats);
+}
+
+static void show_session_stats(void)
+{
+	struct sr_session_stats stats;
+	struct sr_callback_stats *cs;
+	struct sr_device_stats *ds;
+	uint64_t samples, bytes;
+	double secs;
+	int i;
+
+	if (sr_session_get_stats(&stats) != SR_OK)
+		return;
+
+	secs = stats.elapsed / 1000000000.0;
+	stats_totals(&stats, &samples, &bytes);
+	fprintf(stderr, "cli: %" PRIu64 " samples, %" PRIu64 " bytes in %.3f s"
+		" (%.2f MS/s, %.2f MB/s)\n", samples, bytes, secs,
+		secs > 0 ? samples / secs / 1000000 : 0,
+		secs > 0 ? bytes / secs / 1000000 : 0);
+	fprintf(stderr, "cli: %" PRIu64 " source wakeups, %" PRIu64
+		" timeouts\n", stats.num_wakeups, stats.num_timeouts);
+	for (i = 0; i < stats.num_devices; i++) {
+		ds = &stats.devices[i];
+		fprintf(stderr, "cli: device %d: %" PRIu64 " packets, %" PRIu64
+			" samples, %" PRIu64 " triggers", i + 1,
+			ds->num_packets, ds->num_samples, ds->num_triggers);
+		/* Only devices in a threaded session lag. */
+		if (ds->max_lag)
+			fprintf(stderr, ", lag %.3f ms (max %.3f ms)",
+				ds->lag / 1000000000.0,
+				ds->max_lag / 1000000000.0);
+		fprintf(stderr, "\n");
+	}
+	for (i = 0; i < stats.num_callbacks; i++) {
+		cs = &stats.callbacks[i];
+		if (cs->callback == stats_in)
+			continue;
+		fprintf(stderr, "cli: %s: %" PRIu64 " calls, %.3f ms total, "
+			"min/avg/max/p99 %.3f/%.3f/%.3f/%.3f ms\n",
+			callback_name(cs), cs->num_calls,
+			cs->time_total / 1000000.0, cs->time_min / 1000000.0,
+			cs->time_avg / 1000000.0, cs->time_max / 1000000.0,
+			cs->time_p99 / 1000000.0);
+	}
 
+	sr_session_stats_free(&stats);
 }
 
 /* Register the given PDs for this session. */
@@ -565,6 +894,10 @@ static void load_input_file_format(void)
 
 	sr_session_new();
 	sr_session_datafeed_callback_add(datafeed_in);
+	if (opt_stats) {
+		sr_session_datafeed_callback_add(stats_in);
+		sr_session_set_timing(TRUE);
+	}
 	if (sr_session_device_add(in->vdevice) != SR_OK) {
 		printf("Failed to use device.\n");
 		sr_session_destroy();
@@ -572,11 +905,14 @@ static void load_input_file_format(void)
 	}
 
 	input_format->loadfile(in, opt_input_file);
+	if (opt_stats)
+		show_session_stats();
 	if (opt_output_file && default_output_format) {
 		if (sr_session_save(opt_output_file) != SR_OK)
 			printf("Failed to save session.\n");
 	}
 	sr_session_destroy();
+	feeds_free();
 
 }
 
@@ -586,9 +922,16 @@ static void load_input_file(void)
 	if (sr_session_load(opt_input_file) == SR_OK) {
 		/* sigrok session file */
 		sr_session_datafeed_callback_add(datafeed_in);
+		if (opt_stats) {
+			sr_session_datafeed_callback_add(stats_in);
+			sr_session_set_timing(TRUE);
+		}
 		sr_session_start();
 		sr_session_run();
 		sr_session_stop();
+		if (opt_stats)
+			show_session_stats();
+		feeds_free();
 	}
 	else {
 		/* fall back on input modules */
@@ -674,74 +1017,67 @@ int set_device_options(struct sr_device *device, GHashTable *args)
 	return SR_OK;
 }
 
-static void run_session(void)
+/* Add a device to the session, and set it up as the options say. */
+static int add_device(const char *devstring)
 {
-	struct sr_device *device;
+	struct sr_device *device, *other;
 	GHashTable *devargs;
-	int num_devices, max_probes, *capabilities, i;
+	GSList *l;
+	int max_probes, *capabilities, i;
 	uint64_t tmp_u64, time_msec;
-	char **probelist, *devspec;
-
-	devargs = NULL;
-	if (opt_device) {
-		devargs = parse_generic_arg(opt_device);
-		devspec = g_hash_table_lookup(devargs, "sigrok_key");
-		device = parse_devicestring(devspec);
-		if (!device) {
-			g_warning("Device not found.");
-			return;
-		}
-		g_hash_table_remove(devargs, "sigrok_key");
-	} else {
-		num_devices = num_real_devices();
-		if (num_devices == 1) {
-			/* No device specified, but there is only one. */
-			devargs = NULL;
-			device = parse_devicestring("0");
-		} else if (num_devices == 0) {
-			printf("No devices found.\n");
-			return;
-		} else {
-			printf("%d devices found, please select one.\n", num_devices);
-			return;
+	char **probelist;
+
+	if (!(devargs = parse_generic_arg(devstring))) {
+		g_warning("Device not found.");
+		return SR_ERR;
+	}
+	device = parse_devicestring(g_hash_table_lookup(devargs, "sigrok_key"));
+	if (!device) {
+		g_warning("Device not found.");
+		g_hash_table_destroy(devargs);
+		return SR_ERR;
+	}
+	g_hash_table_remove(devargs, "sigrok_key");
+
+	/* This driver keeps its acquisition state for all its devices. */
+	for (l = sr_session_get_current()->devices; l; l = l->next) {
+		other = l->data;
+		if (other->plugin == device->plugin
+		    && !strcmp(device->plugin->name, "zeroplus-logic-cube")) {
+			printf("Only one %s device can be used at a time.\n",
+			       device->plugin->name);
+			g_hash_table_destroy(devargs);
+			return SR_ERR;
 		}
 	}
 
-	sr_session_new();
-	sr_session_datafeed_callback_add(datafeed_in);
-
 	if (sr_session_device_add(device) != SR_OK) {
 		printf("Failed to use device.\n");
-		sr_session_destroy();
-		return;
+		g_hash_table_destroy(devargs);
+		return SR_ERR;
 	}
 
-	if (devargs) {
-		if (set_device_options(device, devargs) != SR_OK) {
-			sr_session_destroy();
-			return;
-		}
+	if (set_device_options(device, devargs) != SR_OK) {
 		g_hash_table_destroy(devargs);
+		return SR_ERR;
 	}
+	g_hash_table_destroy(devargs);
 
 	if (select_probes(device) != SR_OK)
-            return;
+		return SR_ERR;
 
 	if (opt_continuous) {
 		capabilities = device->plugin->get_capabilities();
 		if (!sr_find_hwcap(capabilities, SR_HWCAP_CONTINUOUS)) {
 			printf("This device does not support continuous sampling.");
-			sr_session_destroy();
-			return;
+			return SR_ERR;
 		}
 	}
 
 	if (opt_triggers) {
 		probelist = sr_parse_triggerstring(device, opt_triggers);
-		if (!probelist) {
-			sr_session_destroy();
-			return;
-		}
+		if (!probelist)
+			return SR_ERR;
 
 		max_probes = g_slist_length(device->probes);
 		for (i = 0; i < max_probes; i++) {
@@ -757,8 +1093,7 @@ static void run_session(void)
 		time_msec = sr_parse_timestring(opt_time);
 		if (time_msec == 0) {
 			printf("Invalid time '%s'\n", opt_time);
-			sr_session_destroy();
-			return;
+			return SR_ERR;
 		}
 
 		capabilities = device->plugin->get_capabilities();
@@ -766,8 +1101,7 @@ static void run_session(void)
 			if (device->plugin->set_configuration(device->plugin_index,
 							  SR_HWCAP_LIMIT_MSEC, &time_msec) != SR_OK) {
 				printf("Failed to configure time limit.\n");
-				sr_session_destroy();
-				return;
+				return SR_ERR;
 			}
 		}
 		else {
@@ -782,15 +1116,13 @@ static void run_session(void)
 			}
 			if (limit_samples == 0) {
 				printf("Not enough time at this samplerate.\n");
-				sr_session_destroy();
-				return;
+				return SR_ERR;
 			}
 
 			if (device->plugin->set_configuration(device->plugin_index,
 						  SR_HWCAP_LIMIT_SAMPLES, &limit_samples) != SR_OK) {
 				printf("Failed to configure time-based sample limit.\n");
-				sr_session_destroy();
-				return;
+				return SR_ERR;
 			}
 		}
 	}
@@ -800,21 +1132,100 @@ static void run_session(void)
 		if (device->plugin->set_configuration(device->plugin_index,
 					  SR_HWCAP_LIMIT_SAMPLES, &limit_samples) != SR_OK) {
 			printf("Failed to configure sample limit.\n");
-			sr_session_destroy();
-			return;
+			return SR_ERR;
 		}
 	}
 
 	if (device->plugin->set_configuration(device->plugin_index,
 		  SR_HWCAP_PROBECONFIG, (char *)device->probes) != SR_OK) {
 		printf("Failed to configure probes.\n");
+		return SR_ERR;
+	}
+
+	/* The sample limit may differ between devices. */
+	if (!device_feed(device))
+		return SR_ERR_MALLOC;
+
+	return SR_OK;
+}
+
+static void run_session(void)
+{
+	GSList *l;
+	int num_devices, i;
+
+	if (opt_devices) {
+		num_devices = g_strv_length(opt_devices);
+	} else {
+		num_devices = num_real_devices();
+		if (num_devices == 0) {
+			printf("No devices found.\n");
+			return;
+		} else if (num_devices > 1) {
+			printf("%d devices found, please select one.\n", num_devices);
+			return;
+		}
+	}
+
+	if (num_devices > 1) {
+		if (!opt_output_file || !default_output_format) {
+			printf("Several devices can only be saved to a file "
+			       "in session format.\n");
+			return;
+		}
+		if (opt_pds) {
+			printf("Protocol decoders only work with one device.\n");
+			return;
+		}
+	}
+
+	if (opt_max_memory && sr_parse_sizestring(opt_max_memory) == 0) {
+		printf("Invalid memory size '%s'.\n", opt_max_memory);
+		return;
+	}
+
+	if (opt_ring || opt_ring_memory) {
+		if (!opt_output_file || !default_output_format
+		    || opt_max_memory) {
+			printf("Flight recorder mode needs an output file in "
+			       "session format, and can't be combined with "
+			       "--max-memory.\n");
+			return;
+		}
+#ifdef SIGUSR1
+		signal(SIGUSR1, freeze_handler);
+#endif
+	}
+
+	sr_session_new();
+	sr_session_datafeed_callback_add(datafeed_in);
+	if (opt_stats) {
+		sr_session_datafeed_callback_add(stats_in);
+		sr_session_set_timing(TRUE);
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		/* No device specified, but there is only one. */
+		if (add_device(opt_devices ? opt_devices[i] : "0") != SR_OK) {
+			sr_session_destroy();
+			feeds_free();
+			return;
+		}
+	}
+
+	/* Every device gets a thread, and their samples are put in order. */
+	if (num_devices > 1
+	    && sr_session_set_threaded(TRUE, MERGE_LATENCY) != SR_OK) {
+		printf("Failed to set up a threaded session.\n");
 		sr_session_destroy();
+		feeds_free();
 		return;
 	}
 
 	if (sr_session_start() != SR_OK) {
 		printf("Failed to start session.\n");
 		sr_session_destroy();
+		feeds_free();
 		return;
 	}
 
@@ -826,11 +1237,17 @@ static void run_session(void)
 	if (opt_continuous)
 		clear_anykey();
 
+	if (opt_stats)
+		show_session_stats();
+
 	if (opt_output_file && default_output_format) {
+		for (l = feeds; l; l = l->next)
+			show_datastore_stats(((struct device_feed *)l->data)->device);
 		if (sr_session_save(opt_output_file) != SR_OK)
 			printf("Failed to save session.\n");
 	}
 	sr_session_destroy();
+	feeds_free();
 
 }
 
@@ -894,6 +1311,9 @@ int main(int argc, char **argv)
 	if (sr_init() != SR_OK)
 		return 1;
 
+	if (opt_trace && sr_trace_start(TRACE_EVENTS) != SR_OK)
+		return 1;
+
 	if (opt_pds) {
 		/* TODO: Error handling. */
 		srd_init();
@@ -941,11 +1361,16 @@ int main(int argc, char **argv)
 		load_input_file();
 	else if (opt_samples || opt_time || opt_continuous)
 		run_session();
-	else if (opt_device)
+	else if (opt_devices)
 		show_device_detail();
 	else
 		printf("%s", g_option_context_get_help(context, TRUE, NULL));
 
+	if (opt_trace) {
+		sr_trace_stop();
+		sr_trace_save(opt_trace);
+	}
+
 	if (opt_pds)
 		srd_exit();
 
@@ -36,6 +36,9 @@ static const char *colours[8] = {
 static void
 datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 {
+	static struct sr_filter_plan *filter = NULL;
+	static unsigned char *filter_buf = NULL;
+	static uint64_t filter_buf_size = 0;
 	static int probelist[65] = { 0 };
 	static int unitsize = 0;
 	struct sr_probe *probe;
@@ -43,8 +46,9 @@ datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 	struct sr_datafeed_logic *logic = NULL;
 	int num_enabled_probes, sample_size, i;
 	uint64_t filter_out_len;
-	char *filter_out;
+	const unsigned char *filter_out;
 	GArray *data;
+	struct sr_datastore *ds;
 
 	switch (packet->type) {
 	case SR_DF_HEADER:
@@ -65,15 +69,37 @@ datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 						-1);
 			}
 		}
+		probelist[num_enabled_probes] = 0;
 		/* How many bytes we need to store num_enabled_probes bits */
 		unitsize = (num_enabled_probes + 7) / 8;
+
+		sr_filter_plan_destroy(filter);
+		if (sr_filter_plan_new((header->num_logic_probes + 7) / 8,
+				unitsize, probelist, &filter) != SR_OK)
+			filter = NULL;
+
 		data = g_array_new(FALSE, FALSE, unitsize);
 		g_object_set_data(G_OBJECT(siglist), "sampledata", data);
 
+		/* The datastore keeps the summaries used when zoomed out. */
+		ds = NULL;
+		if (sr_datastore_new(unitsize, &ds) != SR_OK
+		    || sr_datastore_enable_summary(ds) != SR_OK) {
+			sr_datastore_destroy(ds);
+			ds = NULL;
+		}
+		g_object_set_data_full(G_OBJECT(siglist), "datastore", ds,
+				(GDestroyNotify)sr_datastore_destroy);
+
 		break;
 	case SR_DF_END:
 		sigview_zoom(sigview, 1, 0);
 		g_message("cli: Received SR_DF_END");
+		sr_filter_plan_destroy(filter);
+		filter = NULL;
+		g_free(filter_buf);
+		filter_buf = NULL;
+		filter_buf_size = 0;
 		sr_session_halt();
 		break;
 	case SR_DF_TRIGGER:
@@ -91,11 +117,21 @@ datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 		break;
 	}
 
-	if (!logic)
+	if (!logic || !filter)
 		return;
 
-	if (sr_filter_probes(sample_size, unitsize, probelist,
+	if (logic->length > filter_buf_size) {
+		g_free(filter_buf);
+		if (!(filter_buf = g_try_malloc(logic->length))) {
+			filter_buf_size = 0;
+			return;
+		}
+		filter_buf_size = logic->length;
+	}
+
+	if (sr_filter_plan_apply(filter, sample_size,
 				   logic->data, logic->length,
+				   filter_buf, filter_buf_size,
 				   &filter_out, &filter_out_len) != SR_OK)
 		return;
 
@@ -103,6 +139,11 @@ datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 	g_return_if_fail(data != NULL);
 
 	g_array_append_vals(data, filter_out, filter_out_len);
+
+	ds = g_object_get_data(G_OBJECT(siglist), "datastore");
+	if (ds)
+		sr_datastore_put(ds, filter_out, filter_out_len,
+				 sample_size, probelist);
 }
 
 void load_input_file(GtkWindow *parent, const gchar *file)
@@ -211,7 +211,33 @@ GtkWidget *sigview_init(void)
 	return sw;
 }
 
-static GArray *summarize(GArray *in, gdouble *scale)
+/*
+ * Summarize using the summaries the datastore keeps, which takes a few
+ * lookups per output sample instead of looking at every input sample.
+ */
+static void summarize_datastore(struct sr_datastore *ds, GArray *ret,
+				guint64 skip)
+{
+	struct sr_summary sum;
+	guint64 i, k, s, diff;
+	unsigned unitsize = g_array_get_element_size(ret);
+
+	s = 0;
+	for (i = 0, k = 0; k < ret->len; i += skip, k++) {
+		if (sr_datastore_summarize(ds, i, skip, &sum) != SR_OK)
+			break;
+		/*
+		 * Same as below: a probe which differs from the current
+		 * value at the start of the block takes on the new value,
+		 * otherwise it toggles if it changes anywhere in the block.
+		 */
+		diff = s ^ sum.first;
+		s = (diff & sum.first) | (~diff & (s ^ sum.transitions));
+		memcpy(&ret->data[k * unitsize], &s, unitsize);
+	}
+}
+
+static GArray *summarize(GArray *in, struct sr_datastore *ds, gdouble *scale)
 {
 	GArray *ret;
 	int skip = 1 / (*scale * 4);
@@ -226,6 +252,11 @@ static GArray *summarize(GArray *in, gdouble *scale)
 	ret->len = in->len / skip;
 	*scale *= skip;
 
+	if (ds && ds->num_units >= in->len) {
+		summarize_datastore(ds, ret, skip);
+		return ret;
+	}
+
 	memset(s, 0, unitsize);
 	for (i = 0, k = 0; i < in->len; i += skip, k++) {
 		memset(smask, 0xFF, unitsize);
@@ -254,6 +285,7 @@ void sigview_zoom(GtkWidget *sigview, gdouble zoom, gint offset)
 	/* rdata and rscale refer to complete data */
 	GArray *rdata;
 	gdouble *rscale;
+	struct sr_datastore *ds;
 	gint ofs;
 	gint width;
 	guint nsamples;
@@ -273,6 +305,7 @@ void sigview_zoom(GtkWidget *sigview, gdouble zoom, gint offset)
 
 	siglist = G_OBJECT(gtk_tree_view_get_model(GTK_TREE_VIEW(sigview)));
 	rdata = g_object_get_data(siglist, "sampledata");
+	ds = g_object_get_data(siglist, "datastore");
 	rscale = g_object_get_data(siglist, "rscale");
 	if (!rscale) {
 		rscale = g_malloc(sizeof(rscale));
@@ -318,13 +351,14 @@ void sigview_zoom(GtkWidget *sigview, gdouble zoom, gint offset)
 
 	if (scale < 0.125) {
 		g_object_set_data(siglist,
-			"summarydata", summarize(data, &scale));
+			"summarydata", summarize(data,
+				data == rdata ? ds : NULL, &scale));
 		if (data && (data != rdata))
 			g_array_free(data, TRUE);
 	} else if ((scale > 1) && (*rscale < 1)) {
 		scale = *rscale;
 		g_object_set_data(siglist,
-			"summarydata", summarize(rdata, &scale));
+			"summarydata", summarize(rdata, ds, &scale));
 		if (data && (data != rdata))
 			g_array_free(data, TRUE);
 	}
@@ -23,7 +23,13 @@
 #include "ui_channelform.h"
 #include <stdint.h>
 
+extern "C" {
+#include <glib.h>
+#include <sigrok.h>
+}
+
 extern uint8_t *sample_buffer;
+extern struct sr_datastore *sample_datastore;
 
 /* WHEEL_DELTA was introduced in Qt 4.6, earlier versions don't have it. */
 #ifndef WHEEL_DELTA
@@ -96,7 +102,8 @@ void ChannelForm::generatePainterPath(void)
 	int current_y, oldval, newval, x_change_visible;
 	int low = m_ui->renderAreaWidget->height() - 2, high = 20;
 	int ch = getChannelNumber();
-	uint64_t ss, se;
+	uint64_t ss, se, n;
+	struct sr_summary sum;
 
 	if (sample_buffer == NULL)
 		return;
@@ -121,6 +128,30 @@ void ChannelForm::generatePainterPath(void)
 	// 	 << "(" << ss << " - " << se << ")";
 
 	for (uint64_t i = ss; i < se; i += scaleFactor) {
+		/*
+		 * Zoomed out, draw the step from the summary of its samples
+		 * instead of looking at every one of them. A probe which
+		 * changes anywhere in the step gets a full-height line.
+		 */
+		n = MIN((uint64_t)scaleFactor, se - i);
+		if (scaleFactor > 1 && sample_datastore
+		    && sr_datastore_summarize(sample_datastore, i, n,
+					      &sum) == SR_OK) {
+			newval = (sum.last >> ch) & 1;
+			if ((int)((sum.first >> ch) & 1) != oldval
+			    || (sum.transitions >> ch) & 1) {
+				painterPath->lineTo(current_x, current_y);
+				painterPath->lineTo(current_x,
+					(current_y == high) ? low : high);
+				current_y = (newval) ? high : low;
+				painterPath->lineTo(current_x, current_y);
+				old_x = current_x;
+				oldval = newval;
+			}
+			current_x += (double)stepSize * n / scaleFactor;
+			continue;
+		}
+
 		/* Process the samples shown in this step. */
 		for (uint64_t j = 0; (j < scaleFactor) && (i + j < se); j++) {
 			newval = getbit(sample_buffer, i + j, ch);
@@ -32,6 +32,7 @@ extern "C" {
 #include "mainwindow.h"
 
 uint8_t *sample_buffer;
+struct sr_datastore *sample_datastore;
 MainWindow *w;
 
 int main(int argc, char *argv[])
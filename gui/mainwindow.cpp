@@ -53,6 +53,18 @@ uint64_t limit_samples = 0; /* FIXME */
 
 QProgressDialog *progress = NULL;
 
+/* The samples also go into a datastore, for its summaries when zoomed out. */
+static void sample_datastore_new(void)
+{
+	sr_datastore_destroy(sample_datastore);
+	sample_datastore = NULL;
+	if (sr_datastore_new(1, &sample_datastore) != SR_OK
+	    || sr_datastore_enable_summary(sample_datastore) != SR_OK) {
+		sr_datastore_destroy(sample_datastore);
+		sample_datastore = NULL;
+	}
+}
+
 MainWindow::MainWindow(QWidget *parent)
 	: QMainWindow(parent), ui(new Ui::MainWindow)
 {
@@ -377,6 +389,11 @@ void MainWindow::on_action_Open_triggered()
 
 	in.readRawData((char *)sample_buffer, file.size());
 
+	sample_datastore_new();
+	if (sample_datastore)
+		sr_datastore_put(sample_datastore, sample_buffer, file.size(),
+				 1, NULL);
+
 	setNumSamples(file.size());
 	setNumChannels(8); /* FIXME */
 
@@ -442,14 +459,19 @@ void MainWindow::on_action_Save_as_triggered()
 void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 {
 	static int num_probes = 0;
+	static struct sr_filter_plan *filter = NULL;
+	static unsigned char *filter_buf = NULL;
+	static uint64_t filter_buf_size = 0;
 	static int probelist[65] = {0};
+	static int unitsize = 0;
 	static uint64_t received_samples = 0;
 	static int triggered = 0;
 	struct sr_probe *probe;
 	struct sr_datafeed_header *header;
 	struct sr_datafeed_logic *logic;
 	int num_enabled_probes, sample_size;
-	uint64_t sample;
+	uint64_t filter_out_len, first_sample;
+	const unsigned char *filter_out;
 
 	/* If the first packet to come in isn't a header, don't even try. */
 	// if (packet->type != SR_DF_HEADER && o == NULL)
@@ -473,6 +495,13 @@ void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 			if (probe->enabled)
 				probelist[num_enabled_probes++] = probe->index;
 		}
+		probelist[num_enabled_probes] = 0;
+
+		sr_filter_plan_destroy(filter);
+		unitsize = (num_enabled_probes + 7) / 8;
+		if (sr_filter_plan_new((num_probes + 7) / 8, unitsize,
+				       probelist, &filter) != SR_OK)
+			filter = NULL;
 
 		qDebug() << "Acquisition with" << num_enabled_probes << "/"
 			 << num_probes << "probes at"
@@ -485,6 +514,11 @@ void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 	case SR_DF_END:
 		qDebug("SR_DF_END");
 		/* TODO: o */
+		sr_filter_plan_destroy(filter);
+		filter = NULL;
+		g_free(filter_buf);
+		filter_buf = NULL;
+		filter_buf_size = 0;
 		sr_session_halt();
 		progress->setValue(received_samples); /* FIXME */
 		break;
@@ -504,7 +538,7 @@ void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 		break;
 	}
 
-	if (sample_size == -1)
+	if (sample_size == -1 || !filter)
 		return;
 	
 	/* Don't store any samples until triggered. */
@@ -514,17 +548,34 @@ void datafeed_in(struct sr_device *device, struct sr_datafeed_packet *packet)
 	if (received_samples >= limit_samples)
 		return;
 
-	/* TODO */
+	if (logic->length > filter_buf_size) {
+		g_free(filter_buf);
+		if (!(filter_buf = (unsigned char *)g_try_malloc(logic->length))) {
+			filter_buf_size = 0;
+			return;
+		}
+		filter_buf_size = logic->length;
+	}
 
+	if (sr_filter_plan_apply(filter, sample_size,
+				 (const unsigned char *)logic->data,
+				 logic->length, filter_buf, filter_buf_size,
+				 &filter_out, &filter_out_len) != SR_OK)
+		return;
+
+	/* Only the first byte of every (filtered) sample is kept for now. */
+	first_sample = received_samples;
 	for (uint64_t i = 0; received_samples < limit_samples
-			     && i < logic->length; i += sample_size) {
-		sample = 0;
-		memcpy(&sample, (char *)packet->payload + i, sample_size);
-		sample_buffer[i] = (uint8_t)(sample & 0xff); /* FIXME */
-		// qDebug("Sample %" PRIu64 ": 0x%x", i, sample);
+			     && i < filter_out_len; i += unitsize) {
+		sample_buffer[received_samples] =
+			(uint8_t)filter_out[i]; /* FIXME */
 		received_samples++;
 	}
 
+	if (sample_datastore)
+		sr_datastore_put(sample_datastore, sample_buffer + first_sample,
+				 received_samples - first_sample, 1, NULL);
+
 	progress->setValue(received_samples);
 }
 
@@ -559,6 +610,7 @@ void MainWindow::on_action_Get_samples_triggered()
 		/* TODO: Error handling. */
 		return;
 	}
+	sample_datastore_new();
 
 	sr_session_new();
 	sr_session_datafeed_callback_add(datafeed_in);
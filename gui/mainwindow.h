@@ -29,6 +29,7 @@
 #include "channelform.h"
 
 extern uint8_t *sample_buffer;
+extern struct sr_datastore *sample_datastore;
 
 namespace Ui
 {
@@ -40,6 +40,7 @@ int sr_exit(void)
 {
 
 	sr_cleanup_hwplugins();
+	sr_mempool_cleanup();
 
 	return SR_OK;
 }
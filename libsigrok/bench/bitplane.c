@@ -0,0 +1,135 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares an interleaved datastore against a bit-plane one: storing
+ * samples, reading back a single probe, and reading back whole units.
+ *
+ * Usage: bench-bitplane [units]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <glib.h>
+#include <sigrok.h>
+
+#define DEFAULT_UNITS	(16 * 1024 * 1024)
+#define PUT_SIZE	(64 * 1024)
+#define ROUNDS		5
+
+static uint64_t num_units = DEFAULT_UNITS;
+static uint8_t *samples, *bitmap, *units;
+
+/* Best of ROUNDS, in milliseconds. */
+static double best(double *times)
+{
+	double t;
+	int i;
+
+	t = times[0];
+	for (i = 1; i < ROUNDS; i++)
+		t = MIN(t, times[i]);
+
+	return t * 1000;
+}
+
+static int bench(const char *name, int unitsize, int bitplane)
+{
+	struct sr_datastore *ds;
+	GTimer *timer;
+	double put[ROUNDS], probe[ROUNDS], range[ROUNDS];
+	uint64_t pos, len;
+	int round, ret;
+
+	timer = g_timer_new();
+	for (round = 0; round < ROUNDS; round++) {
+		if (bitplane)
+			ret = sr_datastore_new_bitplane(unitsize, &ds);
+		else
+			ret = sr_datastore_new(unitsize, &ds);
+		if (ret != SR_OK)
+			return ret;
+
+		g_timer_start(timer);
+		for (pos = 0; pos < num_units; pos += len) {
+			len = MIN(PUT_SIZE, num_units - pos);
+			sr_datastore_put(ds, samples + pos * unitsize,
+					 len * unitsize, unitsize, NULL);
+		}
+		put[round] = g_timer_elapsed(timer, NULL);
+
+		g_timer_start(timer);
+		sr_datastore_get_probe(ds, 3, 0, num_units, bitmap);
+		probe[round] = g_timer_elapsed(timer, NULL);
+
+		g_timer_start(timer);
+		sr_datastore_get_range(ds, 0, num_units, units);
+		range[round] = g_timer_elapsed(timer, NULL);
+
+		sr_datastore_destroy(ds);
+	}
+	g_timer_destroy(timer);
+
+	printf("%-10s %8d %10.1f %10.1f %10.1f\n", name, unitsize,
+	       best(put), best(probe), best(range));
+
+	return SR_OK;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t i, lfsr;
+	int unitsize;
+
+	if (argc > 1)
+		num_units = strtoull(argv[1], NULL, 10);
+
+	if (!(samples = g_try_malloc(num_units * 4))
+	    || !(units = g_try_malloc(num_units * 4))
+	    || !(bitmap = g_try_malloc(num_units / 8 + 1))) {
+		fprintf(stderr, "bench: sample buffer malloc failed\n");
+		return 1;
+	}
+
+	/* Slowly toggling low probes, noise on the high ones. */
+	lfsr = 0xace1;
+	for (i = 0; i < num_units * 4; i++) {
+		lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xd0000001);
+		samples[i] = (i % 4) ? lfsr : (i >> 10);
+	}
+
+	printf("%" PRIu64 " units, best of %d rounds, times in ms\n",
+	       num_units, ROUNDS);
+	printf("%-10s %8s %10s %10s %10s\n", "mode", "unitsize", "put",
+	       "get_probe", "get_range");
+	for (unitsize = 1; unitsize <= 4; unitsize *= 2) {
+		if (bench("memory", unitsize, FALSE) != SR_OK
+		    || bench("bitplane", unitsize, TRUE) != SR_OK) {
+			fprintf(stderr, "bench: datastore creation failed\n");
+			return 1;
+		}
+	}
+
+	g_free(samples);
+	g_free(units);
+	g_free(bitmap);
+
+	return 0;
+}
@@ -0,0 +1,412 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sends bursts of logic packets over the session bus to a callback which
+ * is slower than the bursts, but keeps up on average. Shows how long the
+ * sender is held up, and what the callback gets, with each policy for
+ * asynchronous callbacks.
+ *
+ * Then sends many small logic packets to a callback with a fixed cost
+ * per call, with and without coalescing them into bigger ones.
+ *
+ * Finally, sends 32 probe logic packets to several callbacks which only
+ * look at two of the probes: once with plain datafeed callbacks, which
+ * each pick out those probes with a filter plan of their own, and once
+ * with subscriptions which get only those probes.
+ *
+ * Usage: bench-bus
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+
+#define PACKET_SIZE	4096
+#define BURSTS		10
+#define BURST_PACKETS	2000
+#define PAUSE_US	50000
+#define QUEUE_PACKETS	64
+/* Time the slow callback spends on each logic packet */
+#define CALLBACK_US	20
+#define SMALL_PACKETS	100000
+#define SMALL_SIZE	64
+/* Fixed time the callback spends on every call */
+#define CALL_US		2
+#define WIDE_PACKETS	2000
+#define WIDE_UNITSIZE	4
+#define WIDE_UNITS	16384
+/* Callbacks watching probes 9 and 10 */
+#define NUM_WATCHERS	3
+#define WATCH_SHIFT	8
+
+static GTimer *cb_timer;
+static uint64_t delivered, num_calls, checksum;
+static uint64_t watch_edges[NUM_WATCHERS];
+static struct sr_filter_plan *watch_plans[NUM_WATCHERS];
+static uint8_t *watch_bufs[NUM_WATCHERS];
+
+static void spin(GTimer *timer, double usecs)
+{
+	g_timer_start(timer);
+	while (g_timer_elapsed(timer, NULL) * 1000000 < usecs)
+		;
+}
+
+static void slow_in(struct sr_device *device,
+		    struct sr_datafeed_packet *packet)
+{
+	/* Avoid compiler warnings. */
+	(void)device;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+
+	spin(cb_timer, CALLBACK_US);
+	delivered++;
+}
+
+static void call_in(struct sr_device *device,
+		    struct sr_datafeed_packet *packet)
+{
+	struct sr_datafeed_logic *logic;
+	const uint8_t *data;
+	uint64_t i;
+
+	/* Avoid compiler warnings. */
+	(void)device;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+
+	spin(cb_timer, CALL_US);
+	logic = packet->payload;
+	data = logic->data;
+	for (i = 0; i < logic->length; i++)
+		checksum += data[i];
+	num_calls++;
+}
+
+/* Count the changes on the two watched probes. */
+static void watch(int n, struct sr_datafeed_packet *packet)
+{
+	struct sr_datafeed_logic *logic;
+	const uint8_t *data;
+	uint64_t length, i;
+	uint8_t last;
+
+	if (packet->type != SR_DF_LOGIC)
+		return;
+
+	logic = packet->payload;
+	data = logic->data;
+	length = logic->length;
+	if (logic->unitsize != 1) {
+		/* Not projected, pick out the watched probes first. */
+		sr_filter_plan_apply(watch_plans[n], logic->unitsize,
+				     logic->data, logic->length, watch_bufs[n],
+				     logic->length, &data, &length);
+	}
+
+	last = 0;
+	for (i = 0; i < length; i++) {
+		if (data[i] != last)
+			watch_edges[n]++;
+		last = data[i];
+	}
+}
+
+static void watch0_in(struct sr_device *device,
+		      struct sr_datafeed_packet *packet)
+{
+	(void)device;
+	watch(0, packet);
+}
+
+static void watch1_in(struct sr_device *device,
+		      struct sr_datafeed_packet *packet)
+{
+	(void)device;
+	watch(1, packet);
+}
+
+static void watch2_in(struct sr_device *device,
+		      struct sr_datafeed_packet *packet)
+{
+	(void)device;
+	watch(2, packet);
+}
+
+static sr_datafeed_callback watchers[NUM_WATCHERS] = {
+	watch0_in, watch1_in, watch2_in,
+};
+
+static void send_header(void)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+
+	memset(&header, 0, sizeof(header));
+	header.feed_version = 1;
+	header.samplerate = SR_MHZ(1);
+	header.num_logic_probes = 8;
+	memset(&packet, 0, sizeof(packet));
+	packet.type = SR_DF_HEADER;
+	packet.payload = &header;
+	sr_session_bus(NULL, &packet);
+}
+
+static void send_end(void)
+{
+	struct sr_datafeed_packet packet;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.type = SR_DF_END;
+	sr_session_bus(NULL, &packet);
+}
+
+/* Send a header, bursts of logic packets and an end packet. */
+static void send_bursts(double *send_ms, double *stall_ms)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	static uint8_t buf[PACKET_SIZE];
+	GTimer *timer;
+	double t;
+	int burst, i;
+
+	send_header();
+	memset(&packet, 0, sizeof(packet));
+	timer = g_timer_new();
+	*send_ms = *stall_ms = 0;
+	for (burst = 0; burst < BURSTS; burst++) {
+		for (i = 0; i < BURST_PACKETS; i++) {
+			memset(buf, i, sizeof(buf));
+			logic.length = PACKET_SIZE;
+			logic.unitsize = 1;
+			logic.buffer = NULL;
+			logic.data = buf;
+			packet.type = SR_DF_LOGIC;
+			packet.payload = &logic;
+			packet.timeoffset += packet.duration;
+			packet.duration = PACKET_SIZE * 1000000ULL;
+			g_timer_start(timer);
+			sr_session_bus(NULL, &packet);
+			t = g_timer_elapsed(timer, NULL) * 1000;
+			*send_ms += t;
+			*stall_ms = MAX(*stall_ms, t);
+		}
+		g_usleep(PAUSE_US);
+	}
+	g_timer_destroy(timer);
+
+	/* Only returns once the callback has seen everything. */
+	send_end();
+}
+
+static int bench_async(const char *name, int policy)
+{
+	uint64_t dropped, spilled;
+	double send_ms, stall_ms;
+
+	sr_session_new();
+	if (sr_session_datafeed_callback_add_async(slow_in, QUEUE_PACKETS,
+						   policy) != SR_OK) {
+		sr_session_destroy();
+		return SR_ERR;
+	}
+
+	delivered = 0;
+	send_bursts(&send_ms, &stall_ms);
+	sr_session_datafeed_callback_stats(slow_in, &dropped, &spilled);
+	printf("%-8s %10.1f %10.2f %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+	       "\n", name, send_ms, stall_ms, delivered, dropped, spilled);
+	sr_session_destroy();
+
+	return SR_OK;
+}
+
+static int bench_coalesce(uint64_t max_bytes)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_packet_stats stats;
+	static uint8_t buf[SMALL_SIZE];
+	GTimer *timer;
+	double total_ms;
+	int i;
+
+	sr_session_new();
+	sr_session_datafeed_callback_add(call_in);
+	if (sr_session_coalesce(max_bytes, 0) != SR_OK) {
+		sr_session_destroy();
+		return SR_ERR;
+	}
+
+	num_calls = 0;
+	timer = g_timer_new();
+	send_header();
+	memset(&packet, 0, sizeof(packet));
+	for (i = 0; i < SMALL_PACKETS; i++) {
+		memset(buf, i, sizeof(buf));
+		logic.length = SMALL_SIZE;
+		logic.unitsize = 1;
+		logic.buffer = NULL;
+		logic.data = buf;
+		packet.type = SR_DF_LOGIC;
+		packet.payload = &logic;
+		packet.timeoffset += packet.duration;
+		packet.duration = SMALL_SIZE * 1000000ULL;
+		sr_session_bus(NULL, &packet);
+	}
+	/* Sends whatever is still held back. */
+	send_end();
+	total_ms = g_timer_elapsed(timer, NULL) * 1000;
+	g_timer_destroy(timer);
+
+	sr_session_get_packet_stats(&stats);
+	printf("%-8" PRIu64 " %10.1f %10" PRIu64 " %10" PRIu64 "\n",
+	       max_bytes, total_ms, num_calls, stats.num_merged);
+	sr_session_destroy();
+
+	return SR_OK;
+}
+
+static int bench_subscribe(gboolean subscribe)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	uint8_t *buf;
+	uint64_t lfsr, i;
+	GTimer *timer;
+	double total_ms;
+	int n, ret;
+
+	if (!(buf = g_try_malloc(WIDE_UNITS * WIDE_UNITSIZE)))
+		return SR_ERR_MALLOC;
+	lfsr = 0xace1;
+	for (i = 0; i < WIDE_UNITS * WIDE_UNITSIZE; i++) {
+		lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xd0000001);
+		buf[i] = lfsr;
+	}
+
+	sr_session_new();
+	for (n = 0; n < NUM_WATCHERS; n++) {
+		watch_edges[n] = 0;
+		if (!subscribe) {
+			sr_session_datafeed_callback_add(watchers[n]);
+			continue;
+		}
+		ret = sr_session_subscribe(watchers[n], SR_DF_ALL,
+					   3ULL << WATCH_SHIFT);
+		if (ret != SR_OK) {
+			sr_session_destroy();
+			g_free(buf);
+			return ret;
+		}
+	}
+
+	timer = g_timer_new();
+	send_header();
+	memset(&packet, 0, sizeof(packet));
+	for (n = 0; n < WIDE_PACKETS; n++) {
+		logic.length = WIDE_UNITS * WIDE_UNITSIZE;
+		logic.unitsize = WIDE_UNITSIZE;
+		logic.buffer = NULL;
+		logic.data = buf;
+		packet.type = SR_DF_LOGIC;
+		packet.payload = &logic;
+		packet.timeoffset += packet.duration;
+		packet.duration = WIDE_UNITS * 1000000ULL;
+		sr_session_bus(NULL, &packet);
+	}
+	send_end();
+	total_ms = g_timer_elapsed(timer, NULL) * 1000;
+	g_timer_destroy(timer);
+
+	printf("%-10s %10.1f %10" PRIu64 "\n",
+	       subscribe ? "subscribed" : "callbacks", total_ms,
+	       watch_edges[0]);
+	sr_session_destroy();
+	g_free(buf);
+
+	return SR_OK;
+}
+
+int main(void)
+{
+	const int watched[] = { WATCH_SHIFT + 1, WATCH_SHIFT + 2, 0 };
+	int n;
+
+	g_thread_init(NULL);
+	cb_timer = g_timer_new();
+
+	for (n = 0; n < NUM_WATCHERS; n++) {
+		if (sr_filter_plan_new(WIDE_UNITSIZE, 1, watched,
+				       &watch_plans[n]) != SR_OK
+		    || !(watch_bufs[n] = g_try_malloc(WIDE_UNITS))) {
+			fprintf(stderr, "bench: filter setup failed\n");
+			return 1;
+		}
+	}
+
+	printf("%d bursts of %d packets of %d bytes, callback takes %d us "
+	       "per packet\n", BURSTS, BURST_PACKETS, PACKET_SIZE,
+	       CALLBACK_US);
+
+	printf("\nasynchronous callback, queue of %d packets:\n",
+	       QUEUE_PACKETS);
+	printf("%-8s %10s %10s %10s %10s %10s\n", "policy", "send ms",
+	       "stall ms", "delivered", "dropped", "spilled");
+	if (bench_async("block", SR_BUS_BLOCK) != SR_OK
+	    || bench_async("drop", SR_BUS_DROP) != SR_OK
+	    || bench_async("spill", SR_BUS_SPILL) != SR_OK) {
+		fprintf(stderr, "bench: failed to add callback\n");
+		return 1;
+	}
+
+	printf("\n%d packets of %d bytes, callback takes %d us per call:\n",
+	       SMALL_PACKETS, SMALL_SIZE, CALL_US);
+	printf("%-8s %10s %10s %10s\n", "coalesce", "total ms", "calls",
+	       "merged");
+	if (bench_coalesce(0) != SR_OK || bench_coalesce(4096) != SR_OK
+	    || bench_coalesce(65536) != SR_OK) {
+		fprintf(stderr, "bench: failed to set up coalescing\n");
+		return 1;
+	}
+
+	printf("\n%d packets of %d units of %d probes, %d callbacks watching "
+	       "probes %d and %d:\n", WIDE_PACKETS, WIDE_UNITS,
+	       WIDE_UNITSIZE * 8, NUM_WATCHERS, WATCH_SHIFT + 1,
+	       WATCH_SHIFT + 2);
+	printf("%-10s %10s %10s\n", "feed", "total ms", "changes");
+	if (bench_subscribe(FALSE) != SR_OK || bench_subscribe(TRUE) != SR_OK) {
+		fprintf(stderr, "bench: failed to subscribe\n");
+		return 1;
+	}
+
+	for (n = 0; n < NUM_WATCHERS; n++) {
+		sr_filter_plan_destroy(watch_plans[n]);
+		g_free(watch_bufs[n]);
+	}
+	g_timer_destroy(cb_timer);
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares the original bit by bit probe filter against a filter plan,
+ * for probe selections which hit each of the plan's kernels.
+ *
+ * Usage: bench-filter [bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+
+#define DEFAULT_BYTES	(64 * 1024 * 1024)
+#define ROUNDS		5
+
+struct filter_case {
+	const char *name;
+	int in_unitsize;
+	int probelist[65];
+};
+
+static const struct filter_case cases[] = {
+	{ "4 of 8, low nibble", 1, { 1, 2, 3, 4, 0 } },
+	{ "bytes 1,3 of 4", 4, { 9, 10, 11, 12, 13, 14, 15, 16,
+				 25, 26, 27, 28, 29, 30, 31, 32, 0 } },
+	{ "probes 5-20 of 32", 4, { 5, 6, 7, 8, 9, 10, 11, 12,
+				    13, 14, 15, 16, 17, 18, 19, 20, 0 } },
+	{ "8 of 16, reversed", 2, { 16, 14, 12, 10, 8, 6, 4, 2, 0 } },
+	{ "12 of 64, scattered", 8, { 1, 7, 13, 19, 25, 31, 37, 43,
+				      49, 55, 61, 64, 0 } },
+};
+
+/*
+ * The filter as it was before filter plans, walking every probe of
+ * every sample. Shifts are widened to 64 bits so that all cases work.
+ */
+static void filter_old(int in_unitsize, int out_unitsize, const int *probelist,
+		       const unsigned char *data_in, uint64_t length_in,
+		       unsigned char *data_out)
+{
+	uint64_t in_offset, out_offset, sample_in, sample_out;
+	int out_bit, i;
+
+	in_offset = out_offset = 0;
+	while (in_offset <= length_in - in_unitsize) {
+		sample_in = 0;
+		memcpy(&sample_in, data_in + in_offset, in_unitsize);
+		sample_out = out_bit = 0;
+		for (i = 0; probelist[i]; i++) {
+			if (sample_in & (1ULL << (probelist[i] - 1)))
+				sample_out |= (1ULL << out_bit);
+			out_bit++;
+		}
+		memcpy(data_out + out_offset, &sample_out, out_unitsize);
+		in_offset += in_unitsize;
+		out_offset += out_unitsize;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const struct filter_case *c;
+	struct sr_filter_plan *plan;
+	const unsigned char *out;
+	unsigned char *in, *buf_old, *buf_new;
+	GTimer *timer;
+	uint64_t length, length_out, lfsr, i;
+	double t_old, t_new, t;
+	int out_unitsize, num_probes, round;
+	unsigned int n;
+
+	length = DEFAULT_BYTES;
+	if (argc > 1)
+		length = strtoull(argv[1], NULL, 10);
+
+	if (!(in = g_try_malloc(length)) || !(buf_old = g_try_malloc(length))
+	    || !(buf_new = g_try_malloc(length))) {
+		fprintf(stderr, "bench: sample buffer malloc failed\n");
+		return 1;
+	}
+
+	lfsr = 0xace1;
+	for (i = 0; i < length; i++) {
+		lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xd0000001);
+		in[i] = lfsr;
+	}
+
+	printf("%" PRIu64 " bytes in, best of %d rounds\n", length, ROUNDS);
+	printf("%-22s %10s %10s %8s\n", "probes", "old MB/s", "plan MB/s",
+	       "speedup");
+
+	timer = g_timer_new();
+	for (n = 0; n < G_N_ELEMENTS(cases); n++) {
+		c = &cases[n];
+		for (num_probes = 0; c->probelist[num_probes]; num_probes++)
+			;
+		out_unitsize = (num_probes + 7) / 8;
+		if (sr_filter_plan_new(c->in_unitsize, out_unitsize,
+				       c->probelist, &plan) != SR_OK) {
+			fprintf(stderr, "bench: filter plan failed\n");
+			return 1;
+		}
+
+		t_old = t_new = G_MAXDOUBLE;
+		for (round = 0; round < ROUNDS; round++) {
+			g_timer_start(timer);
+			filter_old(c->in_unitsize, out_unitsize, c->probelist,
+				   in, length, buf_old);
+			t = g_timer_elapsed(timer, NULL);
+			t_old = MIN(t_old, t);
+
+			g_timer_start(timer);
+			sr_filter_plan_apply(plan, c->in_unitsize, in, length,
+					     buf_new, length, &out,
+					     &length_out);
+			t = g_timer_elapsed(timer, NULL);
+			t_new = MIN(t_new, t);
+		}
+		sr_filter_plan_destroy(plan);
+
+		if (memcmp(buf_old, out, length_out)) {
+			fprintf(stderr, "bench: '%s' output differs\n",
+				c->name);
+			return 1;
+		}
+
+		printf("%-22s %10.0f %10.0f %7.1fx\n", c->name,
+		       length / t_old / 1e6, length / t_new / 1e6,
+		       t_old / t_new);
+	}
+	g_timer_destroy(timer);
+
+	g_free(in);
+	g_free(buf_old);
+	g_free(buf_new);
+
+	return 0;
+}
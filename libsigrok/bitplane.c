@@ -0,0 +1,335 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Conversion between interleaved units and per-probe bit-planes.
+ *
+ * A bit-plane holds one bit per unit for a single probe, with unit n in
+ * bit n % 8 of byte n / 8. The planes of a chunk are stored one after
+ * the other, plane_size bytes apart.
+ *
+ * On x86, SSE2 and AVX2 versions of the kernels are picked at runtime if
+ * the CPU supports them. These gather one byte lane of 16 or 32 units into
+ * a vector register, and pull out each bit position with movemask.
+ * Everything else goes through the portable 8x8 bit matrix transpose.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Number of units extracted at a time by sr_bitplane_extract(). */
+#define EXTRACT_BLOCK 4096
+
+typedef void (*transpose_func)(const uint8_t *in, int unitsize,
+			       uint64_t num_units, uint8_t *planes,
+			       uint64_t plane_size, uint64_t byte_offset);
+
+/*
+ * Transpose an 8x8 bit matrix, with row i in byte i and column j in bit j
+ * (Hacker's Delight, 7-3).
+ */
+static uint64_t transpose8(uint64_t x)
+{
+	uint64_t t;
+
+	t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+	x ^= t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+	x ^= t ^ (t << 28);
+
+	return x;
+}
+
+/*
+ * Transpose groups of 8 units into the planes, starting at the given byte
+ * of each plane. num_units must be a multiple of 8.
+ */
+static void transpose_scalar(const uint8_t *in, int unitsize,
+			     uint64_t num_units, uint8_t *planes,
+			     uint64_t plane_size, uint64_t byte_offset)
+{
+	uint64_t x, g;
+	int b, i, j;
+
+	for (g = 0; g < num_units / 8; g++) {
+		for (b = 0; b < unitsize; b++) {
+			x = 0;
+			for (i = 0; i < 8; i++)
+				x |= (uint64_t)in[(g * 8 + i) * unitsize + b]
+				     << (i * 8);
+			x = transpose8(x);
+			for (j = 0; j < 8; j++)
+				planes[(b * 8 + j) * plane_size + byte_offset
+				       + g] = x >> (j * 8);
+		}
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static void transpose_sse2(const uint8_t *in, int unitsize,
+			   uint64_t num_units, uint8_t *planes,
+			   uint64_t plane_size, uint64_t byte_offset)
+{
+	uint8_t lane[16] __attribute__((aligned(16)));
+	uint16_t bits;
+	uint64_t g;
+	__m128i v;
+	int b, i, j;
+
+	for (g = 0; g < num_units / 16; g++) {
+		for (b = 0; b < unitsize; b++) {
+			if (unitsize == 1) {
+				v = _mm_loadu_si128((const __m128i *)
+						    (in + g * 16));
+			} else {
+				for (i = 0; i < 16; i++)
+					lane[i] = in[(g * 16 + i) * unitsize
+						     + b];
+				v = _mm_load_si128((const __m128i *)lane);
+			}
+			for (j = 0; j < 8; j++) {
+				/* Move bit j of every byte into its top bit. */
+				bits = _mm_movemask_epi8(_mm_slli_epi64(v,
+								7 - j));
+				memcpy(planes + (b * 8 + j) * plane_size
+				       + byte_offset + g * 2, &bits, 2);
+			}
+		}
+	}
+
+	transpose_scalar(in + g * 16 * unitsize, unitsize, num_units % 16,
+			 planes, plane_size, byte_offset + g * 2);
+}
+
+__attribute__((target("avx2")))
+static void transpose_avx2(const uint8_t *in, int unitsize,
+			   uint64_t num_units, uint8_t *planes,
+			   uint64_t plane_size, uint64_t byte_offset)
+{
+	uint8_t lane[32] __attribute__((aligned(32)));
+	uint32_t bits;
+	uint64_t g;
+	__m256i v;
+	int b, i, j;
+
+	for (g = 0; g < num_units / 32; g++) {
+		for (b = 0; b < unitsize; b++) {
+			if (unitsize == 1) {
+				v = _mm256_loadu_si256((const __m256i *)
+						       (in + g * 32));
+			} else {
+				for (i = 0; i < 32; i++)
+					lane[i] = in[(g * 32 + i) * unitsize
+						     + b];
+				v = _mm256_load_si256((const __m256i *)lane);
+			}
+			for (j = 0; j < 8; j++) {
+				bits = _mm256_movemask_epi8(_mm256_slli_epi64(v,
+								7 - j));
+				memcpy(planes + (b * 8 + j) * plane_size
+				       + byte_offset + g * 4, &bits, 4);
+			}
+		}
+	}
+
+	transpose_sse2(in + g * 32 * unitsize, unitsize, num_units % 32,
+		       planes, plane_size, byte_offset + g * 4);
+}
+#endif
+
+static transpose_func get_transpose_func(void)
+{
+	static transpose_func func = NULL;
+
+	if (func)
+		return func;
+
+#ifdef HAVE_X86_SIMD
+	if (__builtin_cpu_supports("avx2"))
+		func = transpose_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		func = transpose_sse2;
+	else
+#endif
+		func = transpose_scalar;
+
+	return func;
+}
+
+static void set_bit(uint8_t *bitmap, uint64_t bit, int val)
+{
+	if (val)
+		bitmap[bit / 8] |= 1 << (bit % 8);
+	else
+		bitmap[bit / 8] &= ~(1 << (bit % 8));
+}
+
+/*
+ * Store units in the planes, starting at unit 'offset' of each plane.
+ * Bits of the planes beyond the stored units are left alone.
+ */
+void sr_bitplane_transpose(const uint8_t *in, int unitsize, uint64_t num_units,
+			   uint8_t *planes, uint64_t plane_size,
+			   uint64_t offset)
+{
+	uint64_t head, bulk, i;
+	int p;
+
+	/* Units up to the next byte boundary of the planes. */
+	head = MIN((8 - offset % 8) % 8, num_units);
+	for (i = 0; i < head; i++) {
+		for (p = 0; p < unitsize * 8; p++)
+			set_bit(planes + p * plane_size, offset + i,
+				(in[i * unitsize + p / 8] >> (p % 8)) & 1);
+	}
+	in += head * unitsize;
+	offset += head;
+	num_units -= head;
+
+	bulk = num_units - num_units % 8;
+	get_transpose_func()(in, unitsize, bulk, planes, plane_size,
+			     offset / 8);
+
+	for (i = bulk; i < num_units; i++) {
+		for (p = 0; p < unitsize * 8; p++)
+			set_bit(planes + p * plane_size, offset + i,
+				(in[i * unitsize + p / 8] >> (p % 8)) & 1);
+	}
+}
+
+/*
+ * Turn the first num_units units of the planes back into interleaved
+ * units. num_units is rounded up to a multiple of 8, so 'out' must have
+ * room for that.
+ */
+void sr_bitplane_interleave(const uint8_t *planes, uint64_t plane_size,
+			    int unitsize, uint64_t num_units, uint8_t *out)
+{
+	uint64_t x, g;
+	int b, i, j;
+
+	for (g = 0; g < (num_units + 7) / 8; g++) {
+		for (b = 0; b < unitsize; b++) {
+			x = 0;
+			for (j = 0; j < 8; j++)
+				x |= (uint64_t)planes[(b * 8 + j) * plane_size
+						      + g] << (j * 8);
+			x = transpose8(x);
+			for (i = 0; i < 8; i++)
+				out[(g * 8 + i) * unitsize + b] = x >> (i * 8);
+		}
+	}
+}
+
+/*
+ * Copy n bits from src, starting at bit src_bit, to dst starting at bit
+ * dst_bit. Other bits of dst are left alone.
+ */
+void sr_bitplane_copy(uint8_t *dst, uint64_t dst_bit, const uint8_t *src,
+		      uint64_t src_bit, uint64_t n)
+{
+	unsigned int v, s, d;
+	uint8_t *out;
+
+	if (dst_bit % 8 == 0 && src_bit % 8 == 0) {
+		memcpy(dst + dst_bit / 8, src + src_bit / 8, n / 8);
+		dst_bit += n - n % 8;
+		src_bit += n - n % 8;
+		n %= 8;
+	}
+
+	for (; n >= 8; n -= 8, src_bit += 8, dst_bit += 8) {
+		s = src_bit % 8;
+		v = src[src_bit / 8] >> s;
+		if (s)
+			v |= src[src_bit / 8 + 1] << (8 - s);
+		v &= 0xff;
+
+		d = dst_bit % 8;
+		out = dst + dst_bit / 8;
+		out[0] = (out[0] & ((1 << d) - 1)) | (v << d);
+		if (d)
+			out[1] = (out[1] & ~((1 << d) - 1)) | (v >> (8 - d));
+	}
+
+	for (; n; n--, src_bit++, dst_bit++)
+		set_bit(dst, dst_bit, (src[src_bit / 8] >> (src_bit % 8)) & 1);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static uint64_t extract_sse2(const uint8_t *in, int unitsize, int probe,
+			     uint64_t num_units, uint8_t *bitmap)
+{
+	uint8_t lane[16] __attribute__((aligned(16)));
+	uint16_t bits;
+	uint64_t g;
+	__m128i v;
+	int i;
+
+	for (g = 0; g < num_units / 16; g++) {
+		for (i = 0; i < 16; i++)
+			lane[i] = in[(g * 16 + i) * unitsize + probe / 8];
+		v = _mm_load_si128((const __m128i *)lane);
+		bits = _mm_movemask_epi8(_mm_slli_epi64(v, 7 - probe % 8));
+		memcpy(bitmap + g * 2, &bits, 2);
+	}
+
+	return g * 16;
+}
+#endif
+
+/*
+ * Pull the bits of a single probe out of interleaved units, into a bitmap
+ * starting at bit 'dst_bit'.
+ */
+void sr_bitplane_extract(const uint8_t *in, int unitsize, int probe,
+			 uint64_t num_units, uint8_t *bitmap, uint64_t dst_bit)
+{
+	uint8_t block[EXTRACT_BLOCK / 8];
+	uint64_t n, done, i;
+
+	while (num_units) {
+		n = MIN(num_units, EXTRACT_BLOCK);
+		done = 0;
+#ifdef HAVE_X86_SIMD
+		if (__builtin_cpu_supports("sse2"))
+			done = extract_sse2(in, unitsize, probe, n, block);
+#endif
+		for (i = done; i < n; i++)
+			set_bit(block, i, (in[i * unitsize + probe / 8]
+					   >> (probe % 8)) & 1);
+		sr_bitplane_copy(bitmap, dst_bit, block, 0, n);
+
+		in += n * unitsize;
+		dst_bit += n;
+		num_units -= n;
+	}
+}
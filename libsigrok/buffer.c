@@ -0,0 +1,142 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reference counted sample buffers.
+ *
+ * A driver which sends its samples in an sr_buffer lets datafeed callbacks
+ * hold on to them by taking a reference, instead of copying them. Once the
+ * last reference is dropped, the memory goes back to the sample buffer
+ * pool, or to the driver's release function so that it can be used again.
+ * References may be taken and dropped from any thread.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+/**
+ * Allocate a buffer of the given size from the sample buffer pool, with
+ * one reference.
+ *
+ * @return The buffer, or NULL if it could not be allocated.
+ */
+struct sr_buffer *sr_buffer_new(uint64_t size)
+{
+	struct sr_buffer *buf;
+
+	if (!(buf = g_try_malloc0(sizeof(struct sr_buffer)))) {
+		sr_err("buffer: %s: buf malloc failed", __func__);
+		return NULL;
+	}
+	if (size && !(buf->data = sr_mempool_alloc(size))) {
+		sr_err("buffer: %s: data malloc failed", __func__);
+		g_free(buf);
+		return NULL;
+	}
+	buf->size = size;
+	buf->refcount = 1;
+
+	return buf;
+}
+
+/**
+ * Put a buffer around memory owned by the caller, with one reference.
+ *
+ * Once the last reference is dropped, release is called with the data
+ * and user_data, possibly from another thread. The data must stay valid
+ * until then.
+ *
+ * @return The buffer, or NULL if it could not be allocated.
+ */
+struct sr_buffer *sr_buffer_wrap(void *data, uint64_t size,
+		void (*release) (void *data, void *user_data),
+		void *user_data)
+{
+	struct sr_buffer *buf;
+
+	if (!(buf = g_try_malloc(sizeof(struct sr_buffer)))) {
+		sr_err("buffer: %s: buf malloc failed", __func__);
+		return NULL;
+	}
+	buf->data = data;
+	buf->size = size;
+	buf->refcount = 1;
+	buf->release = release;
+	buf->user_data = user_data;
+
+	return buf;
+}
+
+struct sr_buffer *sr_buffer_ref(struct sr_buffer *buf)
+{
+	g_atomic_int_inc(&buf->refcount);
+
+	return buf;
+}
+
+void sr_buffer_unref(struct sr_buffer *buf)
+{
+	if (!buf || !g_atomic_int_dec_and_test(&buf->refcount))
+		return;
+
+	if (buf->release)
+		buf->release(buf->data, buf->user_data);
+	else
+		sr_mempool_free(buf->data, buf->size);
+	g_free(buf);
+}
+
+/**
+ * Keep the samples of a logic packet beyond the datafeed callback.
+ *
+ * ref is filled in with the same samples, and a reference to the buffer
+ * holding them. If the packet came without a buffer, the samples are
+ * copied into a new one. Drop the reference with sr_datafeed_logic_unref().
+ *
+ * @return SR_OK upon success, SR_ERR_MALLOC upon errors.
+ */
+int sr_datafeed_logic_ref(const struct sr_datafeed_logic *logic,
+			  struct sr_datafeed_logic *ref)
+{
+	struct sr_buffer *buf;
+
+	*ref = *logic;
+	if (logic->buffer) {
+		sr_buffer_ref(logic->buffer);
+		return SR_OK;
+	}
+
+	if (!(buf = sr_buffer_new(logic->length)))
+		return SR_ERR_MALLOC;
+	memcpy(buf->data, logic->data, logic->length);
+	ref->data = buf->data;
+	ref->buffer = buf;
+
+	return SR_OK;
+}
+
+void sr_datafeed_logic_unref(struct sr_datafeed_logic *logic)
+{
+	sr_buffer_unref(logic->buffer);
+	logic->buffer = NULL;
+	logic->data = NULL;
+}
@@ -17,14 +17,120 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <sigrok.h>
 #include <sigrok-internal.h>
 
-static gpointer new_chunk(struct sr_datastore **ds);
+/* Initial number of slots in the chunk table, doubled when it runs full. */
+#define CHUNKTABLE_INITIAL_SIZE 16
+
+/* How a full chunk of an SR_DS_COMPRESSED datastore is encoded. */
+enum {
+	/* Stored as is. */
+	ENCODING_RAW,
+	/* Runs of identical units, as (run length, unit) pairs. */
+	ENCODING_RLE,
+	/*
+	 * The first unit, followed by (distance, changed bytes mask, XOR of
+	 * changed bytes) for every unit which differs from the previous one.
+	 * This works better than RLE for wide units where only a few probes
+	 * change at a time.
+	 */
+	ENCODING_TRANSITION,
+};
+
+struct packed_chunk {
+	int encoding;
+	uint64_t size;
+	uint8_t data[];
+};
+
+struct sr_chunk_ref {
+	gint refcount;
+	gpointer data;
+	/* Size of a pool buffer, or 0 if allocated with g_try_malloc() */
+	size_t size;
+};
+
+static gpointer new_chunk(struct sr_datastore *ds);
+static gpointer get_chunk_data(struct sr_datastore *ds, unsigned int index);
+
+static void chunk_free(gpointer data, size_t size)
+{
+	if (size)
+		sr_mempool_free(data, size);
+	else
+		g_free(data);
+}
+
+static void chunk_ref_unref(struct sr_chunk_ref *ref)
+{
+	if (g_atomic_int_dec_and_test(&ref->refcount)) {
+		chunk_free(ref->data, ref->size);
+		g_free(ref);
+	}
+}
+
+/* How a chunk was allocated, as passed to chunk_free(). */
+static size_t chunk_alloc_size(struct sr_datastore *ds, unsigned int index)
+{
+	/* Sealed compressed chunks are allocated to fit. */
+	if (ds->state->mode == SR_DS_COMPRESSED
+	    && index < ds->state->num_chunks - 1)
+		return 0;
+
+	return (size_t)DATASTORE_CHUNKSIZE * ds->ds_unitsize;
+}
+
+/* Let go of a chunk, which snapshots may still be holding on to. */
+static void release_chunk(struct sr_datastore *ds, unsigned int index,
+			  size_t size)
+{
+	if (ds->state->chunk_refs && ds->state->chunk_refs[index]) {
+		chunk_ref_unref(ds->state->chunk_refs[index]);
+		ds->state->chunk_refs[index] = NULL;
+	} else {
+		chunk_free(ds->state->chunks[index], size);
+	}
+}
+
+/*
+ * Make sure a chunk which is about to be written to isn't shared with a
+ * snapshot, by copying it if it still is.
+ */
+static gpointer unshare_chunk(struct sr_datastore *ds, unsigned int index)
+{
+	struct sr_chunk_ref *ref;
+	size_t chunk_bytes;
+	gpointer copy;
+
+	ref = ds->state->chunk_refs[index];
+	if (g_atomic_int_get(&ref->refcount) == 1) {
+		/* The snapshots are gone, so it's ours alone again. */
+		g_free(ref);
+	} else {
+		chunk_bytes = (size_t)DATASTORE_CHUNKSIZE * ds->ds_unitsize;
+		if (!(copy = sr_mempool_alloc(chunk_bytes))) {
+			sr_err("ds: %s: chunk copy malloc failed", __func__);
+			return NULL;
+		}
+		memcpy(copy, ds->state->chunks[index], chunk_bytes);
+		chunk_ref_unref(ref);
+		ds->state->chunks[index] = copy;
+	}
+	ds->state->chunk_refs[index] = NULL;
+
+	return ds->state->chunks[index];
+}
 
 int sr_datastore_new(int unitsize, struct sr_datastore **ds)
 {
@@ -34,83 +140,1096 @@ int sr_datastore_new(int unitsize, struct sr_datastore **ds)
 	if (unitsize <= 0)
 		return SR_ERR; /* TODO: Different error? */
 
-	if (!(*ds = g_try_malloc(sizeof(struct sr_datastore)))) {
+	if (!(*ds = g_try_malloc0(sizeof(struct sr_datastore)))) {
 		sr_err("ds: %s: ds malloc failed", __func__);
 		return SR_ERR_MALLOC;
 	}
+	(*ds)->state = g_try_malloc0(sizeof(struct sr_datastore_state));
+	if (!(*ds)->state) {
+		sr_err("ds: %s: ds state malloc failed", __func__);
+		g_free(*ds);
+		return SR_ERR_MALLOC;
+	}
 
 	(*ds)->ds_unitsize = unitsize;
 	(*ds)->num_units = 0;
-	(*ds)->chunklist = NULL;
+	(*ds)->state->mode = SR_DS_MEMORY;
+	(*ds)->state->chunks = NULL;
+	(*ds)->state->num_chunks = 0;
+	(*ds)->state->max_chunks = 0;
+	(*ds)->state->fd = -1;
+	(*ds)->state->cache_index = -1;
+
+	return SR_OK;
+}
+
+/**
+ * Create a datastore which keeps its samples in a temporary file.
+ *
+ * Chunks are mapped into memory only while they are being written or
+ * read, so the capture can grow well beyond the amount of physical memory.
+ * The file is sparse, and is removed as soon as it has been created, so
+ * nothing is left behind when the process exits.
+ *
+ * @param unitsize The size of a unit, in bytes.
+ * @param dir The directory to create the file in. If NULL, the system's
+ *            default directory for temporary files is used.
+ * @param max_resident The maximum number of bytes of sample data to keep
+ *                     mapped at any time. At least one chunk is always
+ *                     mapped, regardless of this setting.
+ * @param ds Pointer to where the new datastore will be stored.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR upon other
+ *         errors (e.g. if the file could not be created).
+ */
+int sr_datastore_new_file(int unitsize, const char *dir, uint64_t max_resident,
+			  struct sr_datastore **ds)
+{
+#ifdef HAVE_SYS_MMAN_H
+	char *filename;
+	uint64_t chunk_bytes;
+	long pagesize;
+	int ret;
+
+	if ((ret = sr_datastore_new(unitsize, ds)) != SR_OK)
+		return ret;
+
+	if (!((*ds)->state->mapped = g_queue_new())) {
+		sr_err("ds: %s: mapped queue malloc failed", __func__);
+		sr_datastore_destroy(*ds);
+		return SR_ERR_MALLOC;
+	}
+
+	filename = g_build_filename(dir ? dir : g_get_tmp_dir(),
+				    "sigrok-ds-XXXXXX", NULL);
+	if (((*ds)->state->fd = g_mkstemp(filename)) == -1) {
+		sr_err("ds: %s: failed to create %s", __func__, filename);
+		g_free(filename);
+		sr_datastore_destroy(*ds);
+		return SR_ERR;
+	}
+	/* Only the open fd refers to the file from now on. */
+	g_unlink(filename);
+	g_free(filename);
+
+	/* Chunks must start on a page boundary to be mappable. */
+	chunk_bytes = (uint64_t)DATASTORE_CHUNKSIZE * unitsize;
+	pagesize = sysconf(_SC_PAGESIZE);
+	(*ds)->state->chunk_stride = (chunk_bytes + pagesize - 1)
+				     / pagesize * pagesize;
+
+	(*ds)->state->mode = SR_DS_FILE;
+	(*ds)->state->max_mapped = MAX(max_resident / chunk_bytes, 1);
+
+	return SR_OK;
+#else
+	(void)unitsize;
+	(void)dir;
+	(void)max_resident;
+	(void)ds;
+
+	sr_err("ds: %s: file-backed datastores are not supported on this "
+	       "platform", __func__);
+
+	return SR_ERR;
+#endif
+}
+
+/**
+ * Create a datastore which compresses its samples in memory.
+ *
+ * Every chunk is compressed as soon as it is full, using whichever of the
+ * logic-specific encodings works best for it. Reading from a compressed
+ * chunk decompresses it into a cache holding a single chunk, so ranges can
+ * still be accessed at random. Use sr_datastore_get_stats() to see how well
+ * this works out on a given capture.
+ *
+ * @param unitsize The size of a unit, in bytes.
+ * @param ds Pointer to where the new datastore will be stored.
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors,
+ *         SR_ERR upon other errors.
+ */
+int sr_datastore_new_compressed(int unitsize, struct sr_datastore **ds)
+{
+	int ret;
+
+	if ((ret = sr_datastore_new(unitsize, ds)) != SR_OK)
+		return ret;
+
+	(*ds)->state->cache = g_try_malloc(DATASTORE_CHUNKSIZE * unitsize);
+	if (!(*ds)->state->cache) {
+		sr_err("ds: %s: cache malloc failed", __func__);
+		sr_datastore_destroy(*ds);
+		return SR_ERR_MALLOC;
+	}
+	(*ds)->state->timer = g_timer_new();
+	(*ds)->state->mode = SR_DS_COMPRESSED;
+
+	return SR_OK;
+}
+
+/**
+ * Create a datastore which keeps its samples as per-probe bit-planes.
+ *
+ * Incoming units are transposed so that every chunk holds one contiguous
+ * bitmap per probe. Consumers which only look at a few probes can then use
+ * sr_datastore_get_probe() without touching the other probes' data at all.
+ * Accessing interleaved units is still possible, but transposes a chunk
+ * back into a single chunk cache first, so is slower than with the other
+ * modes.
+ *
+ * @param unitsize The size of a unit, in bytes.
+ * @param ds Pointer to where the new datastore will be stored.
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors,
+ *         SR_ERR upon other errors.
+ */
+int sr_datastore_new_bitplane(int unitsize, struct sr_datastore **ds)
+{
+	int ret;
+
+	if ((ret = sr_datastore_new(unitsize, ds)) != SR_OK)
+		return ret;
+
+	(*ds)->state->cache = g_try_malloc(DATASTORE_CHUNKSIZE * unitsize);
+	if (!(*ds)->state->cache) {
+		sr_err("ds: %s: cache malloc failed", __func__);
+		sr_datastore_destroy(*ds);
+		return SR_ERR_MALLOC;
+	}
+	(*ds)->state->mode = SR_DS_BITPLANE;
+
+	return SR_OK;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/*
+ * File-backed snapshots map the same file through a chunk table of their
+ * own. Units which have been stored are never written to again, so there
+ * is nothing to share or copy.
+ */
+static int snapshot_file(struct sr_datastore *ds,
+			 struct sr_datastore **snapshot)
+{
+	struct sr_datastore *snap;
+	int ret;
+
+	if ((ret = sr_datastore_new(ds->ds_unitsize, &snap)) != SR_OK)
+		return ret;
+
+	snap->state->mode = SR_DS_FILE;
+	snap->state->readonly = TRUE;
+	snap->state->chunk_stride = ds->state->chunk_stride;
+	snap->state->max_mapped = ds->state->max_mapped;
+	if (!(snap->state->mapped = g_queue_new())
+	    || !(snap->state->chunks = g_try_malloc0(
+			MAX(ds->state->num_chunks, 1) * sizeof(gpointer)))
+	    || !(snap->state->mapped_links = g_try_malloc0(
+			MAX(ds->state->num_chunks, 1) * sizeof(GList *)))) {
+		sr_err("ds: %s: snapshot malloc failed", __func__);
+		sr_datastore_destroy(snap);
+		return SR_ERR_MALLOC;
+	}
+	if ((snap->state->fd = dup(ds->state->fd)) == -1) {
+		sr_err("ds: %s: failed to duplicate datastore file", __func__);
+		sr_datastore_destroy(snap);
+		return SR_ERR;
+	}
+	snap->state->num_chunks = ds->state->num_chunks;
+	snap->state->max_chunks = ds->state->num_chunks;
+	snap->num_units = ds->num_units;
+	*snapshot = snap;
 
 	return SR_OK;
 }
+#endif
+
+/**
+ * Take a snapshot of the samples stored in a datastore so far.
+ *
+ * The snapshot is a read-only datastore, which can be read with the usual
+ * functions from any thread while data keeps being put into the original
+ * one, without any locking on either side. Full chunks are shared between
+ * the two. The chunk which is still being filled up is shared as well,
+ * until the next sr_datastore_put() copies it before writing to it.
+ *
+ * This must be called from the thread which puts data into the datastore.
+ * Summaries and edge indexes are not carried over into the snapshot.
+ *
+ * @param ds The datastore.
+ * @param snapshot Pointer to where the snapshot will be stored. It must be
+ *                 destroyed with sr_datastore_destroy() when done.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR upon other
+ *         errors.
+ */
+int sr_datastore_snapshot(struct sr_datastore *ds,
+			  struct sr_datastore **snapshot)
+{
+	struct sr_datastore *snap;
+	struct sr_chunk_ref *ref;
+	unsigned int i;
+	int ret;
+
+	if (!ds || !snapshot || ds->state->readonly)
+		return SR_ERR_ARG;
+
+	if (ds->state->mode == SR_DS_FILE) {
+#ifdef HAVE_SYS_MMAN_H
+		return snapshot_file(ds, snapshot);
+#else
+		return SR_ERR;
+#endif
+	}
+
+	if (!ds->state->chunk_refs && ds->state->max_chunks) {
+		ds->state->chunk_refs = g_try_malloc0(ds->state->max_chunks
+					* sizeof(struct sr_chunk_ref *));
+		if (!ds->state->chunk_refs) {
+			sr_err("ds: %s: chunk refs malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+	}
+
+	if (ds->state->mode == SR_DS_COMPRESSED)
+		ret = sr_datastore_new_compressed(ds->ds_unitsize, &snap);
+	else if (ds->state->mode == SR_DS_BITPLANE)
+		ret = sr_datastore_new_bitplane(ds->ds_unitsize, &snap);
+	else
+		ret = sr_datastore_new(ds->ds_unitsize, &snap);
+	if (ret != SR_OK)
+		return ret;
+	snap->state->readonly = TRUE;
+
+	if (ds->state->num_chunks) {
+		snap->state->chunks = g_try_malloc(ds->state->num_chunks
+						   * sizeof(gpointer));
+		snap->state->chunk_refs = g_try_malloc(ds->state->num_chunks
+					* sizeof(struct sr_chunk_ref *));
+		if (!snap->state->chunks || !snap->state->chunk_refs) {
+			sr_err("ds: %s: snapshot malloc failed", __func__);
+			sr_datastore_destroy(snap);
+			return SR_ERR_MALLOC;
+		}
+		snap->state->max_chunks = ds->state->num_chunks;
+	}
+
+	for (i = 0; i < ds->state->num_chunks; i++) {
+		if (!ds->state->chunk_refs[i]) {
+			if (!(ref = g_try_malloc(sizeof(struct sr_chunk_ref)))) {
+				sr_err("ds: %s: chunk ref malloc failed",
+				       __func__);
+				sr_datastore_destroy(snap);
+				return SR_ERR_MALLOC;
+			}
+			ref->refcount = 1;
+			ref->data = ds->state->chunks[i];
+			ref->size = chunk_alloc_size(ds, i);
+			ds->state->chunk_refs[i] = ref;
+		}
+		g_atomic_int_inc(&ds->state->chunk_refs[i]->refcount);
+		snap->state->chunks[i] = ds->state->chunks[i];
+		snap->state->chunk_refs[i] = ds->state->chunk_refs[i];
+		snap->state->num_chunks++;
+	}
+	snap->num_units = ds->num_units;
+	snap->state->first_unit = ds->state->first_unit;
+	snap->state->stats = ds->state->stats;
+	*snapshot = snap;
+
+	return SR_OK;
+}
+
+/**
+ * Make a datastore keep only the most recent samples, like a flight
+ * recorder.
+ *
+ * Once the datastore is full, the chunk holding the oldest samples is
+ * dropped (and its memory reused) to make room for new ones, so memory use
+ * stays constant however long the acquisition runs. At least the last
+ * max_units units are always kept. Units keep their numbers, and
+ * sr_datastore_get_first_unit() returns the oldest one still available.
+ *
+ * This must be called before any data is put into the datastore. It is not
+ * supported for file-backed datastores, nor together with summaries or edge
+ * indexes.
+ *
+ * @param ds The datastore.
+ * @param max_units The number of units to keep.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or an
+ *         unsupported datastore, SR_ERR if it already contains data.
+ */
+int sr_datastore_set_ring(struct sr_datastore *ds, uint64_t max_units)
+{
+	if (!ds || !max_units || ds->state->readonly
+	    || ds->state->mode == SR_DS_FILE || ds->state->summary
+	    || ds->state->edges)
+		return SR_ERR_ARG;
+
+	if (ds->num_units)
+		return SR_ERR;
+
+	/* The newest chunk may hold only a single unit. */
+	ds->state->ring_chunks = MAX((max_units + DATASTORE_CHUNKSIZE - 1)
+			      / DATASTORE_CHUNKSIZE + 1, 2);
+
+	return SR_OK;
+}
+
+/**
+ * Get the number of units a flight recorder datastore keeps at most.
+ *
+ * @param ds The datastore.
+ * @return The number of units, or 0 if the datastore isn't in flight
+ *         recorder mode, see sr_datastore_set_ring().
+ */
+uint64_t sr_datastore_get_ring_size(struct sr_datastore *ds)
+{
+	if (!ds)
+		return 0;
+
+	return (uint64_t)ds->state->ring_chunks * DATASTORE_CHUNKSIZE;
+}
+
+/**
+ * Get the number of the oldest unit a datastore still holds.
+ *
+ * This is always 0, except in flight recorder mode where older units are
+ * dropped to make room for new ones.
+ *
+ * @param ds The datastore.
+ * @return The number of the oldest unit held, or 0 if ds is NULL.
+ */
+uint64_t sr_datastore_get_first_unit(struct sr_datastore *ds)
+{
+	if (!ds)
+		return 0;
+
+	return ds->state->first_unit;
+}
 
 int sr_datastore_destroy(struct sr_datastore *ds)
 {
-	GSList *chunk;
+	unsigned int i;
 
 	if (!ds)
 		return SR_ERR;
 
-	for (chunk = ds->chunklist; chunk; chunk = chunk->next)
-		g_free(chunk->data);
-	g_slist_free(ds->chunklist);
+	for (i = 0; i < ds->state->num_chunks; i++) {
+		if (ds->state->mode != SR_DS_FILE) {
+			release_chunk(ds, i, chunk_alloc_size(ds, i));
+#ifdef HAVE_SYS_MMAN_H
+		} else if (ds->state->chunks[i]) {
+			munmap(ds->state->chunks[i],
+			       (size_t)DATASTORE_CHUNKSIZE * ds->ds_unitsize);
+#endif
+		}
+	}
+	g_free(ds->state->chunks);
+	g_free(ds->state->chunk_refs);
+	g_free(ds->state->mapped_links);
+	if (ds->state->mapped)
+		g_queue_free(ds->state->mapped);
+	sr_summary_free(ds);
+	sr_edges_free(ds);
+	g_free(ds->state->cache);
+	if (ds->state->timer)
+		g_timer_destroy(ds->state->timer);
+	if (ds->state->fd != -1)
+		close(ds->state->fd);
+	g_free(ds->state);
 	g_free(ds);
 
 	return SR_OK;
 }
 
-void sr_datastore_put(struct sr_datastore *ds, void *data, unsigned int length,
-		      int in_unitsize, int *probelist)
+/**
+ * Append samples to a datastore.
+ *
+ * The chunk table is indexed directly, so appending is O(1) no matter how
+ * many chunks the datastore already holds. Trailing bytes which don't make
+ * up a complete unit are dropped.
+ *
+ * @param ds The datastore to append to.
+ * @param data The samples to append.
+ * @param length The length of data, in bytes.
+ * @param in_unitsize Unused.
+ * @param probelist Unused.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ */
+int sr_datastore_put(struct sr_datastore *ds, const void *data,
+		     uint64_t length, int in_unitsize, int *probelist)
 {
-	unsigned int stored;
-	int capacity, size, num_chunks, chunk_bytes_free, chunk_offset;
+	uint64_t stored, used, chunk_bytes, chunk_offset, size;
+	unsigned int chunk_index;
 	gpointer chunk;
+	int ret;
 
 	/* Avoid compiler warnings. */
 	(void)in_unitsize;
 	(void)probelist;
 
-	if (ds->chunklist == NULL)
-		chunk = new_chunk(&ds);
-	else
-		chunk = g_slist_last(ds->chunklist)->data;
+	if (!ds || !data || ds->state->readonly)
+		return SR_ERR_ARG;
+
+	chunk_bytes = (uint64_t)DATASTORE_CHUNKSIZE * ds->ds_unitsize;
+	length -= length % ds->ds_unitsize;
 
-	num_chunks = g_slist_length(ds->chunklist);
-	capacity = (num_chunks * DATASTORE_CHUNKSIZE);
-	chunk_bytes_free = capacity - (ds->ds_unitsize * ds->num_units);
-	chunk_offset = capacity - (DATASTORE_CHUNKSIZE * (num_chunks - 1))
-		       - chunk_bytes_free;
 	stored = 0;
 	while (stored < length) {
-		if (chunk_bytes_free == 0) {
-			chunk = new_chunk(&ds);
-			chunk_bytes_free = DATASTORE_CHUNKSIZE;
-			chunk_offset = 0;
-		}
+		used = ds->num_units * ds->ds_unitsize;
+		chunk_index = used / chunk_bytes
+			      - ds->state->first_unit / DATASTORE_CHUNKSIZE;
+		chunk_offset = used % chunk_bytes;
+
+		if (chunk_index < ds->state->num_chunks && ds->state->chunk_refs
+		    && ds->state->chunk_refs[chunk_index]
+		    && !unshare_chunk(ds, chunk_index))
+			return SR_ERR_MALLOC;
 
-		if (length - stored > (unsigned int)chunk_bytes_free)
-			size = chunk_bytes_free;
-		else
-			/* Last part, won't fill up this chunk. */
-			size = length - stored;
+		if (chunk_index == ds->state->num_chunks) {
+			if (!(chunk = new_chunk(ds)))
+				return SR_ERR_MALLOC;
+		} else if (ds->state->mode == SR_DS_BITPLANE) {
+			chunk = ds->state->chunks[chunk_index];
+		} else if (!(chunk = get_chunk_data(ds, chunk_index))) {
+			return SR_ERR;
+		}
 
-		memcpy(chunk + chunk_offset, data + stored, size);
-		chunk_bytes_free -= size;
+		size = MIN(chunk_bytes - chunk_offset, length - stored);
+		if (ds->state->mode == SR_DS_BITPLANE) {
+			sr_bitplane_transpose((const uint8_t *)data + stored,
+					ds->ds_unitsize, size / ds->ds_unitsize,
+					chunk, DATASTORE_CHUNKSIZE / 8,
+					chunk_offset / ds->ds_unitsize);
+			if (ds->state->cache_index == (int)chunk_index)
+				ds->state->cache_index = -1;
+		} else {
+			memcpy((uint8_t *)chunk + chunk_offset,
+			       (const uint8_t *)data + stored, size);
+		}
+		if (ds->state->summary && (ret = sr_summary_update(ds,
+				(const uint8_t *)data + stored,
+				size / ds->ds_unitsize)) != SR_OK)
+			return ret;
+		if (ds->state->edges && (ret = sr_edges_update(ds,
+				(const uint8_t *)data + stored,
+				size / ds->ds_unitsize)) != SR_OK)
+			return ret;
 		stored += size;
+		ds->num_units += size / ds->ds_unitsize;
 	}
-	ds->num_units += stored / ds->ds_unitsize;
+
+	return SR_OK;
 }
 
-static gpointer new_chunk(struct sr_datastore **ds)
+/**
+ * Get direct access to the stored samples starting at a given unit.
+ *
+ * The returned pointer points into the chunk holding the unit at 'start'.
+ * Only the number of units returned in 'num_units' are contiguous; the
+ * caller should call this again with 'start' advanced by that amount to
+ * walk over a larger range. The data must not be modified, and is only
+ * valid until the next call on this datastore: compressed and bit-plane
+ * datastores unpack each chunk into a cache, and file-backed datastores
+ * may unmap the chunk, when another chunk is read. Callers which need
+ * data from two chunks at once must copy it.
+ *
+ * @param ds The datastore to read from.
+ * @param start The number of the first unit to access.
+ * @param data Pointer to where the start address will be stored.
+ * @param num_units Pointer to where the number of contiguous units
+ *                  available at 'data' will be stored.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or if
+ *         'start' is beyond the end of the stored data.
+ */
+int sr_datastore_get_chunk(struct sr_datastore *ds, uint64_t start,
+			   const void **data, uint64_t *num_units)
 {
+	unsigned int chunk_index;
+	uint64_t chunk_offset;
 	gpointer chunk;
 
-	if (!(chunk = malloc(DATASTORE_CHUNKSIZE * (*ds)->ds_unitsize)))
+	if (!ds || !data || !num_units)
+		return SR_ERR_ARG;
+
+	if (start >= ds->num_units || start < ds->state->first_unit)
+		return SR_ERR_ARG;
+
+	chunk_index = (start - ds->state->first_unit) / DATASTORE_CHUNKSIZE;
+	chunk_offset = start % DATASTORE_CHUNKSIZE;
+
+	if (!(chunk = get_chunk_data(ds, chunk_index)))
+		return SR_ERR;
+
+	*data = (const uint8_t *)chunk + chunk_offset * ds->ds_unitsize;
+	*num_units = MIN(DATASTORE_CHUNKSIZE - chunk_offset,
+			 ds->num_units - start);
+
+	return SR_OK;
+}
+
+/**
+ * Copy a range of samples out of a datastore.
+ *
+ * @param ds The datastore to read from.
+ * @param start The number of the first unit to copy.
+ * @param count The number of units to copy.
+ * @param buf The buffer to copy to. Must be at least
+ *            count * ds->ds_unitsize bytes large.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or if the
+ *         requested range lies (partially) beyond the end of the stored data.
+ */
+int sr_datastore_get_range(struct sr_datastore *ds, uint64_t start,
+			   uint64_t count, void *buf)
+{
+	const void *chunk;
+	uint64_t pos, len;
+	int ret;
+
+	if (!ds || !buf)
+		return SR_ERR_ARG;
+
+	if (start + count > ds->num_units || start + count < start
+	    || start < ds->state->first_unit)
+		return SR_ERR_ARG;
+
+	for (pos = start; pos < start + count; pos += len) {
+		if ((ret = sr_datastore_get_chunk(ds, pos, &chunk, &len)) != SR_OK)
+			return ret;
+		len = MIN(len, start + count - pos);
+		memcpy((uint8_t *)buf + (pos - start) * ds->ds_unitsize, chunk,
+		       len * ds->ds_unitsize);
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Copy the samples of a single probe out of a datastore, as a bitmap.
+ *
+ * Unit start + n ends up in bit n % 8 of byte n / 8 of the bitmap. Bits in
+ * the last byte beyond 'count' are left alone. This works on any datastore,
+ * but is fastest with SR_DS_BITPLANE, where it is a plain copy.
+ *
+ * @param ds The datastore to read from.
+ * @param probe The probe, as bit number within a unit (0 is the LSB).
+ * @param start The number of the first unit to copy.
+ * @param count The number of units to copy.
+ * @param bitmap The buffer to copy to. Must be at least (count + 7) / 8
+ *               bytes large.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or if the
+ *         requested range lies (partially) beyond the end of the stored data.
+ */
+int sr_datastore_get_probe(struct sr_datastore *ds, int probe, uint64_t start,
+			   uint64_t count, uint8_t *bitmap)
+{
+	const void *data;
+	uint64_t pos, len, chunk_offset;
+	gpointer chunk;
+	int ret;
+
+	if (!ds || !bitmap || probe < 0 || probe >= ds->ds_unitsize * 8)
+		return SR_ERR_ARG;
+
+	if (start + count > ds->num_units || start + count < start
+	    || start < ds->state->first_unit)
+		return SR_ERR_ARG;
+
+	for (pos = start; pos < start + count; pos += len) {
+		if (ds->state->mode == SR_DS_BITPLANE) {
+			/* Straight out of the plane, no transposing needed. */
+			chunk = ds->state->chunks[(pos - ds->state->first_unit)
+					   / DATASTORE_CHUNKSIZE];
+			chunk_offset = pos % DATASTORE_CHUNKSIZE;
+			len = MIN(DATASTORE_CHUNKSIZE - chunk_offset,
+				  start + count - pos);
+			sr_bitplane_copy(bitmap, pos - start, (uint8_t *)chunk
+					 + probe * (DATASTORE_CHUNKSIZE / 8),
+					 chunk_offset, len);
+			continue;
+		}
+
+		if ((ret = sr_datastore_get_chunk(ds, pos, &data, &len)) != SR_OK)
+			return ret;
+		len = MIN(len, start + count - pos);
+		sr_bitplane_extract(data, ds->ds_unitsize, probe, len, bitmap,
+				    pos - start);
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Get statistics on the memory used by a datastore.
+ *
+ * @param ds The datastore.
+ * @param stats Pointer to where the statistics will be stored.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ */
+int sr_datastore_get_stats(struct sr_datastore *ds,
+			   struct sr_datastore_stats *stats)
+{
+	uint64_t chunk_bytes;
+
+	if (!ds || !stats)
+		return SR_ERR_ARG;
+
+	chunk_bytes = (uint64_t)DATASTORE_CHUNKSIZE * ds->ds_unitsize;
+
+	*stats = ds->state->stats;
+	stats->raw_bytes = ds->num_units * ds->ds_unitsize;
+	if (ds->state->mode == SR_DS_COMPRESSED) {
+		/* Sealed chunks are already accounted for, add the tail. */
+		if (ds->state->num_chunks)
+			stats->stored_bytes += chunk_bytes;
+	} else {
+		stats->stored_bytes = ds->state->num_chunks * chunk_bytes;
+	}
+
+	return SR_OK;
+}
+
+static unsigned int varint_put(uint8_t *out, uint64_t val)
+{
+	unsigned int len;
+
+	for (len = 1; val >= 0x80; len++) {
+		if (out)
+			*out++ = (val & 0x7f) | 0x80;
+		val >>= 7;
+	}
+	if (out)
+		*out = val;
+
+	return len;
+}
+
+static uint64_t varint_get(const uint8_t **in)
+{
+	uint64_t val;
+	int shift;
+
+	val = shift = 0;
+	do {
+		val |= (uint64_t)(**in & 0x7f) << shift;
+		shift += 7;
+	} while (*(*in)++ & 0x80);
+
+	return val;
+}
+
+/*
+ * The encoders return the encoded size in bytes, or 0 if that would
+ * exceed max_size. If out is NULL, only the size is computed.
+ */
+static uint64_t rle_encode(const uint8_t *in, uint64_t num_units,
+			   int unitsize, uint8_t *out, uint64_t max_size)
+{
+	uint64_t i, run, size;
+
+	size = 0;
+	for (i = 0; i < num_units; i += run) {
+		for (run = 1; i + run < num_units; run++) {
+			if (memcmp(in + i * unitsize,
+				   in + (i + run) * unitsize, unitsize))
+				break;
+		}
+		size += varint_put(out ? out + size : NULL, run);
+		if (out)
+			memcpy(out + size, in + i * unitsize, unitsize);
+		size += unitsize;
+		if (size > max_size)
+			return 0;
+	}
+
+	return size;
+}
+
+static void rle_decode(const uint8_t *in, uint64_t num_units, int unitsize,
+		       uint8_t *out)
+{
+	uint64_t i, run;
+
+	for (i = 0; i < num_units; ) {
+		run = varint_get(&in);
+		for (; run && i < num_units; run--, i++)
+			memcpy(out + i * unitsize, in, unitsize);
+		in += unitsize;
+	}
+}
+
+static uint64_t transition_encode(const uint8_t *in, uint64_t num_units,
+				  int unitsize, uint8_t *out, uint64_t max_size)
+{
+	const uint8_t *prev, *cur;
+	uint64_t i, last, size;
+	uint8_t *mask;
+	int masksize, b;
+
+	masksize = (unitsize + 7) / 8;
+
+	if (out)
+		memcpy(out, in, unitsize);
+	size = unitsize;
+	last = 0;
+	for (i = 1; i < num_units; i++) {
+		prev = in + (i - 1) * unitsize;
+		cur = in + i * unitsize;
+		if (!memcmp(prev, cur, unitsize))
+			continue;
+		size += varint_put(out ? out + size : NULL, i - last);
+		mask = out ? out + size : NULL;
+		if (mask)
+			memset(mask, 0, masksize);
+		size += masksize;
+		for (b = 0; b < unitsize; b++) {
+			if (prev[b] == cur[b])
+				continue;
+			if (out) {
+				mask[b / 8] |= 1 << (b % 8);
+				out[size] = prev[b] ^ cur[b];
+			}
+			size++;
+		}
+		if (size > max_size)
+			return 0;
+		last = i;
+	}
+
+	return size;
+}
+
+static void transition_decode(const uint8_t *in, uint64_t size,
+			      uint64_t num_units, int unitsize, uint8_t *out)
+{
+	const uint8_t *end, *mask;
+	uint64_t i, next;
+	int masksize, b;
+
+	masksize = (unitsize + 7) / 8;
+	end = in + size;
+
+	memcpy(out, in, unitsize);
+	in += unitsize;
+	for (i = 1; i < num_units; ) {
+		next = in < end ? i - 1 + varint_get(&in) : num_units;
+		/* Everything up to the next transition is unchanged. */
+		for (; i < next && i < num_units; i++)
+			memcpy(out + i * unitsize, out + (i - 1) * unitsize,
+			       unitsize);
+		if (i == num_units)
+			break;
+		memcpy(out + i * unitsize, out + (i - 1) * unitsize, unitsize);
+		mask = in;
+		in += masksize;
+		for (b = 0; b < unitsize; b++) {
+			if (mask[b / 8] & (1 << (b % 8)))
+				out[i * unitsize + b] ^= *in++;
+		}
+		i++;
+	}
+}
+
+/*
+ * Compress a full chunk of an SR_DS_COMPRESSED datastore, using whichever
+ * encoding gives the smallest result. The chunk is replaced by its packed
+ * form in the chunk table.
+ */
+static int seal_chunk(struct sr_datastore *ds, unsigned int index)
+{
+	struct packed_chunk *packed;
+	uint64_t chunk_bytes, rle_size, transition_size, size;
+	const uint8_t *chunk;
+	int encoding;
+
+	chunk = ds->state->chunks[index];
+	chunk_bytes = (uint64_t)DATASTORE_CHUNKSIZE * ds->ds_unitsize;
+
+	g_timer_start(ds->state->timer);
+
+	rle_size = rle_encode(chunk, DATASTORE_CHUNKSIZE, ds->ds_unitsize,
+			      NULL, chunk_bytes);
+	transition_size = transition_encode(chunk, DATASTORE_CHUNKSIZE,
+			ds->ds_unitsize, NULL, rle_size ? rle_size : chunk_bytes);
+	if (transition_size) {
+		encoding = ENCODING_TRANSITION;
+		size = transition_size;
+	} else if (rle_size) {
+		encoding = ENCODING_RLE;
+		size = rle_size;
+	} else {
+		encoding = ENCODING_RAW;
+		size = chunk_bytes;
+	}
+
+	if (!(packed = g_try_malloc(sizeof(struct packed_chunk) + size))) {
+		sr_err("ds: %s: packed chunk malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	packed->encoding = encoding;
+	packed->size = size;
+
+	switch (encoding) {
+	case ENCODING_RLE:
+		rle_encode(chunk, DATASTORE_CHUNKSIZE, ds->ds_unitsize,
+			   packed->data, size);
+		ds->state->stats.chunks_rle++;
+		break;
+	case ENCODING_TRANSITION:
+		transition_encode(chunk, DATASTORE_CHUNKSIZE, ds->ds_unitsize,
+				  packed->data, size);
+		ds->state->stats.chunks_transition++;
+		break;
+	default:
+		memcpy(packed->data, chunk, size);
+		ds->state->stats.chunks_raw++;
+	}
+
+	ds->state->stats.encode_usec += g_timer_elapsed(ds->state->timer, NULL)
+					* 1000000;
+	ds->state->stats.encoded_bytes += chunk_bytes;
+	ds->state->stats.stored_bytes += sizeof(struct packed_chunk) + size;
+
+	release_chunk(ds, index, chunk_bytes);
+	ds->state->chunks[index] = packed;
+
+	return SR_OK;
+}
+
+/* Decompress a sealed chunk into the datastore's chunk cache. */
+static gpointer unpack_chunk(struct sr_datastore *ds, unsigned int index)
+{
+	struct packed_chunk *packed;
+
+	if (ds->state->cache_index == (int)index)
+		return ds->state->cache;
+
+	packed = ds->state->chunks[index];
+
+	g_timer_start(ds->state->timer);
+
+	switch (packed->encoding) {
+	case ENCODING_RLE:
+		rle_decode(packed->data, DATASTORE_CHUNKSIZE, ds->ds_unitsize,
+			   ds->state->cache);
+		break;
+	case ENCODING_TRANSITION:
+		transition_decode(packed->data, packed->size,
+				  DATASTORE_CHUNKSIZE, ds->ds_unitsize,
+				  ds->state->cache);
+		break;
+	default:
+		memcpy(ds->state->cache, packed->data, packed->size);
+	}
+
+	ds->state->stats.decode_usec += g_timer_elapsed(ds->state->timer, NULL)
+					* 1000000;
+	ds->state->stats.decoded_bytes += (uint64_t)DATASTORE_CHUNKSIZE
+				   * ds->ds_unitsize;
+	ds->state->cache_index = index;
+
+	return ds->state->cache;
+}
+
+/* Turn a bit-plane chunk back into interleaved units, in the cache. */
+static gpointer interleave_chunk(struct sr_datastore *ds, unsigned int index)
+{
+	uint64_t num_units;
+
+	if (ds->state->cache_index == (int)index)
+		return ds->state->cache;
+
+	num_units = MIN(DATASTORE_CHUNKSIZE,
+			ds->num_units - ds->state->first_unit
+			- (uint64_t)index * DATASTORE_CHUNKSIZE);
+	sr_bitplane_interleave(ds->state->chunks[index],
+			       DATASTORE_CHUNKSIZE / 8, ds->ds_unitsize,
+			       num_units, ds->state->cache);
+	ds->state->cache_index = index;
+
+	return ds->state->cache;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/*
+ * Map a chunk of a file-backed datastore into memory, unmapping the least
+ * recently used chunk if that would exceed the resident memory budget.
+ */
+static gpointer map_chunk(struct sr_datastore *ds, unsigned int index)
+{
+	gpointer chunk;
+	size_t chunk_bytes;
+	unsigned int lru;
+
+	chunk_bytes = (size_t)DATASTORE_CHUNKSIZE * ds->ds_unitsize;
+
+	if (g_queue_get_length(ds->state->mapped) >= ds->state->max_mapped) {
+		lru = GPOINTER_TO_UINT(g_queue_pop_head(ds->state->mapped));
+		munmap(ds->state->chunks[lru], chunk_bytes);
+		ds->state->chunks[lru] = NULL;
+		ds->state->mapped_links[lru] = NULL;
+	}
+
+	chunk = mmap(NULL, chunk_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+		     ds->state->fd, (off_t)(index * ds->state->chunk_stride));
+	if (chunk == MAP_FAILED) {
+		sr_err("ds: %s: failed to map chunk %u", __func__, index);
+		return NULL;
+	}
+	ds->state->chunks[index] = chunk;
+	g_queue_push_tail(ds->state->mapped, GUINT_TO_POINTER(index));
+	ds->state->mapped_links[index] =
+		g_queue_peek_tail_link(ds->state->mapped);
+
+	return chunk;
+}
+#endif
+
+static gpointer get_chunk_data(struct sr_datastore *ds, unsigned int index)
+{
+	if (ds->state->mode == SR_DS_MEMORY)
+		return ds->state->chunks[index];
+
+	if (ds->state->mode == SR_DS_COMPRESSED) {
+		/* Only the last chunk is still being filled up. */
+		if (index == ds->state->num_chunks - 1)
+			return ds->state->chunks[index];
+		return unpack_chunk(ds, index);
+	}
+
+	if (ds->state->mode == SR_DS_BITPLANE)
+		return interleave_chunk(ds, index);
+
+#ifdef HAVE_SYS_MMAN_H
+	if (ds->state->chunks[index]) {
+		/* Already mapped, just mark it as most recently used. */
+		g_queue_unlink(ds->state->mapped,
+			       ds->state->mapped_links[index]);
+		g_queue_push_tail_link(ds->state->mapped,
+				       ds->state->mapped_links[index]);
+		return ds->state->chunks[index];
+	}
+
+	return map_chunk(ds, index);
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * Drop the oldest chunk of a datastore in ring mode. Its buffer is
+ * returned for reuse if it can be, NULL otherwise.
+ */
+static gpointer drop_oldest_chunk(struct sr_datastore *ds)
+{
+	struct packed_chunk *packed;
+	gpointer chunk;
+
+	chunk = NULL;
+	if (ds->state->mode == SR_DS_COMPRESSED) {
+		packed = ds->state->chunks[0];
+		ds->state->stats.stored_bytes -= sizeof(struct packed_chunk)
+					  + packed->size;
+		release_chunk(ds, 0, 0);
+	} else if (ds->state->chunk_refs && ds->state->chunk_refs[0]) {
+		/* Still in use by a snapshot. */
+		release_chunk(ds, 0, chunk_alloc_size(ds, 0));
+	} else {
+		chunk = ds->state->chunks[0];
+	}
+
+	ds->state->num_chunks--;
+	memmove(ds->state->chunks, ds->state->chunks + 1,
+		ds->state->num_chunks * sizeof(gpointer));
+	if (ds->state->chunk_refs)
+		memmove(ds->state->chunk_refs, ds->state->chunk_refs + 1,
+			ds->state->num_chunks * sizeof(struct sr_chunk_ref *));
+	ds->state->first_unit += DATASTORE_CHUNKSIZE;
+	/* Chunk numbers have shifted. */
+	ds->state->cache_index = -1;
+
+	return chunk;
+}
+
+static gpointer new_chunk(struct sr_datastore *ds)
+{
+	struct sr_chunk_ref **refs;
+	gpointer chunk, *chunks;
+	GList **links;
+	unsigned int max_chunks;
+
+	if (ds->state->mode == SR_DS_COMPRESSED && ds->state->num_chunks) {
+		/* The current last chunk is full, compress it. */
+		if (seal_chunk(ds, ds->state->num_chunks - 1) != SR_OK)
+			return NULL;
+	}
+
+	chunk = NULL;
+	if (ds->state->ring_chunks
+	    && ds->state->num_chunks == ds->state->ring_chunks)
+		chunk = drop_oldest_chunk(ds);
+
+	if (ds->state->num_chunks == ds->state->max_chunks) {
+		max_chunks = ds->state->max_chunks ? ds->state->max_chunks * 2
+					    : CHUNKTABLE_INITIAL_SIZE;
+		if (!(chunks = g_try_realloc(ds->state->chunks,
+					     max_chunks * sizeof(gpointer)))) {
+			sr_err("ds: %s: chunk table realloc failed", __func__);
+			return NULL;
+		}
+		ds->state->chunks = chunks;
+		if (ds->state->chunk_refs) {
+			if (!(refs = g_try_realloc(ds->state->chunk_refs,
+					max_chunks * sizeof(struct sr_chunk_ref *)))) {
+				sr_err("ds: %s: chunk refs realloc failed",
+				       __func__);
+				return NULL;
+			}
+			ds->state->chunk_refs = refs;
+		}
+		if (ds->state->mode == SR_DS_FILE) {
+			if (!(links = g_try_realloc(ds->state->mapped_links,
+					max_chunks * sizeof(GList *)))) {
+				sr_err("ds: %s: mapped links realloc failed",
+				       __func__);
+				return NULL;
+			}
+			ds->state->mapped_links = links;
+		}
+		ds->state->max_chunks = max_chunks;
+	}
+	if (ds->state->chunk_refs)
+		ds->state->chunk_refs[ds->state->num_chunks] = NULL;
+
+	if (ds->state->mode == SR_DS_FILE) {
+#ifdef HAVE_SYS_MMAN_H
+		/* Grow the (sparse) file, and map in the new chunk. */
+		if (ftruncate(ds->state->fd,
+			      (off_t)((ds->state->num_chunks + 1)
+				      * ds->state->chunk_stride)) == -1) {
+			sr_err("ds: %s: failed to grow datastore file",
+			       __func__);
+			return NULL;
+		}
+		ds->state->chunks[ds->state->num_chunks] = NULL;
+		ds->state->mapped_links[ds->state->num_chunks] = NULL;
+		if (!(chunk = map_chunk(ds, ds->state->num_chunks)))
+			return NULL;
+		ds->state->num_chunks++;
+		return chunk;
+#else
 		return NULL;
+#endif
+	}
+
+	if (!chunk && !(chunk = sr_mempool_alloc((size_t)DATASTORE_CHUNKSIZE
+						 * ds->ds_unitsize))) {
+		sr_err("ds: %s: chunk malloc failed", __func__);
+		return NULL;
+	}
 
-	(*ds)->chunklist = g_slist_append((*ds)->chunklist, chunk);
+	ds->state->chunks[ds->state->num_chunks++] = chunk;
 
 	return chunk;
 }
@@ -25,6 +25,8 @@
 extern struct sr_global *global;
 
 GSList *devices = NULL;
+/* Sessions in other threads may create devices, e.g. from session files. */
+static GStaticMutex devices_lock = G_STATIC_MUTEX_INIT;
 
 
 void sr_device_scan(void)
@@ -68,7 +70,9 @@ struct sr_device *sr_device_new(struct sr_device_plugin *plugin, int plugin_inde
 
 	device->plugin = plugin;
 	device->plugin_index = plugin_index;
+	g_static_mutex_lock(&devices_lock);
 	devices = g_slist_append(devices, device);
+	g_static_mutex_unlock(&devices_lock);
 
 	for (i = 0; i < num_probes; i++)
 		sr_device_probe_add(device, NULL);
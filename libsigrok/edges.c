@@ -0,0 +1,433 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-probe edge index of the samples in a datastore.
+ *
+ * For every block of 2^EDGE_SHIFT units, the number of edges on each probe
+ * is counted. Like the summaries, blocks are paired up into levels above
+ * that. An edge at unit n means unit n differs from unit n - 1 on that
+ * probe. Finding the next or previous edge walks up the levels past empty
+ * blocks and back down into the first non-empty one, so only O(log n)
+ * blocks plus at most two blocks' worth of samples are looked at.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+#define EDGE_SHIFT 12
+#define EDGE_BLOCKSIZE (1ULL << EDGE_SHIFT)
+#define EDGE_MAX_LEVELS (64 - EDGE_SHIFT)
+
+/* Initial number of blocks allocated for a level, doubled when full. */
+#define EDGE_INITIAL_BLOCKS 64
+
+static uint64_t *block_counts(struct sr_datastore *ds, int level,
+			      uint64_t block)
+{
+	return ds->state->edges[level].counts + block * ds->ds_unitsize * 8;
+}
+
+static int level_append(struct sr_datastore *ds, int level)
+{
+	struct sr_edge_level *lvl;
+	uint64_t *counts, max_blocks;
+	int num_probes;
+
+	num_probes = ds->ds_unitsize * 8;
+	lvl = &ds->state->edges[level];
+	if (lvl->num_blocks == lvl->max_blocks) {
+		max_blocks = lvl->max_blocks ? lvl->max_blocks * 2
+					     : EDGE_INITIAL_BLOCKS;
+		if (!(counts = g_try_realloc(lvl->counts, max_blocks
+				* num_probes * sizeof(uint64_t)))) {
+			sr_err("edges: %s: counts realloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		lvl->counts = counts;
+		lvl->max_blocks = max_blocks;
+	}
+	lvl->num_blocks++;
+	if (level + 1 > ds->state->num_edge_levels)
+		ds->state->num_edge_levels = level + 1;
+
+	return SR_OK;
+}
+
+/* Append the completed level 0 block, and complete blocks above it. */
+static int edges_push(struct sr_datastore *ds)
+{
+	uint64_t *left, *right, *parent;
+	int num_probes, level, p, ret;
+
+	num_probes = ds->ds_unitsize * 8;
+
+	if ((ret = level_append(ds, 0)) != SR_OK)
+		return ret;
+	memcpy(block_counts(ds, 0, ds->state->edges[0].num_blocks - 1),
+	       ds->state->edge_current, num_probes * sizeof(uint64_t));
+	memset(ds->state->edge_current, 0, num_probes * sizeof(uint64_t));
+
+	/* A block completes its parent if it's the right one of a pair. */
+	for (level = 0; level + 1 < EDGE_MAX_LEVELS
+	     && ds->state->edges[level].num_blocks % 2 == 0; level++) {
+		if ((ret = level_append(ds, level + 1)) != SR_OK)
+			return ret;
+		left = block_counts(ds, level,
+				    ds->state->edges[level].num_blocks - 2);
+		right = left + num_probes;
+		parent = block_counts(ds, level + 1,
+				ds->state->edges[level + 1].num_blocks - 1);
+		for (p = 0; p < num_probes; p++)
+			parent[p] = left[p] + right[p];
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Start maintaining an edge index for a datastore.
+ *
+ * This must be called before any data is put into the datastore, and is
+ * not supported in ring mode.
+ *
+ * @param ds The datastore.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR if the
+ *         datastore already contains data.
+ */
+int sr_datastore_enable_edge_index(struct sr_datastore *ds)
+{
+	if (!ds || ds->ds_unitsize > 8 || ds->state->ring_chunks)
+		return SR_ERR_ARG;
+
+	if (ds->num_units)
+		return SR_ERR;
+
+	if (ds->state->edges)
+		return SR_OK;
+
+	if (!(ds->state->edges = g_try_malloc0(EDGE_MAX_LEVELS
+					* sizeof(struct sr_edge_level)))) {
+		sr_err("edges: %s: edges malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (!(ds->state->edge_current = g_try_malloc0(ds->ds_unitsize * 8
+					       * sizeof(uint64_t)))) {
+		sr_err("edges: %s: edge_current malloc failed", __func__);
+		g_free(ds->state->edges);
+		ds->state->edges = NULL;
+		return SR_ERR_MALLOC;
+	}
+	ds->state->num_edge_levels = 0;
+	ds->state->edge_count = 0;
+	ds->state->edge_last = 0;
+
+	return SR_OK;
+}
+
+/* Update the edge index with units just put into the datastore. */
+int sr_edges_update(struct sr_datastore *ds, const uint8_t *data,
+		    uint64_t num_units)
+{
+	uint64_t unit, diff, i;
+	int ret;
+
+	unit = 0;
+	for (i = 0; i < num_units; i++) {
+		memcpy(&unit, data + i * ds->ds_unitsize, ds->ds_unitsize);
+		/* There is no edge at the very first unit. */
+		diff = (ds->num_units + i) ? unit ^ ds->state->edge_last : 0;
+		for (; diff; diff &= diff - 1)
+			ds->state->edge_current[__builtin_ctzll(diff)]++;
+		ds->state->edge_last = unit;
+		if (++ds->state->edge_count == EDGE_BLOCKSIZE) {
+			if ((ret = edges_push(ds)) != SR_OK)
+				return ret;
+			ds->state->edge_count = 0;
+		}
+	}
+
+	return SR_OK;
+}
+
+void sr_edges_free(struct sr_datastore *ds)
+{
+	int i;
+
+	if (!ds->state->edges)
+		return;
+
+	for (i = 0; i < EDGE_MAX_LEVELS; i++)
+		g_free(ds->state->edges[i].counts);
+	g_free(ds->state->edges);
+	g_free(ds->state->edge_current);
+	ds->state->edges = NULL;
+	ds->state->edge_current = NULL;
+}
+
+static int probe_bit(struct sr_datastore *ds, uint64_t pos, int probe,
+		     int *bit)
+{
+	const uint8_t *data;
+	uint64_t num_units;
+	int ret;
+
+	if ((ret = sr_datastore_get_chunk(ds, pos, (const void **)&data,
+					  &num_units)) != SR_OK)
+		return ret;
+	*bit = (data[probe / 8] >> (probe % 8)) & 1;
+
+	return SR_OK;
+}
+
+/*
+ * Scan units [start, end) for edges on a probe, forwards or backwards.
+ * Returns SR_OK and sets *pos if one is found, SR_ERR otherwise.
+ */
+static int scan_edges(struct sr_datastore *ds, int probe, uint64_t start,
+		      uint64_t end, gboolean backwards, uint64_t *pos)
+{
+	const uint8_t *data;
+	uint64_t num_units, i, p;
+	int prev, bit, ret;
+
+	if (start == 0)
+		start = 1;
+	if (start >= end)
+		return SR_ERR;
+
+	if (!backwards) {
+		if ((ret = probe_bit(ds, start - 1, probe, &prev)) != SR_OK)
+			return ret;
+		for (p = start; p < end; p += num_units) {
+			if ((ret = sr_datastore_get_chunk(ds, p,
+					(const void **)&data,
+					&num_units)) != SR_OK)
+				return ret;
+			num_units = MIN(num_units, end - p);
+			for (i = 0; i < num_units; i++) {
+				bit = (data[i * ds->ds_unitsize + probe / 8]
+				       >> (probe % 8)) & 1;
+				if (bit != prev) {
+					*pos = p + i;
+					return SR_OK;
+				}
+			}
+		}
+		return SR_ERR;
+	}
+
+	if ((ret = probe_bit(ds, end - 1, probe, &bit)) != SR_OK)
+		return ret;
+	for (p = end - 1; p >= start; p--) {
+		if ((ret = probe_bit(ds, p - 1, probe, &prev)) != SR_OK)
+			return ret;
+		if (bit != prev) {
+			*pos = p;
+			return SR_OK;
+		}
+		bit = prev;
+	}
+
+	return SR_ERR;
+}
+
+/**
+ * Find the first edge on a probe at or after a given unit.
+ *
+ * @param ds The datastore, which must have an edge index.
+ * @param probe The probe, as bit number within a unit (0 is the LSB).
+ * @param from The unit to start looking at.
+ * @param pos Pointer to where the position of the edge will be stored. An
+ *            edge at position n means unit n differs from unit n - 1.
+ * @return SR_OK if an edge was found, SR_ERR if there is none,
+ *         SR_ERR_ARG upon invalid arguments.
+ */
+int sr_datastore_next_edge(struct sr_datastore *ds, int probe, uint64_t from,
+			   uint64_t *pos)
+{
+	uint64_t b, end;
+	int level, ret;
+
+	if (!ds || !ds->state->edges || !pos || probe < 0
+	    || probe >= ds->ds_unitsize * 8)
+		return SR_ERR_ARG;
+
+	if (from >= ds->num_units)
+		return SR_ERR;
+
+	/* The rest of the block 'from' is in. */
+	end = MIN((from / EDGE_BLOCKSIZE + 1) * EDGE_BLOCKSIZE, ds->num_units);
+	if ((ret = scan_edges(ds, probe, from, end, FALSE, pos)) != SR_ERR)
+		return ret;
+
+	level = 0;
+	b = from / EDGE_BLOCKSIZE + 1;
+	while (1) {
+		if (b >= ds->state->edges[level].num_blocks) {
+			/* Not complete at this level, look at the halves. */
+			if (level == 0)
+				return scan_edges(ds, probe, b * EDGE_BLOCKSIZE,
+						  ds->num_units, FALSE, pos);
+			level--;
+			b *= 2;
+			continue;
+		}
+
+		if (block_counts(ds, level, b)[probe]) {
+			/* Descend into the first non-empty half. */
+			for (; level > 0; level--) {
+				b *= 2;
+				if (!block_counts(ds, level - 1, b)[probe])
+					b++;
+			}
+			return scan_edges(ds, probe, b * EDGE_BLOCKSIZE,
+					  (b + 1) * EDGE_BLOCKSIZE, FALSE, pos);
+		}
+
+		/* Skip this block, going up while we're at a left half. */
+		b++;
+		while (b % 2 == 0 && level + 1 < ds->state->num_edge_levels
+		       && b / 2 < ds->state->edges[level + 1].num_blocks) {
+			level++;
+			b /= 2;
+		}
+	}
+}
+
+/**
+ * Find the last edge on a probe at or before a given unit.
+ *
+ * @param ds The datastore, which must have an edge index.
+ * @param probe The probe, as bit number within a unit (0 is the LSB).
+ * @param from The unit to start looking at.
+ * @param pos Pointer to where the position of the edge will be stored.
+ * @return SR_OK if an edge was found, SR_ERR if there is none,
+ *         SR_ERR_ARG upon invalid arguments.
+ */
+int sr_datastore_prev_edge(struct sr_datastore *ds, int probe, uint64_t from,
+			   uint64_t *pos)
+{
+	uint64_t b;
+	int level, ret;
+
+	if (!ds || !ds->state->edges || !pos || probe < 0
+	    || probe >= ds->ds_unitsize * 8)
+		return SR_ERR_ARG;
+
+	if (!ds->num_units)
+		return SR_ERR;
+	from = MIN(from, ds->num_units - 1);
+
+	/* The start of the block 'from' is in. */
+	b = from / EDGE_BLOCKSIZE;
+	if ((ret = scan_edges(ds, probe, b * EDGE_BLOCKSIZE, from + 1, TRUE,
+			      pos)) != SR_ERR)
+		return ret;
+
+	/* All blocks before this one are complete. */
+	if (b-- == 0)
+		return SR_ERR;
+	level = 0;
+	while (1) {
+		if (block_counts(ds, level, b)[probe]) {
+			/* Descend into the last non-empty half. */
+			for (; level > 0; level--) {
+				b = b * 2 + 1;
+				if (!block_counts(ds, level - 1, b)[probe])
+					b--;
+			}
+			return scan_edges(ds, probe, b * EDGE_BLOCKSIZE,
+					  (b + 1) * EDGE_BLOCKSIZE, TRUE, pos);
+		}
+
+		/* Skip this block, going up while we're at a right half. */
+		if (b-- == 0)
+			return SR_ERR;
+		while (b % 2 == 1 && level + 1 < ds->state->num_edge_levels) {
+			level++;
+			b /= 2;
+		}
+	}
+}
+
+/**
+ * Count the edges on a probe in a range of units.
+ *
+ * @param ds The datastore, which must have an edge index.
+ * @param probe The probe, as bit number within a unit (0 is the LSB).
+ * @param start The first unit of the range.
+ * @param count The number of units in the range.
+ * @param num_edges Pointer to where the number of edges will be stored.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or if the
+ *         range lies (partially) beyond the end of the data.
+ */
+int sr_datastore_count_edges(struct sr_datastore *ds, int probe,
+			     uint64_t start, uint64_t count,
+			     uint64_t *num_edges)
+{
+	uint64_t end, size, next, pos;
+	int level, ret;
+
+	if (!ds || !ds->state->edges || !num_edges || probe < 0
+	    || probe >= ds->ds_unitsize * 8)
+		return SR_ERR_ARG;
+
+	end = start + count;
+	if (end > ds->num_units || end < start)
+		return SR_ERR_ARG;
+
+	*num_edges = 0;
+	while (start < end) {
+		/* Find the largest block starting here which fits. */
+		for (level = ds->state->num_edge_levels - 1; level >= 0;
+		     level--) {
+			size = EDGE_BLOCKSIZE << level;
+			if (start % size == 0 && start + size <= end
+			    && start / size
+			       < ds->state->edges[level].num_blocks)
+				break;
+		}
+
+		if (level >= 0) {
+			*num_edges += block_counts(ds, level,
+						   start / size)[probe];
+			start += size;
+			continue;
+		}
+
+		/* No block fits, count up to the next block by hand. */
+		next = MIN((start / EDGE_BLOCKSIZE + 1) * EDGE_BLOCKSIZE, end);
+		while ((ret = scan_edges(ds, probe, start, next, FALSE,
+					 &pos)) == SR_OK) {
+			(*num_edges)++;
+			start = pos + 1;
+		}
+		if (ret != SR_ERR)
+			return ret;
+		start = next;
+	}
+
+	return SR_OK;
+}
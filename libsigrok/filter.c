@@ -20,7 +20,394 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <glib.h>
 #include <sigrok.h>
+#include <sigrok-internal.h>
+#include <sample.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* How the enabled probes map onto the bits of an input unit. */
+struct probe_map {
+	int in_unitsize;
+	int out_unitsize;
+	int num_probes;
+	/* Input bit each output bit comes from */
+	int shift[64];
+	/* All input bits used, and whether they keep their order */
+	uint64_t mask;
+	int ordered;
+	/* Whether every output byte is a whole input byte, and which one */
+	int whole_bytes;
+	int byte_index[8];
+};
+
+enum {
+	FILTER_IDENTITY,
+	FILTER_SHUFFLE,
+	FILTER_PEXT,
+	FILTER_LUT,
+};
+
+static const char *strategy_names[] = {
+	"identity", "byte shuffle", "bit gather", "lookup tables",
+};
+
+struct sr_filter_plan {
+	int probelist[65];
+	int out_unitsize;
+	struct probe_map map;
+	int strategy;
+	/* Lookup tables, one per input byte holding enabled probes */
+	int num_lut_bytes;
+	int lut_byte[8];
+	uint64_t (*lut)[256];
+};
+
+static int probe_map_init(struct probe_map *map, int in_unitsize,
+			  int out_unitsize, const int *probelist)
+{
+	int i, j;
+
+	map->in_unitsize = in_unitsize;
+	map->out_unitsize = out_unitsize;
+	map->mask = 0;
+	map->ordered = TRUE;
+	for (i = 0; probelist[i]; i++) {
+		if (i == 64 || probelist[i] < 1
+		    || probelist[i] > in_unitsize * 8)
+			return SR_ERR_ARG;
+		map->shift[i] = probelist[i] - 1;
+		map->mask |= 1ULL << map->shift[i];
+		if (i && map->shift[i] <= map->shift[i - 1])
+			map->ordered = FALSE;
+	}
+	map->num_probes = i;
+
+	if ((map->num_probes + 7) / 8 > out_unitsize
+	    || out_unitsize > in_unitsize)
+		return SR_ERR_ARG;
+
+	map->whole_bytes = map->num_probes % 8 == 0;
+	for (i = 0; i < map->num_probes / 8 && map->whole_bytes; i++) {
+		map->byte_index[i] = map->shift[i * 8] / 8;
+		for (j = 0; j < 8; j++) {
+			if (map->shift[i * 8 + j] != map->byte_index[i] * 8 + j)
+				map->whole_bytes = FALSE;
+		}
+	}
+
+	return SR_OK;
+}
+
+static void compact_scalar(const struct probe_map *map, const uint8_t *in,
+			   uint64_t num_units, uint8_t *out)
+{
+	uint64_t sample_in, sample_out, i;
+	int p;
+
+	for (i = 0; i < num_units; i++) {
+		sample_in = sr_sample_load(in + i * map->in_unitsize,
+				      map->in_unitsize);
+		sample_out = 0;
+		for (p = 0; p < map->num_probes; p++)
+			sample_out |= ((sample_in >> map->shift[p]) & 1) << p;
+		sr_sample_store(out + i * map->out_unitsize, sample_out,
+			   map->out_unitsize);
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+#ifdef __x86_64__
+/* The enabled probes, in order, are exactly what PEXT pulls out. */
+__attribute__((target("bmi2")))
+static void compact_pext(const struct probe_map *map, const uint8_t *in,
+			 uint64_t num_units, uint8_t *out)
+{
+	uint64_t sample_in, sample_out, i;
+
+	for (i = 0; i < num_units; i++) {
+		sample_in = sr_sample_load(in + i * map->in_unitsize,
+				      map->in_unitsize);
+		sample_out = _pext_u64(sample_in, map->mask);
+		sr_sample_store(out + i * map->out_unitsize, sample_out,
+			   map->out_unitsize);
+	}
+}
+#endif
+
+/*
+ * Whole bytes are selected, so 16 bytes worth of units can be compacted
+ * with a single byte shuffle. This is only used for unit sizes which
+ * divide 16. Writes never go beyond the input consumed so far, so this
+ * also works in place.
+ */
+__attribute__((target("ssse3")))
+static void compact_shuffle(const struct probe_map *map, const uint8_t *in,
+			    uint64_t num_units, uint8_t *out)
+{
+	uint8_t ctrl[16] __attribute__((aligned(16)));
+	uint8_t tmp[16] __attribute__((aligned(16)));
+	uint64_t per_block, block_out, i;
+	unsigned int u;
+	__m128i shuffle, v;
+	int k;
+
+	per_block = 16 / map->in_unitsize;
+	block_out = per_block * map->out_unitsize;
+	memset(ctrl, 0x80, sizeof(ctrl));
+	for (u = 0; u < per_block; u++) {
+		for (k = 0; k < map->num_probes / 8; k++)
+			ctrl[u * map->out_unitsize + k] = u * map->in_unitsize
+							  + map->byte_index[k];
+	}
+	shuffle = _mm_load_si128((const __m128i *)ctrl);
+
+	for (i = 0; i + per_block <= num_units; i += per_block) {
+		v = _mm_loadu_si128((const __m128i *)
+				    (in + i * map->in_unitsize));
+		_mm_store_si128((__m128i *)tmp, _mm_shuffle_epi8(v, shuffle));
+		memcpy(out + i * map->out_unitsize, tmp, block_out);
+	}
+
+	compact_scalar(map, in + i * map->in_unitsize, num_units - i,
+		       out + i * map->out_unitsize);
+}
+#endif
+
+/*
+ * Every input byte which holds enabled probes gets a table, mapping its
+ * 256 values onto the output bits they end up in. A unit is then
+ * compacted with one lookup per such byte, whatever order the probes
+ * are in.
+ */
+static int lut_init(struct sr_filter_plan *plan)
+{
+	const struct probe_map *map;
+	int byte, bit, p, n;
+	unsigned int v;
+
+	map = &plan->map;
+	plan->num_lut_bytes = 0;
+	for (byte = 0; byte < map->in_unitsize; byte++) {
+		if ((map->mask >> (byte * 8)) & 0xff)
+			plan->lut_byte[plan->num_lut_bytes++] = byte;
+	}
+
+	/* No probes kept: every output unit is just zeroes. */
+	if (!plan->num_lut_bytes)
+		return SR_OK;
+
+	if (!(plan->lut = g_try_malloc0(plan->num_lut_bytes
+					* sizeof(*plan->lut))))
+		return SR_ERR_MALLOC;
+
+	for (n = 0; n < plan->num_lut_bytes; n++) {
+		byte = plan->lut_byte[n];
+		for (p = 0; p < map->num_probes; p++) {
+			if (map->shift[p] / 8 != byte)
+				continue;
+			bit = map->shift[p] % 8;
+			for (v = 0; v < 256; v++) {
+				if (v & (1 << bit))
+					plan->lut[n][v] |= 1ULL << p;
+			}
+		}
+	}
+
+	return SR_OK;
+}
+
+static void compact_lut(const struct sr_filter_plan *plan, const uint8_t *in,
+			uint64_t num_units, uint8_t *out)
+{
+	const struct probe_map *map;
+	uint64_t sample_out, i;
+	const uint8_t *unit;
+	int n;
+
+	map = &plan->map;
+	for (i = 0; i < num_units; i++) {
+		unit = in + i * map->in_unitsize;
+		sample_out = 0;
+		for (n = 0; n < plan->num_lut_bytes; n++)
+			sample_out |= plan->lut[n][unit[plan->lut_byte[n]]];
+		sr_sample_store(out + i * map->out_unitsize, sample_out,
+			   map->out_unitsize);
+	}
+}
+
+static int plan_init(struct sr_filter_plan *plan, int in_unitsize)
+{
+	struct probe_map *map;
+	int ret;
+
+	map = &plan->map;
+	if ((ret = probe_map_init(map, in_unitsize, plan->out_unitsize,
+				  plan->probelist)) != SR_OK)
+		return ret;
+
+	g_free(plan->lut);
+	plan->lut = NULL;
+
+	if (map->num_probes == in_unitsize * 8 && map->ordered
+	    && map->out_unitsize == in_unitsize) {
+		/* All probes are used -- no need to compress anything. */
+		plan->strategy = FILTER_IDENTITY;
+		return SR_OK;
+	}
+
+#ifdef HAVE_X86_SIMD
+	if (map->num_probes && map->whole_bytes && 16 % in_unitsize == 0
+	    && __builtin_cpu_supports("ssse3")) {
+		plan->strategy = FILTER_SHUFFLE;
+		return SR_OK;
+	}
+#ifdef __x86_64__
+	/* A single table lookup beats PEXT, which is slow on some CPUs. */
+	if (map->ordered && (map->mask & ~0xffULL << (map->shift[0] & ~7))
+	    && __builtin_cpu_supports("bmi2")) {
+		plan->strategy = FILTER_PEXT;
+		return SR_OK;
+	}
+#endif
+#endif
+
+	plan->strategy = FILTER_LUT;
+	return lut_init(plan);
+}
+
+/**
+ * Create a plan for removing unused probes from samples.
+ *
+ * The fastest way of moving the enabled probes' bits into place is
+ * worked out once here, typically when SR_DF_HEADER comes in, so that
+ * sr_filter_plan_apply() only has to run it on every packet.
+ *
+ * @param in_unitsize The unit size of the samples the plan is applied to.
+ * @param out_unitsize The unit size of the compacted samples.
+ * @param probelist Zero-terminated list of probe numbers to keep. It is
+ *                  copied, so it doesn't need to outlive the plan.
+ * @param plan Pointer to a variable that will hold the new plan.
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors,
+ *         SR_ERR_ARG upon invalid arguments.
+ */
+int sr_filter_plan_new(int in_unitsize, int out_unitsize,
+		       const int *probelist, struct sr_filter_plan **plan)
+{
+	struct sr_filter_plan *p;
+	int num_probes, ret;
+
+	if (in_unitsize < 1 || in_unitsize > 8 || !probelist || !plan)
+		return SR_ERR_ARG;
+
+	for (num_probes = 0; probelist[num_probes]; num_probes++)
+		;
+	if (num_probes > 64)
+		return SR_ERR_ARG;
+
+	if (!(p = g_try_malloc0(sizeof(struct sr_filter_plan))))
+		return SR_ERR_MALLOC;
+	p->out_unitsize = out_unitsize;
+	memcpy(p->probelist, probelist, num_probes * sizeof(int));
+
+	if ((ret = plan_init(p, in_unitsize)) != SR_OK) {
+		sr_filter_plan_destroy(p);
+		return ret;
+	}
+	sr_dbg("filter: %d of %d probes, %s", num_probes, in_unitsize * 8,
+	       strategy_names[p->strategy]);
+	*plan = p;
+
+	return SR_OK;
+}
+
+/**
+ * Remove unused probes from samples, as set up by sr_filter_plan_new().
+ *
+ * Nothing is allocated here. If no probes need to be removed, data_out
+ * is simply set to data_in. Otherwise the compacted samples are written
+ * to buf, which may be data_in itself to filter in place. Since samples
+ * never grow, a buffer of length_in bytes is always large enough, and
+ * can be reused for every packet.
+ *
+ * If the samples turn out to have a different unit size than the plan
+ * was made for, it is made again for this one.
+ *
+ * @param plan The filter plan.
+ * @param in_unitsize The unit size of the input (data_in).
+ * @param data_in The input data.
+ * @param length_in The input data length.
+ * @param buf The buffer to write compacted samples to.
+ * @param buf_size The size of buf.
+ * @param data_out Will be set to either data_in or buf.
+ * @param length_out The output data length.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or if buf
+ *         is too small.
+ */
+int sr_filter_plan_apply(struct sr_filter_plan *plan, int in_unitsize,
+			 const unsigned char *data_in, uint64_t length_in,
+			 unsigned char *buf, uint64_t buf_size,
+			 const unsigned char **data_out, uint64_t *length_out)
+{
+	uint64_t num_units, t;
+	int ret;
+
+	if (!plan || in_unitsize < 1 || in_unitsize > 8)
+		return SR_ERR_ARG;
+
+	if (in_unitsize != plan->map.in_unitsize) {
+		sr_dbg("filter: unit size changed from %d to %d",
+		       plan->map.in_unitsize, in_unitsize);
+		if ((ret = plan_init(plan, in_unitsize)) != SR_OK)
+			return ret;
+	}
+
+	if (plan->strategy == FILTER_IDENTITY) {
+		/* All probes are used -- no need to compress anything. */
+		*data_out = data_in;
+		*length_out = length_in;
+		return SR_OK;
+	}
+
+	num_units = length_in / in_unitsize;
+	if (!buf || buf_size < num_units * plan->map.out_unitsize)
+		return SR_ERR_ARG;
+
+	t = sr_trace_begin();
+	switch (plan->strategy) {
+#ifdef HAVE_X86_SIMD
+	case FILTER_SHUFFLE:
+		compact_shuffle(&plan->map, data_in, num_units, buf);
+		break;
+#ifdef __x86_64__
+	case FILTER_PEXT:
+		compact_pext(&plan->map, data_in, num_units, buf);
+		break;
+#endif
+#endif
+	case FILTER_LUT:
+		compact_lut(plan, data_in, num_units, buf);
+		break;
+	}
+	sr_trace_end("filter", t, length_in);
+	*data_out = buf;
+	*length_out = num_units * plan->map.out_unitsize;
+
+	return SR_OK;
+}
+
+void sr_filter_plan_destroy(struct sr_filter_plan *plan)
+{
+	if (!plan)
+		return;
+
+	g_free(plan->lut);
+	g_free(plan);
+}
 
 /**
  * Remove unused probes from samples.
@@ -29,6 +416,10 @@
  * it -- to a sample taking up only as much space as required, with
  * unused probes removed.
  *
+ * This works out how to do so, and allocates the output, on every call;
+ * frontends filtering a stream of packets should create an sr_filter_plan
+ * once instead, and reuse their output buffer.
+ *
  * @param in_unitsize The unit size of the input (data_in).
  * @param out_unitsize The unit size of the output (data_out).
  * @param probelist Pointer to a list of integers (probe numbers).
@@ -36,45 +427,34 @@
  * @param length_in The input data length.
  * @param data_out The output data.
  * @param length_out The output data length.
- * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors.
+ * @return SR_OK upon success, SR_ERR_MALLOC upon memory allocation errors,
+ *         SR_ERR_ARG upon invalid arguments.
  */
 int sr_filter_probes(int in_unitsize, int out_unitsize, int *probelist,
 		     const unsigned char *data_in, uint64_t length_in,
 		     char **data_out, uint64_t *length_out)
 {
-	unsigned int in_offset, out_offset;
-	int num_enabled_probes, out_bit, i;
-	uint64_t sample_in, sample_out;
-
-	if (!(*data_out = malloc(length_in)))
-		return SR_ERR_MALLOC;
+	struct sr_filter_plan *plan;
+	const unsigned char *out;
+	int ret;
 
-	num_enabled_probes = 0;
-	for (i = 0; probelist[i]; i++)
-		num_enabled_probes++;
+	if ((ret = sr_filter_plan_new(in_unitsize, out_unitsize, probelist,
+				      &plan)) != SR_OK)
+		return ret;
 
-	if (num_enabled_probes == in_unitsize * 8) {
-		/* All probes are used -- no need to compress anything. */
-		memcpy(*data_out, data_in, length_in);
-		*length_out = length_in;
-		return SR_OK;
+	if (!(*data_out = malloc(length_in))) {
+		sr_filter_plan_destroy(plan);
+		return SR_ERR_MALLOC;
 	}
 
-	/* If we reached this point, not all probes are used, so "compress". */
-	in_offset = out_offset = 0;
-	while (in_offset <= length_in - in_unitsize) {
-		memcpy(&sample_in, data_in + in_offset, in_unitsize);
-		sample_out = out_bit = 0;
-		for (i = 0; probelist[i]; i++) {
-			if (sample_in & (1 << (probelist[i] - 1)))
-				sample_out |= (1 << out_bit);
-			out_bit++;
-		}
-		memcpy((*data_out) + out_offset, &sample_out, out_unitsize);
-		in_offset += in_unitsize;
-		out_offset += out_unitsize;
-	}
-	*length_out = out_offset;
+	ret = sr_filter_plan_apply(plan, in_unitsize, data_in, length_in,
+				   (unsigned char *)*data_out, length_in,
+				   &out, length_out);
+	if (ret == SR_OK && out == data_in)
+		memcpy(*data_out, data_in, length_in);
+	else if (ret != SR_OK)
+		free(*data_out);
+	sr_filter_plan_destroy(plan);
 
-	return SR_OK;
+	return ret;
 }
@@ -832,6 +832,24 @@ static int get_trigger_offset(uint16_t *samples, uint16_t last_sample,
 	return i & 0x7;
 }
 
+/* Send count samples, which are in buf, to sigrok. */
+static void send_samples(struct sigma *sigma, struct sr_buffer *buf,
+			 uint16_t *samples, int count)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+
+	packet.type = SR_DF_LOGIC;
+	/* TODO: fill in timeoffset and duration */
+	packet.timeoffset = 0;
+	packet.duration = 0;
+	packet.payload = &logic;
+	logic.length = count * sizeof(uint16_t);
+	logic.unitsize = 2;
+	logic.data = samples;
+	sr_session_buffer_commit(sigma->session_id, &packet, buf);
+}
+
 /*
  * Decode chunk of 1024 bytes, 64 clusters, 7 events per cluster.
  * Each event is 20ns apart, and can contain multiple samples.
@@ -840,6 +858,9 @@ static int get_trigger_offset(uint16_t *samples, uint16_t last_sample,
  * For 100 MHz, events contain 2 samples for each channel, spread 10 ns apart.
  * For 50 MHz and below, events contain one sample for each channel,
  * spread 20 ns apart.
+ *
+ * The samples of each cluster, and the padding before it, are decoded
+ * straight into a buffer from the session.
  */
 static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 			   uint16_t *lastsample, int triggerpos,
@@ -848,9 +869,9 @@ static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 	struct sr_device_instance *sdi = session_data;
 	struct sigma *sigma = sdi->priv;
 	uint16_t tsdiff, ts;
-	uint16_t samples[65536 * sigma->samples_per_event];
+	struct sr_buffer *sbuf;
+	uint16_t *samples;
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_logic logic;
 	int i, j, k, l, numpad, tosend;
 	size_t n = 0, sent = 0;
 	int clustersize = EVENTS_PER_CLUSTER * sigma->samples_per_event;
@@ -880,33 +901,29 @@ static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 		if (limit_chunk && ts > limit_chunk)
 			return SR_OK;
 
-		/* Pad last sample up to current point. */
 		numpad = tsdiff * sigma->samples_per_event - clustersize;
-		if (numpad > 0) {
-			for (j = 0; j < numpad; ++j)
-				samples[j] = *lastsample;
+		if (numpad < 0)
+			numpad = 0;
 
-			n = numpad;
+		if (!(sbuf = sr_session_buffer_acquire((numpad + clustersize)
+						       * sizeof(uint16_t)))) {
+			sr_err("sigma: %s: sbuf malloc failed", __func__);
+			return SR_ERR_MALLOC;
 		}
+		samples = sbuf->data;
+
+		/* Pad last sample up to current point. */
+		for (j = 0; j < numpad; ++j)
+			samples[j] = *lastsample;
 
 		/* Send samples between previous and this timestamp to sigrok. */
 		sent = 0;
-		while (sent < n) {
-			tosend = MIN(2048, n - sent);
-
-			packet.type = SR_DF_LOGIC;
-			/* TODO: fill in timeoffset and duration */
-			packet.timeoffset = 0;
-			packet.duration = 0;
-			packet.payload = &logic;
-			logic.length = tosend * sizeof(uint16_t);
-			logic.unitsize = 2;
-			logic.data = samples + sent;
-			sr_session_bus(sigma->session_id, &packet);
-
+		while (sent < (size_t)numpad) {
+			tosend = MIN(2048, numpad - sent);
+			send_samples(sigma, sbuf, samples + sent, tosend);
 			sent += tosend;
 		}
-		n = 0;
+		n = numpad;
 
 		event = (uint16_t *) &buf[i * 16 + 2];
 		cur_sample = 0;
@@ -930,7 +947,6 @@ static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 		}
 
 		/* Send data up to trigger point (if triggered). */
-		sent = 0;
 		if (i == triggerts) {
 			/*
 			 * Trigger is not always accurate to sample because of
@@ -938,20 +954,13 @@ static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 			 * the actual event. We therefore look at the next
 			 * samples to pinpoint the exact position of the trigger.
 			 */
-			tosend = get_trigger_offset(samples, *lastsample,
+			tosend = get_trigger_offset(samples + sent,
+						    *lastsample,
 						    &sigma->trigger);
 
 			if (tosend > 0) {
-				packet.type = SR_DF_LOGIC;
-				/* TODO: fill in timeoffset and duration */
-				packet.timeoffset = 0;
-				packet.duration = 0;
-				packet.payload = &logic;
-				logic.length = tosend * sizeof(uint16_t);
-				logic.unitsize = 2;
-				logic.data = samples;
-				sr_session_bus(sigma->session_id, &packet);
-
+				send_samples(sigma, sbuf, samples + sent,
+					     tosend);
 				sent += tosend;
 			}
 
@@ -968,19 +977,11 @@ static int decode_chunk_ts(uint8_t *buf, uint16_t *lastts,
 		/* Send rest of the chunk to sigrok. */
 		tosend = n - sent;
 
-		if (tosend > 0) {
-			packet.type = SR_DF_LOGIC;
-			/* TODO: fill in timeoffset and duration */
-			packet.timeoffset = 0;
-			packet.duration = 0;
-			packet.payload = &logic;
-			logic.length = tosend * sizeof(uint16_t);
-			logic.unitsize = 2;
-			logic.data = samples + sent;
-			sr_session_bus(sigma->session_id, &packet);
-		}
+		if (tosend > 0)
+			send_samples(sigma, sbuf, samples + sent, tosend);
 
 		*lastsample = samples[n - 1];
+		sr_buffer_unref(sbuf);
 	}
 
 	return SR_OK;
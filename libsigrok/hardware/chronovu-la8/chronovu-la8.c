@@ -919,6 +919,7 @@ static void send_block_to_session_bus(struct la8 *la8, int block)
 		packet.payload = &logic;
 		logic.length = BS;
 		logic.unitsize = 1;
+		logic.buffer = NULL;
 		logic.data = la8->final_buf + (block * BS);
 		sr_session_bus(la8->session_id, &packet);
 		return;
@@ -944,6 +945,7 @@ static void send_block_to_session_bus(struct la8 *la8, int block)
 		packet.payload = &logic;
 		logic.length = trigger_point;
 		logic.unitsize = 1;
+		logic.buffer = NULL;
 		logic.data = la8->final_buf + (block * BS);
 		sr_session_bus(la8->session_id, &packet);
 	}
@@ -969,6 +971,7 @@ static void send_block_to_session_bus(struct la8 *la8, int block)
 		packet.payload = &logic;
 		logic.length = BS - trigger_point;
 		logic.unitsize = 1;
+		logic.buffer = NULL;
 		logic.data = la8->final_buf + (block * BS) + trigger_point;
 		sr_session_bus(la8->session_id, &packet);
 	}
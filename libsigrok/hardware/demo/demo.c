@@ -40,6 +40,9 @@
 /* TODO: Should be configurable. */
 #define BUFSIZE                4096
 
+/* Size of the ring buffer between the generator thread and the session. */
+#define RINGSIZE               (1024 * 1024)
+
 /* Supported patterns which we can generate */
 enum {
 	/**
@@ -64,14 +67,28 @@ enum {
 	PATTERN_ALL_HIGH,
 };
 
-/* FIXME: Should not be global. */
-GIOChannel *channels[2];
-
+/* State of an acquisition, kept in the device instance's priv. */
 struct databag {
+	/* Samples go through the ring, the pipe is only used to wake up
+	 * the session loop when it is waiting for data. */
+	struct sr_ringbuffer *ring;
 	int pipe_fds[2];
+	GIOChannel *channels[2];
+	GThread *thread;
+	int thread_running;
+	/* The device's settings when the acquisition was started */
 	uint8_t sample_generator;
-	uint8_t thread_running;
+	uint64_t samplerate;
+	uint64_t period_ps;
+	uint64_t limit_samples;
+	uint64_t limit_msec;
+	/* Position in the sigrok pattern */
+	uint64_t pattern_pos;
 	uint64_t samples_counter;
+	/* Samples sent on to the session so far */
+	uint64_t samples_received;
+	/* Samples are being sent, see hw_stop_acquisition() */
+	gboolean sending;
 	int device_index;
 	gpointer session_data;
 	GTimer *timer;
@@ -120,8 +137,6 @@ static uint64_t period_ps = 5000000;
 static uint64_t limit_samples = 0;
 static uint64_t limit_msec = 0;
 static int default_pattern = PATTERN_SIGROK;
-static GThread *my_thread;
-static int thread_running;
 
 static void hw_stop_acquisition(int device_index, gpointer session_data);
 
@@ -266,9 +281,8 @@ static int hw_set_configuration(int device_index, int capability, void *value)
 
 static void samples_generator(uint8_t *buf, uint64_t size, void *data)
 {
-	static uint64_t p = 0;
 	struct databag *mydata = data;
-	uint64_t i;
+	uint64_t i, p = mydata->pattern_pos;
 
 	/* TODO: Needed? */
 	memset(buf, 0, size);
@@ -280,6 +294,7 @@ static void samples_generator(uint8_t *buf, uint64_t size, void *data)
 			if (++p == 64)
 				p = 0;
 		}
+		mydata->pattern_pos = p;
 		break;
 	case PATTERN_RANDOM: /* Random */
 		for (i = 0; i < size; i++)
@@ -305,88 +320,145 @@ static void samples_generator(uint8_t *buf, uint64_t size, void *data)
 static void thread_func(void *data)
 {
 	struct databag *mydata = data;
-	uint8_t buf[BUFSIZE];
+	uint8_t *buf;
 	uint64_t nb_to_send = 0;
-	int bytes_written;
+	unsigned int len;
+	gsize bytes_written;
 	double time_cur, time_last, time_diff;
 
 	time_last = g_timer_elapsed(mydata->timer, NULL);
 
-	while (thread_running) {
+	while (g_atomic_int_get(&mydata->thread_running)) {
 		/* Rate control */
 		time_cur = g_timer_elapsed(mydata->timer, NULL);
 
 		time_diff = time_cur - time_last;
 		time_last = time_cur;
 
-		nb_to_send = cur_samplerate * time_diff;
+		nb_to_send = mydata->samplerate * time_diff;
 
-		if (limit_samples) {
-			nb_to_send = MIN(nb_to_send,
-				      limit_samples - mydata->samples_counter);
+		if (mydata->limit_samples) {
+			nb_to_send = MIN(nb_to_send, mydata->limit_samples
+					 - mydata->samples_counter);
 		}
 
 		/* Make sure we don't overflow. */
 		nb_to_send = MIN(nb_to_send, BUFSIZE);
 
-		if (nb_to_send) {
-			samples_generator(buf, nb_to_send, data);
-			mydata->samples_counter += nb_to_send;
-
-			g_io_channel_write_chars(channels[1], (gchar *)&buf,
-				nb_to_send, (gsize *)&bytes_written, NULL);
+		/* Generate straight into the ring, in up to two pieces
+		 * if it wraps around. Anything that doesn't fit is lost,
+		 * just like with a real device which overruns. */
+		while (nb_to_send) {
+			len = nb_to_send;
+			buf = sr_ringbuffer_reserve(mydata->ring, &len);
+			if (!len)
+				break;
+			samples_generator(buf, len, data);
+			mydata->samples_counter += len;
+			nb_to_send -= len;
+			if (sr_ringbuffer_commit(mydata->ring, len))
+				g_io_channel_write_chars(mydata->channels[1],
+					"", 1, &bytes_written, NULL);
 		}
 
 		/* Check if we're done. */
-		if ((limit_msec && time_cur * 1000 > limit_msec) ||
-		    (limit_samples && mydata->samples_counter >= limit_samples))
-		{
-			close(mydata->pipe_fds[1]);
-			thread_running = 0;
-		}
+		if ((mydata->limit_msec && time_cur * 1000 > mydata->limit_msec)
+		    || (mydata->limit_samples
+			&& mydata->samples_counter >= mydata->limit_samples))
+			g_atomic_int_set(&mydata->thread_running, 0);
 
 		g_usleep(10);
 	}
+
+	/* Stopped by a limit or by hw_stop_acquisition(), either way. */
+	close(mydata->pipe_fds[1]);
 }
 
-/* Callback handling data */
-static int receive_data(int fd, int revents, void *session_data)
+/* Send the samples straight out of the ring. */
+static void send_samples(struct databag *mydata)
 {
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
-	static uint64_t samples_received = 0;
-	unsigned char c[BUFSIZE];
+	const void *data;
+	unsigned int len;
+
+	while ((data = sr_ringbuffer_peek(mydata->ring, &len)) && len) {
+		len = MIN(len, BUFSIZE);
+		packet.type = SR_DF_LOGIC;
+		packet.payload = &logic;
+		packet.timeoffset = mydata->samples_received
+				    * mydata->period_ps;
+		packet.duration = len * mydata->period_ps;
+		logic.length = len;
+		logic.unitsize = 1;
+		logic.buffer = NULL;
+		logic.data = (void *)data;
+		sr_session_bus(mydata->session_data, &packet);
+		mydata->samples_received += len;
+		sr_ringbuffer_release(mydata->ring, len);
+	}
+}
+
+/* Send the rest of the samples and the last packet, and clean up. */
+static void end_acquisition(struct databag *mydata)
+{
+	struct sr_device_instance *sdi;
+	struct sr_datafeed_packet packet;
+
+	/* From here on hw_stop_acquisition() has nothing left to do. */
+	mydata->sending = TRUE;
+
+	/* Whatever the thread put in the ring in its last round is the rest. */
+	g_atomic_int_set(&mydata->thread_running, 0);
+	g_thread_join(mydata->thread);
+	send_samples(mydata);
+
+	/* Make sure we don't receive more packets. */
+	g_io_channel_close(mydata->channels[0]);
+	g_io_channel_unref(mydata->channels[0]);
+	g_io_channel_unref(mydata->channels[1]);
+
+	/* Send last packet. */
+	packet.type = SR_DF_END;
+	sr_session_bus(mydata->session_data, &packet);
+
+	sr_ringbuffer_destroy(mydata->ring);
+	g_timer_destroy(mydata->timer);
+	if ((sdi = sr_get_device_instance(device_instances,
+					  mydata->device_index)))
+		sdi->priv = NULL;
+	g_free(mydata);
+}
+
+/* Callback handling data */
+static int receive_data(int fd, int revents, void *user_data)
+{
+	struct databag *mydata = user_data;
+	unsigned char c[16];
 	gsize z;
 
 	/* Avoid compiler warnings. */
 	(void)fd;
-	(void)revents;
-
-	do {
-		g_io_channel_read_chars(channels[0],
-				        (gchar *)&c, BUFSIZE, &z, NULL);
-
-		if (z > 0) {
-			packet.type = SR_DF_LOGIC;
-			packet.payload = &logic;
-			packet.timeoffset =  samples_received * period_ps;
-			packet.duration = z * period_ps;
-			logic.length = z;
-			logic.unitsize = 1;
-			logic.data = c;
-			sr_session_bus(session_data, &packet);
-			samples_received += z;
-		}
-	} while (z > 0);
-
-	if (!thread_running && z <= 0) {
-		/* Make sure we don't receive more packets. */
-		g_io_channel_close(channels[0]);
 
-		/* Send last packet. */
-		packet.type = SR_DF_END;
-		sr_session_bus(session_data, &packet);
+	/* Drain the wakeup pipe, the data itself is in the ring. */
+	if (revents & G_IO_IN) {
+		do {
+			z = 0;
+			g_io_channel_read_chars(mydata->channels[0],
+					(gchar *)&c, sizeof(c), &z, NULL);
+		} while (z == sizeof(c));
+	}
 
+	mydata->sending = TRUE;
+	do {
+		send_samples(mydata);
+	} while (g_atomic_int_get(&mydata->thread_running)
+		 && !sr_ringbuffer_wait_prepare(mydata->ring));
+	mydata->sending = FALSE;
+
+	if (!g_atomic_int_get(&mydata->thread_running)) {
+		/* Stopped by a limit, or by a stop while sending. */
+		end_acquisition(mydata);
 		return FALSE;
 	}
 
@@ -395,49 +467,72 @@ static int receive_data(int fd, int revents, void *session_data)
 
 static int hw_start_acquisition(int device_index, gpointer session_data)
 {
+	struct sr_device_instance *sdi;
 	struct sr_datafeed_packet *packet;
 	struct sr_datafeed_header *header;
 	struct databag *mydata;
 
-	/* TODO: 'mydata' is never g_free()'d? */
-	if (!(mydata = g_try_malloc(sizeof(struct databag)))) {
+	if (!(sdi = sr_get_device_instance(device_instances, device_index))) {
+		sr_err("demo: %s: sdi was NULL", __func__);
+		return SR_ERR;
+	}
+
+	/* Freed by end_acquisition() once the acquisition has ended. */
+	if (!(mydata = g_try_malloc0(sizeof(struct databag)))) {
 		sr_err("demo: %s: mydata malloc failed", __func__);
 		return SR_ERR_MALLOC;
 	}
 
 	mydata->sample_generator = default_pattern;
+	mydata->samplerate = cur_samplerate;
+	mydata->period_ps = period_ps;
+	mydata->limit_samples = limit_samples;
+	mydata->limit_msec = limit_msec;
 	mydata->session_data = session_data;
 	mydata->device_index = device_index;
-	mydata->samples_counter = 0;
+
+	if (sr_ringbuffer_new(RINGSIZE, &mydata->ring) != SR_OK) {
+		sr_err("demo: %s: ring buffer creation failed", __func__);
+		g_free(mydata);
+		return SR_ERR_MALLOC;
+	}
 
 	if (pipe(mydata->pipe_fds)) {
 		/* TODO: Better error message. */
 		sr_err("demo: %s: pipe() failed", __func__);
+		sr_ringbuffer_destroy(mydata->ring);
+		g_free(mydata);
 		return SR_ERR;
 	}
 
-	channels[0] = g_io_channel_unix_new(mydata->pipe_fds[0]);
-	channels[1] = g_io_channel_unix_new(mydata->pipe_fds[1]);
+	mydata->channels[0] = g_io_channel_unix_new(mydata->pipe_fds[0]);
+	mydata->channels[1] = g_io_channel_unix_new(mydata->pipe_fds[1]);
 
 	/* Set channel encoding to binary (default is UTF-8). */
-	g_io_channel_set_encoding(channels[0], NULL, NULL);
-	g_io_channel_set_encoding(channels[1], NULL, NULL);
+	g_io_channel_set_encoding(mydata->channels[0], NULL, NULL);
+	g_io_channel_set_encoding(mydata->channels[1], NULL, NULL);
 
 	/* Make channels to unbuffered. */
-	g_io_channel_set_buffered(channels[0], FALSE);
-	g_io_channel_set_buffered(channels[1], FALSE);
+	g_io_channel_set_buffered(mydata->channels[0], FALSE);
+	g_io_channel_set_buffered(mydata->channels[1], FALSE);
+
+	/* The receive side is also polled on timeout, don't block there. */
+	g_io_channel_set_flags(mydata->channels[0], G_IO_FLAG_NONBLOCK, NULL);
 
 	sr_source_add(mydata->pipe_fds[0], G_IO_IN | G_IO_ERR, 40,
-		      receive_data, session_data);
+		      receive_data, mydata);
+
+	/* For hw_stop_acquisition(). */
+	sdi->priv = mydata;
 
 	/* Run the demo thread. */
 	g_thread_init(NULL);
 	/* This must to be done between g_thread_init() & g_thread_create(). */
 	mydata->timer = g_timer_new();
-	thread_running = 1;
-	my_thread =
+	g_atomic_int_set(&mydata->thread_running, 1);
+	mydata->thread =
 	    g_thread_create((GThreadFunc)thread_func, mydata, TRUE, NULL);
-	if (!my_thread) {
+	if (!mydata->thread) {
 		sr_err("demo: %s: g_thread_create failed", __func__);
 		return SR_ERR; /* TODO */
 	}
@@ -470,12 +565,27 @@ static int hw_start_acquisition(int device_index, gpointer session_data)
 
 static void hw_stop_acquisition(int device_index, gpointer session_data)
 {
+	struct sr_device_instance *sdi;
+	struct databag *mydata;
+
 	/* Avoid compiler warnings. */
-	(void)device_index;
 	(void)session_data;
 
+	if (!(sdi = sr_get_device_instance(device_instances, device_index))
+	    || !(mydata = sdi->priv))
+		return;
+
 	/* Stop generate thread. */
-	thread_running = 0;
+	g_atomic_int_set(&mydata->thread_running, 0);
+
+	/*
+	 * The session may not call receive_data() again, so send the rest
+	 * right away. If this was called back from there, it does that.
+	 */
+	if (mydata->sending)
+		return;
+	sr_source_remove(mydata->pipe_fds[0]);
+	end_acquisition(mydata);
 }
 
 struct sr_device_plugin demo_plugin_info = {
@@ -774,6 +774,7 @@ static int receive_data(int fd, int revents, void *session_data)
 				packet.payload = &logic;
 				logic.length = ols->trigger_at * 4;
 				logic.unitsize = 4;
+				logic.buffer = NULL;
 				logic.data = ols->raw_sample_buf +
 					(ols->limit_samples - ols->num_samples) * 4;
 				sr_session_bus(session_data, &packet);
@@ -792,6 +793,7 @@ static int receive_data(int fd, int revents, void *session_data)
 			packet.payload = &logic;
 			logic.length = (ols->num_samples * 4) - (ols->trigger_at * 4);
 			logic.unitsize = 4;
+			logic.buffer = NULL;
 			logic.data = ols->raw_sample_buf + ols->trigger_at * 4 +
 				(ols->limit_samples - ols->num_samples) * 4;
 			sr_session_bus(session_data, &packet);
@@ -803,6 +805,7 @@ static int receive_data(int fd, int revents, void *session_data)
 			packet.payload = &logic;
 			logic.length = ols->num_samples * 4;
 			logic.unitsize = 4;
+			logic.buffer = NULL;
 			logic.data = ols->raw_sample_buf +
 				(ols->limit_samples - ols->num_samples) * 4;
 			sr_session_bus(session_data, &packet);
@@ -69,10 +69,11 @@ static struct sr_samplerates samplerates = {
 
 /* List of struct sr_device_instance, maintained by opendev()/closedev(). */
 static GSList *device_instances = NULL;
+/* Only used to find the devices and upload their firmware. */
 static libusb_context *usb_context = NULL;
 
 static int hw_set_configuration(int device_index, int capability, void *value);
-static void hw_stop_acquisition(int device_index, gpointer session_device_id);
+static void end_acquisition(struct fx2_device *fx2);
 
 /**
  * Check the USB configuration to determine if this is a Saleae Logic.
@@ -150,8 +151,14 @@ static int sl_open_device(int device_index)
 		/* already in use */
 		return SR_ERR;
 
+	if (!fx2->usb_context && libusb_init(&fx2->usb_context) != 0) {
+		sr_warn("Failed to initialize USB.");
+		fx2->usb_context = NULL;
+		return SR_ERR;
+	}
+
 	skip = 0;
-	libusb_get_device_list(usb_context, &devlist);
+	libusb_get_device_list(fx2->usb_context, &devlist);
 	for (i = 0; devlist[i]; i++) {
 		if ((err = libusb_get_device_descriptor(devlist[i], &des))) {
 			sr_warn("failed to get device descriptor: %d", err);
@@ -207,15 +214,23 @@ static int sl_open_device(int device_index)
 
 static void close_device(struct sr_device_instance *sdi)
 {
-	if (sdi->usb->devhdl == NULL)
-		return;
+	struct fx2_device *fx2;
+
+	fx2 = sdi->priv;
 
-	sr_info("saleae: closing device %d on %d.%d interface %d", sdi->index,
-		sdi->usb->bus, sdi->usb->address, USB_INTERFACE);
-	libusb_release_interface(sdi->usb->devhdl, USB_INTERFACE);
-	libusb_close(sdi->usb->devhdl);
-	sdi->usb->devhdl = NULL;
-	sdi->status = SR_ST_INACTIVE;
+	if (sdi->usb->devhdl != NULL) {
+		sr_info("saleae: closing device %d on %d.%d interface %d",
+			sdi->index, sdi->usb->bus, sdi->usb->address,
+			USB_INTERFACE);
+		libusb_release_interface(sdi->usb->devhdl, USB_INTERFACE);
+		libusb_close(sdi->usb->devhdl);
+		sdi->usb->devhdl = NULL;
+		sdi->status = SR_ST_INACTIVE;
+	}
+
+	if (fx2->usb_context)
+		libusb_exit(fx2->usb_context);
+	fx2->usb_context = NULL;
 }
 
 static int configure_probes(struct fx2_device *fx2, GSList *probes)
@@ -551,41 +566,47 @@ static int hw_set_configuration(int device_index, int capability, void *value)
 
 static int receive_data(int fd, int revents, void *user_data)
 {
+	struct fx2_device *fx2;
 	struct timeval tv;
 
 	/* Avoid compiler warnings. */
 	(void)fd;
 	(void)revents;
-	(void)user_data;
 
+	fx2 = user_data;
 	tv.tv_sec = tv.tv_usec = 0;
-	libusb_handle_events_timeout(usb_context, &tv);
+	libusb_handle_events_timeout(fx2->usb_context, &tv);
 
 	return TRUE;
 }
 
+/* A sample transfer in flight, and the buffer it reads into. */
+struct sample_transfer {
+	struct fx2_device *fx2;
+	struct sr_buffer *buf;
+};
+
 void receive_transfer(struct libusb_transfer *transfer)
 {
-	/* TODO: these statics have to move to fx2_device struct */
-	static int num_samples = 0;
-	static int empty_transfer_count = 0;
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
 	struct fx2_device *fx2;
+	struct sample_transfer *st;
+	struct sr_buffer *cur, *next;
 	int cur_buflen, trigger_offset, i;
-	unsigned char *cur_buf, *new_buf;
+	unsigned char *cur_buf;
 
-	/* hw_stop_acquisition() is telling us to stop. */
-	if (transfer == NULL)
-		num_samples = -1;
+	st = transfer->user_data;
+	fx2 = st->fx2;
 
 	/*
 	 * If acquisition has already ended, just free any queued up
 	 * transfer that come in.
 	 */
-	if (num_samples == -1) {
-		if (transfer)
-			libusb_free_transfer(transfer);
+	if (fx2->num_samples == -1) {
+		sr_buffer_unref(st->buf);
+		g_free(st);
+		libusb_free_transfer(transfer);
 		return;
 	}
 
@@ -593,18 +614,19 @@ void receive_transfer(struct libusb_transfer *transfer)
 		transfer->status, transfer->actual_length);
 
 	/* Save incoming transfer before reusing the transfer struct. */
-	cur_buf = transfer->buffer;
+	cur = st->buf;
+	cur_buf = cur->data;
 	cur_buflen = transfer->actual_length;
-	fx2 = transfer->user_data;
 
 	/* Fire off a new request. */
-	if (!(new_buf = g_try_malloc(4096))) {
+	if (!(next = sr_session_buffer_acquire(4096))) {
 		sr_err("saleae: %s: new_buf malloc failed", __func__);
 		// return SR_ERR_MALLOC;
 		return; /* FIXME */
 	}
 
-	transfer->buffer = new_buf;
+	st->buf = next;
+	transfer->buffer = next->data;
 	transfer->length = 4096;
 	if (libusb_submit_transfer(transfer) != 0) {
 		/* TODO: Stop session? */
@@ -612,17 +634,18 @@ void receive_transfer(struct libusb_transfer *transfer)
 	}
 
 	if (cur_buflen == 0) {
-		empty_transfer_count++;
-		if (empty_transfer_count > MAX_EMPTY_TRANSFERS) {
+		fx2->empty_transfer_count++;
+		if (fx2->empty_transfer_count > MAX_EMPTY_TRANSFERS) {
 			/*
 			 * The FX2 gave up. End the acquisition, the frontend
 			 * will work out that the samplecount is short.
 			 */
-			hw_stop_acquisition(-1, fx2->session_data);
+			end_acquisition(fx2);
 		}
+		sr_buffer_unref(cur);
 		return;
 	} else {
-		empty_transfer_count = 0;
+		fx2->empty_transfer_count = 0;
 	}
 
 	trigger_offset = 0;
@@ -643,7 +666,7 @@ void receive_transfer(struct libusb_transfer *transfer)
 					 * Tell the frontend we hit the trigger here.
 					 */
 					packet.type = SR_DF_TRIGGER;
-					packet.timeoffset = (num_samples + i) * fx2->period_ps;
+					packet.timeoffset = (fx2->num_samples + i) * fx2->period_ps;
 					packet.duration = 0;
 					packet.payload = NULL;
 					sr_session_bus(fx2->session_data, &packet);
@@ -653,17 +676,19 @@ void receive_transfer(struct libusb_transfer *transfer)
 					 * skipping past them.
 					 */
 					packet.type = SR_DF_LOGIC;
-					packet.timeoffset = (num_samples + i) * fx2->period_ps;
+					packet.timeoffset = (fx2->num_samples + i) * fx2->period_ps;
 					packet.duration = fx2->trigger_stage * fx2->period_ps;
 					packet.payload = &logic;
 					logic.length = fx2->trigger_stage;
 					logic.unitsize = 1;
+					logic.buffer = NULL;
 					logic.data = fx2->trigger_buffer;
 					sr_session_bus(fx2->session_data, &packet);
 
 					fx2->trigger_stage = TRIGGER_FIRED;
 					break;
 				}
+				sr_buffer_unref(cur);
 				return;
 			}
 
@@ -687,18 +712,17 @@ void receive_transfer(struct libusb_transfer *transfer)
 	if (fx2->trigger_stage == TRIGGER_FIRED) {
 		/* Send the incoming transfer to the session bus. */
 		packet.type = SR_DF_LOGIC;
-		packet.timeoffset = num_samples * fx2->period_ps;
+		packet.timeoffset = fx2->num_samples * fx2->period_ps;
 		packet.duration = cur_buflen * fx2->period_ps;
 		packet.payload = &logic;
 		logic.length = cur_buflen - trigger_offset;
 		logic.unitsize = 1;
 		logic.data = cur_buf + trigger_offset;
-		sr_session_bus(fx2->session_data, &packet);
-		g_free(cur_buf);
+		sr_session_buffer_commit(fx2->session_data, &packet, cur);
 
-		num_samples += cur_buflen;
-		if (fx2->limit_samples && (unsigned int) num_samples > fx2->limit_samples) {
-			hw_stop_acquisition(-1, fx2->session_data);
+		fx2->num_samples += cur_buflen;
+		if (fx2->limit_samples && (unsigned int) fx2->num_samples > fx2->limit_samples) {
+			end_acquisition(fx2);
 		}
 	} else {
 		/*
@@ -706,6 +730,8 @@ void receive_transfer(struct libusb_transfer *transfer)
 		 * ratio-sized buffer.
 		 */
 	}
+
+	sr_buffer_unref(cur);
 }
 
 static int hw_start_acquisition(int device_index, gpointer session_data)
@@ -715,14 +741,16 @@ static int hw_start_acquisition(int device_index, gpointer session_data)
 	struct sr_datafeed_header *header;
 	struct fx2_device *fx2;
 	struct libusb_transfer *transfer;
+	struct sample_transfer *st;
 	const struct libusb_pollfd **lupfd;
 	int size, i;
-	unsigned char *buf;
 
 	if (!(sdi = sr_get_device_instance(device_instances, device_index)))
 		return SR_ERR;
 	fx2 = sdi->priv;
 	fx2->session_data = session_data;
+	fx2->num_samples = 0;
+	fx2->empty_transfer_count = 0;
 
 	if (!(packet = g_try_malloc(sizeof(struct sr_datafeed_packet)))) {
 		sr_err("saleae: %s: packet malloc failed", __func__);
@@ -737,27 +765,34 @@ static int hw_start_acquisition(int device_index, gpointer session_data)
 	/* Start with 2K transfer, subsequently increased to 4K. */
 	size = 2048;
 	for (i = 0; i < NUM_SIMUL_TRANSFERS; i++) {
-		if (!(buf = g_try_malloc(size))) {
+		if (!(st = g_try_malloc(sizeof(struct sample_transfer)))) {
+			sr_err("saleae: %s: st malloc failed", __func__);
+			return SR_ERR_MALLOC;
+		}
+		st->fx2 = fx2;
+		if (!(st->buf = sr_session_buffer_acquire(size))) {
 			sr_err("saleae: %s: buf malloc failed", __func__);
+			g_free(st);
 			return SR_ERR_MALLOC;
 		}
 		transfer = libusb_alloc_transfer(0);
 		libusb_fill_bulk_transfer(transfer, sdi->usb->devhdl,
-				2 | LIBUSB_ENDPOINT_IN, buf, size,
-				receive_transfer, fx2, 40);
+				2 | LIBUSB_ENDPOINT_IN, st->buf->data, size,
+				receive_transfer, st, 40);
 		if (libusb_submit_transfer(transfer) != 0) {
 			/* TODO: Free them all. */
 			libusb_free_transfer(transfer);
-			g_free(buf);
+			sr_buffer_unref(st->buf);
+			g_free(st);
 			return SR_ERR;
 		}
 		size = 4096;
 	}
 
-	lupfd = libusb_get_pollfds(usb_context);
+	lupfd = libusb_get_pollfds(fx2->usb_context);
 	for (i = 0; lupfd[i]; i++)
 		sr_source_add(lupfd[i]->fd, lupfd[i]->events, 40, receive_data,
-			      NULL);
+			      fx2);
 	free(lupfd);
 
 	packet->type = SR_DF_HEADER;
@@ -774,22 +809,35 @@ static int hw_start_acquisition(int device_index, gpointer session_data)
 	return SR_OK;
 }
 
-/* This stops acquisition on ALL devices, ignoring device_index. */
-static void hw_stop_acquisition(int device_index, gpointer session_data)
+/* Send the last packet; transfers still coming in are only freed. */
+static void end_acquisition(struct fx2_device *fx2)
 {
 	struct sr_datafeed_packet packet;
 
-	/* Avoid compiler warnings. */
-	(void)device_index;
+	if (fx2->num_samples == -1)
+		return;
 
 	packet.type = SR_DF_END;
-	sr_session_bus(session_data, &packet);
+	sr_session_bus(fx2->session_data, &packet);
 
-	receive_transfer(NULL);
+	fx2->num_samples = -1;
 
 	/* TODO: Need to cancel and free any queued up transfers. */
 }
 
+static void hw_stop_acquisition(int device_index, gpointer session_data)
+{
+	struct sr_device_instance *sdi;
+
+	/* Avoid compiler warnings. */
+	(void)session_data;
+
+	if (!(sdi = sr_get_device_instance(device_instances, device_index)))
+		return;
+
+	end_acquisition(sdi->priv);
+}
+
 struct sr_device_plugin saleae_logic_plugin_info = {
 	.name = "saleae-logic",
 	.longname = "Saleae Logic",
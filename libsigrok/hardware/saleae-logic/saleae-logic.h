@@ -67,6 +67,14 @@ struct fx2_device {
 	uint8_t trigger_value[NUM_TRIGGER_STAGES];
 	int trigger_stage;
 	uint8_t trigger_buffer[NUM_TRIGGER_STAGES];
+	/* Samples received so far, -1 once the acquisition has ended */
+	int num_samples;
+	int empty_transfer_count;
+	/*
+	 * Each open device has a libusb context of its own, so its events
+	 * are only handled by whoever runs its acquisition.
+	 */
+	libusb_context *usb_context;
 	/*
 	 * opaque session data passed in by the frontend, will be passed back
 	 * on the session bus along with samples.
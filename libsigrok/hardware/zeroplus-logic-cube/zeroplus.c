@@ -544,6 +544,7 @@ static int hw_start_acquisition(int device_index, gpointer session_data)
 		packet.payload = &logic;
 		logic.length = PACKET_SIZE;
 		logic.unitsize = 4;
+		logic.buffer = NULL;
 		logic.data = buf;
 		sr_session_bus(session_data, &packet);
 		samples_read += res / 4;
@@ -82,6 +82,7 @@ static int loadfile(struct sr_input *in, const char *filename)
 	packet.type = SR_DF_LOGIC;
 	packet.payload = &logic;
 	logic.unitsize = (num_probes + 7) / 8;
+	logic.buffer = NULL;
 	logic.data = buffer;
 	while ((size = read(fd, buffer, CHUNKSIZE)) > 0) {
 		logic.length = size;
@@ -141,6 +141,7 @@ static int loadfile(struct sr_input *in, const char *filename)
 	packet.type = SR_DF_LOGIC;
 	packet.payload = &logic;
 	logic.unitsize = (num_probes + 7) / 8;
+	logic.buffer = NULL;
 	logic.data = buf;
 
 	/* Send 8MB of total data to the session bus in small chunks. */
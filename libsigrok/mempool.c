@@ -0,0 +1,362 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pool allocator for sample buffers.
+ *
+ * Memory is taken from the system in slabs of SLAB_SIZE bytes, aligned to
+ * SLAB_SIZE so that the kernel can back them with huge pages. Buffers of
+ * up to half a slab are carved out of slabs in power of two size classes;
+ * larger ones get one or more whole slabs. Freed buffers go onto a free
+ * list for their size class and are handed out again by the next
+ * allocation, so the sample path doesn't go through malloc() once a
+ * session has warmed up, and neither does the next session.
+ *
+ * Slabs are only returned to the system by sr_exit().
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+#define SLAB_SHIFT 21
+#define SLAB_SIZE (1UL << SLAB_SHIFT)
+
+/* Smallest size class, 64 bytes. */
+#define MIN_CLASS_SHIFT 6
+#define NUM_SMALL_CLASSES (SLAB_SHIFT - 1 - MIN_CLASS_SHIFT + 1)
+
+/* Buffers of more slabs than this are mapped and unmapped directly. */
+#define MAX_LARGE_SLABS 16
+
+struct slab {
+	void *mem;
+	size_t size;
+	gboolean hugetlb;
+};
+
+static GStaticMutex pool_mutex = G_STATIC_MUTEX_INIT;
+/* Free lists, linked through the first word of every free buffer. */
+static void *small_free[NUM_SMALL_CLASSES];
+static void *large_free[MAX_LARGE_SLABS + 1];
+static GSList *slabs = NULL;
+static gboolean use_hugetlb = FALSE;
+static struct sr_mempool_stats stats;
+
+/* Size class of a small buffer: the smallest power of two >= size. */
+static int small_class(size_t size)
+{
+	int c;
+
+	for (c = 0; ((size_t)1 << (c + MIN_CLASS_SHIFT)) < size; c++)
+		;
+
+	return c;
+}
+
+static struct slab *slab_new(size_t size)
+{
+	struct slab *slab;
+	uint8_t *mem;
+#ifdef HAVE_SYS_MMAN_H
+	uint8_t *aligned;
+#endif
+
+	if (!(slab = g_try_malloc0(sizeof(struct slab)))) {
+		sr_err("mempool: %s: slab malloc failed", __func__);
+		return NULL;
+	}
+	slab->size = size;
+
+#ifdef HAVE_SYS_MMAN_H
+#ifdef MAP_HUGETLB
+	if (use_hugetlb) {
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mem != MAP_FAILED) {
+			slab->mem = mem;
+			slab->hugetlb = TRUE;
+			return slab;
+		}
+		/* No huge pages reserved (anymore), don't keep trying. */
+		sr_dbg("mempool: no huge pages available, using normal pages");
+		use_hugetlb = FALSE;
+	}
+#endif
+
+	/* Map one slab extra, so the start can be aligned. */
+	mem = mmap(NULL, size + SLAB_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		sr_err("mempool: %s: failed to map %zu bytes", __func__, size);
+		g_free(slab);
+		return NULL;
+	}
+	aligned = (uint8_t *)(((uintptr_t)mem + SLAB_SIZE - 1)
+			      & ~(uintptr_t)(SLAB_SIZE - 1));
+	if (aligned > mem)
+		munmap(mem, aligned - mem);
+	munmap(aligned + size, mem + SLAB_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+	slab->mem = aligned;
+#else
+	/* Without mmap(), the C library can still align the slab. */
+#ifdef _WIN32
+	mem = _aligned_malloc(size, SLAB_SIZE);
+#else
+	if (posix_memalign((void **)&mem, SLAB_SIZE, size))
+		mem = NULL;
+#endif
+	if (!mem) {
+		sr_err("mempool: %s: failed to allocate %zu bytes", __func__,
+		       size);
+		g_free(slab);
+		return NULL;
+	}
+	slab->mem = mem;
+#endif
+
+	return slab;
+}
+
+/* Give memory from slab_new() back to the system. */
+static void slab_release(void *mem, size_t size)
+{
+#ifdef HAVE_SYS_MMAN_H
+	munmap(mem, size);
+#else
+	/* Avoid compiler warnings. */
+	(void)size;
+#ifdef _WIN32
+	_aligned_free(mem);
+#else
+	free(mem);
+#endif
+#endif
+}
+
+static void slab_free(struct slab *slab)
+{
+	slab_release(slab->mem, slab->size);
+	g_free(slab);
+}
+
+/* Get a new slab of the given size, and account for it. */
+static void *pool_grow(size_t size)
+{
+	struct slab *slab;
+
+	if (!(slab = slab_new(size)))
+		return NULL;
+	slabs = g_slist_prepend(slabs, slab);
+
+	stats.num_slabs++;
+	stats.mapped_bytes += size;
+	if (slab->hugetlb)
+		stats.hugetlb_bytes += size;
+
+	return slab->mem;
+}
+
+/**
+ * Allocate a buffer from the sample buffer pool.
+ *
+ * The buffer must be given back with sr_mempool_free(), with the same size.
+ * Buffers of more than half a slab (1 MB) start on a 2 MB boundary.
+ *
+ * @param size The size of the buffer, in bytes.
+ * @return The buffer, or NULL if it could not be allocated.
+ */
+void *sr_mempool_alloc(size_t size)
+{
+	struct slab *slab;
+	uint8_t *mem, *p;
+	size_t csize, n;
+	int c;
+
+	if (!size)
+		return NULL;
+
+	g_static_mutex_lock(&pool_mutex);
+
+	if (size <= SLAB_SIZE / 2) {
+		c = small_class(size);
+		csize = (size_t)1 << (c + MIN_CLASS_SHIFT);
+		if (!small_free[c]) {
+			/* Carve a new slab up into buffers of this class. */
+			if (!(mem = pool_grow(SLAB_SIZE)))
+				goto fail;
+			for (p = mem + SLAB_SIZE - csize; p >= mem; p -= csize) {
+				*(void **)p = small_free[c];
+				small_free[c] = p;
+			}
+		} else {
+			stats.num_recycled++;
+		}
+		mem = small_free[c];
+		small_free[c] = *(void **)mem;
+	} else {
+		n = (size + SLAB_SIZE - 1) / SLAB_SIZE;
+		csize = n * SLAB_SIZE;
+		if (n > MAX_LARGE_SLABS) {
+			/* Too big to bother keeping around. */
+			if (!(slab = slab_new(csize)))
+				goto fail;
+			mem = slab->mem;
+			stats.mapped_bytes += csize;
+			g_free(slab);
+		} else if (large_free[n]) {
+			mem = large_free[n];
+			large_free[n] = *(void **)mem;
+			stats.num_recycled++;
+		} else if (!(mem = pool_grow(csize))) {
+			goto fail;
+		}
+	}
+
+	stats.num_allocs++;
+	stats.used_bytes += csize;
+	if (stats.used_bytes > stats.peak_used_bytes)
+		stats.peak_used_bytes = stats.used_bytes;
+
+	g_static_mutex_unlock(&pool_mutex);
+
+	return mem;
+
+fail:
+	stats.num_failed++;
+	g_static_mutex_unlock(&pool_mutex);
+
+	return NULL;
+}
+
+/**
+ * Give a buffer back to the sample buffer pool.
+ *
+ * @param mem The buffer, as returned by sr_mempool_alloc(). May be NULL.
+ * @param size The size which was passed to sr_mempool_alloc().
+ */
+void sr_mempool_free(void *mem, size_t size)
+{
+	size_t csize, n;
+	int c;
+
+	if (!mem)
+		return;
+
+	g_static_mutex_lock(&pool_mutex);
+
+	if (size <= SLAB_SIZE / 2) {
+		c = small_class(size);
+		csize = (size_t)1 << (c + MIN_CLASS_SHIFT);
+		*(void **)mem = small_free[c];
+		small_free[c] = mem;
+	} else {
+		n = (size + SLAB_SIZE - 1) / SLAB_SIZE;
+		csize = n * SLAB_SIZE;
+		if (n > MAX_LARGE_SLABS) {
+			slab_release(mem, csize);
+			stats.mapped_bytes -= csize;
+		} else {
+			*(void **)mem = large_free[n];
+			large_free[n] = mem;
+		}
+	}
+
+	stats.num_frees++;
+	stats.used_bytes -= csize;
+
+	g_static_mutex_unlock(&pool_mutex);
+}
+
+/**
+ * Back slabs allocated from now on with explicit huge pages (MAP_HUGETLB).
+ *
+ * This needs huge pages to be reserved by the system administrator. If
+ * there are none left, normal pages are used, which the kernel may still
+ * merge into transparent huge pages.
+ *
+ * @param enable TRUE to use explicit huge pages, FALSE to stop doing so.
+ * @return SR_OK upon success, SR_ERR if huge pages are not supported on
+ *         this platform.
+ */
+int sr_mempool_set_hugetlb(gboolean enable)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+	g_static_mutex_lock(&pool_mutex);
+	use_hugetlb = enable;
+	g_static_mutex_unlock(&pool_mutex);
+
+	return SR_OK;
+#else
+	return enable ? SR_ERR : SR_OK;
+#endif
+}
+
+/**
+ * Get statistics on the sample buffer pool.
+ *
+ * @param pool_stats Pointer to where the statistics will be stored.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ */
+int sr_mempool_get_stats(struct sr_mempool_stats *pool_stats)
+{
+	if (!pool_stats)
+		return SR_ERR_ARG;
+
+	g_static_mutex_lock(&pool_mutex);
+	*pool_stats = stats;
+	g_static_mutex_unlock(&pool_mutex);
+
+	return SR_OK;
+}
+
+/* Return all slabs to the system. All buffers must have been freed. */
+void sr_mempool_cleanup(void)
+{
+	GSList *l;
+
+	g_static_mutex_lock(&pool_mutex);
+
+	if (stats.used_bytes)
+		sr_warn("mempool: %" PRIu64 " bytes still in use at cleanup",
+			stats.used_bytes);
+
+	for (l = slabs; l; l = l->next)
+		slab_free(l->data);
+	g_slist_free(slabs);
+	slabs = NULL;
+	memset(small_free, 0, sizeof(small_free));
+	memset(large_free, 0, sizeof(large_free));
+	memset(&stats, 0, sizeof(stats));
+
+	g_static_mutex_unlock(&pool_mutex);
+}
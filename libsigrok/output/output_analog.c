@@ -50,28 +50,29 @@ struct context {
 	int mark_trigger;
 //	struct sr_analog_sample *prevsample;
 	enum outputmode mode;
+	int max_probename_len;
 };
 
 static void flush_linebufs(struct context *ctx, char *outbuf)
 {
-	static int max_probename_len = 0;
 	int len, i;
 
 	if (ctx->linebuf[0] == 0)
 		return;
 
-	if (max_probename_len == 0) {
+	if (ctx->max_probename_len == 0) {
 		/* First time through... */
 		for (i = 0; ctx->probelist[i]; i++) {
 			len = strlen(ctx->probelist[i]);
-			if (len > max_probename_len)
-				max_probename_len = len;
+			if (len > ctx->max_probename_len)
+				ctx->max_probename_len = len;
 		}
 	}
 
 	for (i = 0; ctx->probelist[i]; i++) {
-		sprintf(outbuf + strlen(outbuf), "%*s:%s\n", max_probename_len,
-			ctx->probelist[i], ctx->linebuf + i * ctx->linebuf_len);
+		sprintf(outbuf + strlen(outbuf), "%*s:%s\n",
+			ctx->max_probename_len, ctx->probelist[i],
+			ctx->linebuf + i * ctx->linebuf_len);
 	}
 
 	/* Mark trigger with a ^ character. */
@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <sigrok.h>
 #include <sigrok-internal.h>
+#include <sample.h>
 #include "config.h"
 
 struct context {
@@ -173,7 +174,7 @@ static int data(struct sr_output *o, const char *data_in, uint64_t length_in,
 {
 	struct context *ctx;
 	GString *outstr;
-	uint64_t sample, i;
+	uint64_t samples[SR_SAMPLE_BLOCK], num_units, n, i, k;
 	int j;
 
 	if (!o) {
@@ -199,14 +200,19 @@ static int data(struct sr_output *o, const char *data_in, uint64_t length_in,
 		outstr = g_string_sized_new(512);
 	}
 
-	for (i = 0; i <= length_in - ctx->unitsize; i += ctx->unitsize) {
-		memcpy(&sample, data_in + i, ctx->unitsize);
-		for (j = ctx->num_enabled_probes - 1; j >= 0; j--) {
-			g_string_append_printf(outstr, "%d%c",
-				(int)((sample & (1 << j)) >> j),
-				ctx->separator);
+	num_units = length_in / ctx->unitsize;
+	for (i = 0; i < num_units; i += n) {
+		n = MIN(num_units - i, SR_SAMPLE_BLOCK);
+		sr_samples_load(data_in + i * ctx->unitsize, ctx->unitsize,
+				n, samples);
+		for (k = 0; k < n; k++) {
+			for (j = ctx->num_enabled_probes - 1; j >= 0; j--) {
+				g_string_append_printf(outstr, "%d%c",
+					sr_sample_bit(samples[k], j),
+					ctx->separator);
+			}
+			g_string_append_printf(outstr, "\n");
 		}
-		g_string_append_printf(outstr, "\n");
 	}
 
 	*data_out = outstr->str;
@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <sigrok.h>
 #include <sigrok-internal.h>
+#include <sample.h>
 #include "config.h"
 
 struct context {
@@ -30,6 +31,8 @@ struct context {
 	unsigned int unitsize;
 	char *probelist[SR_MAX_NUM_PROBES + 1];
 	char *header;
+	uint64_t samplecount;
+	uint64_t old_sample;
 };
 
 #define MAX_HEADER_LEN \
@@ -193,9 +196,8 @@ static int data(struct sr_output *o, const char *data_in, uint64_t length_in,
 		char **data_out, uint64_t *length_out)
 {
 	struct context *ctx;
-	unsigned int max_linelen, outsize, p, curbit, i;
-	uint64_t sample;
-	static uint64_t samplecount = 0, old_sample = 0;
+	unsigned int max_linelen, outsize, p, curbit;
+	uint64_t sample, num_units, same, i;
 	char *outbuf, *c;
 
 	if (!o) {
@@ -242,33 +244,43 @@ static int data(struct sr_output *o, const char *data_in, uint64_t length_in,
 		ctx->header = NULL;
 	}
 
-	for (i = 0; i <= length_in - ctx->unitsize; i += ctx->unitsize) {
+	num_units = length_in / ctx->unitsize;
+	for (i = 0; i < num_units; i++) {
 
-		memcpy(&sample, data_in + i, ctx->unitsize);
+		sample = sr_sample_load(data_in + i * ctx->unitsize,
+					ctx->unitsize);
 
 		/*
 		 * Don't output the same samples multiple times. However, make
 		 * sure to output at least the first and last sample.
 		 */
-		if (samplecount++ != 0 && sample == old_sample) {
-			if (i != (length_in - ctx->unitsize))
+		if (ctx->samplecount++ != 0 && sample == ctx->old_sample) {
+			if (i != num_units - 1)
 				continue;
 		}
-		old_sample = sample;
+		ctx->old_sample = sample;
 
 		/* The first column is a counter (needed for gnuplot). */
 		c = outbuf + strlen(outbuf);
-		sprintf(c, "%" PRIu64 "\t", samplecount++);
+		sprintf(c, "%" PRIu64 "\t", ctx->samplecount++);
 
 		/* The next columns are the values of all channels. */
 		for (p = 0; p < ctx->num_enabled_probes; p++) {
-			curbit = (sample & ((uint64_t) (1 << p))) >> p;
+			curbit = sr_sample_bit(sample, p);
 			c = outbuf + strlen(outbuf);
 			sprintf(c, "%d ", curbit);
 		}
 
 		c = outbuf + strlen(outbuf);
 		sprintf(c, "\n");
+
+		/* Skip over repeats of this sample, but not the last one. */
+		if (i + 2 < num_units) {
+			same = sr_samples_span(data_in + (i + 1) * ctx->unitsize,
+					ctx->unitsize, num_units - i - 2, sample);
+			ctx->samplecount += same;
+			i += same;
+		}
 	}
 
 	*data_out = outbuf;
@@ -369,7 +381,6 @@ static int analog_data(struct sr_output *o, char *data_in, uint64_t length_in,
 	struct context *ctx;
 	unsigned int max_linelen, outsize, p, /* curbit, */ i;
 //	uint64_t sample;
-	static uint64_t samplecount = 0;
 	char *outbuf, *c;
 	struct sr_analog_sample *sample;
 
@@ -397,7 +408,7 @@ static int analog_data(struct sr_output *o, char *data_in, uint64_t length_in,
 
 		/* The first column is a counter (needed for gnuplot). */
 		c = outbuf + strlen(outbuf);
-		sprintf(c, "%" PRIu64 "\t", samplecount++);
+		sprintf(c, "%" PRIu64 "\t", ctx->samplecount++);
 
 		/* The next columns are the values of all channels. */
 		for (p = 0; p < ctx->num_enabled_probes; p++) {
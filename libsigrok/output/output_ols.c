@@ -30,6 +30,7 @@
 #include <glib.h>
 #include <sigrok.h>
 #include <sigrok-internal.h>
+#include <sample.h>
 #include "config.h"
 
 struct context {
@@ -102,8 +103,7 @@ static int data(struct sr_output *o, const char *data_in, uint64_t length_in,
 {
 	GString *out;
 	struct context *ctx;
-	uint64_t sample;
-	unsigned int i;
+	uint64_t samples[SR_SAMPLE_BLOCK], num_units, n, i, k;
 
 	ctx = o->internal;
 	if (ctx->header) {
@@ -113,11 +113,14 @@ static int data(struct sr_output *o, const char *data_in, uint64_t length_in,
 	} else
 		out = g_string_sized_new(512);
 
-	for (i = 0; i <= length_in - ctx->unitsize; i += ctx->unitsize) {
-		sample = 0;
-		memcpy(&sample, data_in + i, ctx->unitsize);
-		g_string_append_printf(out, "%08x@%"PRIu64"\n",
-				(uint32_t) sample, ctx->num_samples++);
+	num_units = length_in / ctx->unitsize;
+	for (i = 0; i < num_units; i += n) {
+		n = MIN(num_units - i, SR_SAMPLE_BLOCK);
+		sr_samples_load(data_in + i * ctx->unitsize, ctx->unitsize,
+				n, samples);
+		for (k = 0; k < n; k++)
+			g_string_append_printf(out, "%08x@%"PRIu64"\n",
+					(uint32_t) samples[k], ctx->num_samples++);
 	}
 	*data_out = out->str;
 	*length_out = out->len;
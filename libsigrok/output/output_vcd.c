@@ -24,6 +24,7 @@
 #include <glib.h>
 #include <sigrok.h>
 #include <sigrok-internal.h>
+#include <sample.h>
 #include "config.h"
 
 struct context {
@@ -35,6 +36,7 @@ struct context {
 	uint64_t prevsample;
 	int period;
 	uint64_t samplerate;
+	uint64_t samplecount;
 };
 
 static const char *vcd_header_comment = "\
@@ -160,50 +162,50 @@ static int data(struct sr_output *o, const char *data_in, uint64_t length_in,
 		char **data_out, uint64_t *length_out)
 {
 	struct context *ctx;
-	unsigned int i;
-	int p, curbit, prevbit;
-	uint64_t sample;
-	static uint64_t samplecount = 0;
+	uint64_t i, num_units, sample, diff, same;
+	int p, curbit;
 	GString *out;
-	int first_sample = 0;
 
 	ctx = o->internal;
 	out = g_string_sized_new(512);
+	num_units = length_in / ctx->unitsize;
 
 	if (ctx->header) {
 		/* The header is still here, this must be the first packet. */
 		g_string_append(out, ctx->header->str);
 		g_string_free(ctx->header, TRUE);
 		ctx->header = NULL;
-		first_sample = 1;
+		/* First packet. We neg to make sure sample is stored. */
+		if (num_units)
+			ctx->prevsample = ~sr_sample_load(data_in,
+							  ctx->unitsize);
 	}
 
-	for (i = 0; i <= length_in - ctx->unitsize; i += ctx->unitsize) {
-		samplecount++;
+	for (i = 0; i < num_units; i++) {
+		ctx->samplecount++;
 
-		memcpy(&sample, data_in + i, ctx->unitsize);
+		sample = sr_sample_load(data_in + i * ctx->unitsize,
+					ctx->unitsize);
 
-		if (first_sample) {
-			/* First packet. We neg to make sure sample is stored. */
-			ctx->prevsample = ~sample;
-			first_sample = 0;
-		}
-
-		for (p = 0; p < ctx->num_enabled_probes; p++) {
-			curbit = (sample & ((uint64_t) (1 << p))) >> p;
-			prevbit = (ctx->prevsample & ((uint64_t) (1 << p))) >> p;
-
-			/* VCD only contains deltas/changes of signals. */
-			if (prevbit == curbit)
-				continue;
+		/* VCD only contains deltas/changes of signals. */
+		diff = (sample ^ ctx->prevsample)
+		       & sr_sample_mask(ctx->num_enabled_probes);
+		while (diff) {
+			p = sr_sample_next_change(&diff);
+			curbit = sr_sample_bit(sample, p);
 
 			/* Output which signal changed to which value. */
 			g_string_append_printf(out, "#%" PRIu64 "\n%i%c\n",
-					(uint64_t)(((float)samplecount / ctx->samplerate)
+					(uint64_t)(((float)ctx->samplecount / ctx->samplerate)
 					* ctx->period), curbit, (char)('!' + p));
 		}
-
 		ctx->prevsample = sample;
+
+		/* Skip over samples where nothing changes. */
+		same = sr_samples_span(data_in + (i + 1) * ctx->unitsize,
+				       ctx->unitsize, num_units - i - 1, sample);
+		ctx->samplecount += same;
+		i += same;
 	}
 
 	*data_out = out->str;
@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <sigrok.h>
 #include <sigrok-internal.h>
+#include <sample.h>
 #include "text.h"
 
 int init_ascii(struct sr_output *o)
@@ -63,14 +64,13 @@ int data_ascii(struct sr_output *o, const char *data_in, uint64_t length_in,
 	if (length_in >= ctx->unitsize) {
 		for (offset = 0; offset <= length_in - ctx->unitsize;
 		     offset += ctx->unitsize) {
-			memcpy(&sample, data_in + offset, ctx->unitsize);
+			sample = sr_sample_load(data_in + offset, ctx->unitsize);
 
 			char tmpval[ctx->num_enabled_probes];
 
 			for (p = 0; p < ctx->num_enabled_probes; p++) {
-				uint64_t curbit = (sample & ((uint64_t) 1 << p));
-				uint64_t prevbit = (ctx->prevsample &
-						((uint64_t) 1 << p));
+				int curbit = sr_sample_bit(sample, p);
+				int prevbit = sr_sample_bit(ctx->prevsample, p);
 
 				if (curbit < prevbit && ctx->line_offset > 0) {
 					ctx->linebuf[p * ctx->linebuf_len +
@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <sigrok.h>
 #include <sigrok-internal.h>
+#include <sample.h>
 #include "text.h"
 
 int init_bits(struct sr_output *o)
@@ -60,16 +61,15 @@ int data_bits(struct sr_output *o, const char *data_in, uint64_t length_in,
 		ctx->header = NULL;
 
 		/* Ensure first transition. */
-		memcpy(&ctx->prevsample, data_in, ctx->unitsize);
-		ctx->prevsample = ~ctx->prevsample;
+		ctx->prevsample = ~sr_sample_load(data_in, ctx->unitsize);
 	}
 
 	if (length_in >= ctx->unitsize) {
 		for (offset = 0; offset <= length_in - ctx->unitsize;
 		     offset += ctx->unitsize) {
-			memcpy(&sample, data_in + offset, ctx->unitsize);
+			sample = sr_sample_load(data_in + offset, ctx->unitsize);
 			for (p = 0; p < ctx->num_enabled_probes; p++) {
-				c = (sample & ((uint64_t) 1 << p)) ? '1' : '0';
+				c = sr_sample_bit(sample, p) ? '1' : '0';
 				ctx->linebuf[p * ctx->linebuf_len +
 					     ctx->line_offset] = c;
 			}
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <glib.h>
 #include <sigrok.h>
+#include <sample.h>
 #include "text.h"
 
 int init_hex(struct sr_output *o)
@@ -58,11 +59,10 @@ int data_hex(struct sr_output *o, const char *data_in, uint64_t length_in,
 	ctx->line_offset = 0;
 	for (offset = 0; offset <= length_in - ctx->unitsize;
 	     offset += ctx->unitsize) {
-		memcpy(&sample, data_in + offset, ctx->unitsize);
+		sample = sr_sample_load(data_in + offset, ctx->unitsize);
 		for (p = 0; p < ctx->num_enabled_probes; p++) {
 			ctx->linevalues[p] <<= 1;
-			if (sample & ((uint64_t) 1 << p))
-				ctx->linevalues[p] |= 1;
+			ctx->linevalues[p] |= sr_sample_bit(sample, p);
 			sprintf(ctx->linebuf + (p * ctx->linebuf_len) +
 				ctx->line_offset, "%.2x", ctx->linevalues[p]);
 		}
@@ -44,6 +44,7 @@ struct context {
 	int mark_trigger;
 	uint64_t prevsample;
 	enum outputmode mode;
+	int max_probename_len;
 };
 
 void flush_linebufs(struct context *ctx, char *outbuf);
@@ -0,0 +1,215 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Single-producer/single-consumer ring buffer.
+ *
+ * One thread (typically a driver's acquisition thread) writes samples
+ * straight into the buffer, another one (the session loop) reads them
+ * straight out of it. No locks are taken and no data is copied: both sides
+ * only publish how far they got, using atomic operations on the head and
+ * tail indices. These live on separate cache lines, so the two threads
+ * don't keep stealing the same line from each other.
+ *
+ * The indices run freely and wrap around at 2^32; the buffer size is a
+ * power of two, so the position in the buffer is simply index & mask.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+#define CACHELINE_SIZE 64
+
+struct sr_ringbuffer {
+	/* Producer side: written by the producer only. */
+	volatile gint head;
+	/* Consumer's tail as last seen by the producer. */
+	guint cached_tail;
+	char pad0[CACHELINE_SIZE - sizeof(gint) - sizeof(guint)];
+
+	/* Consumer side: written by the consumer only. */
+	volatile gint tail;
+	/* Producer's head as last seen by the consumer. */
+	guint cached_head;
+	char pad1[CACHELINE_SIZE - sizeof(gint) - sizeof(guint)];
+
+	/* Set by the consumer when it's about to go to sleep. */
+	volatile gint waiting;
+	char pad2[CACHELINE_SIZE - sizeof(gint)];
+
+	/* Read-only after creation. */
+	guint size;
+	guint mask;
+	uint8_t *buf;
+};
+
+/**
+ * Create a new ring buffer.
+ *
+ * @param size The size of the buffer in bytes. This is rounded up to the
+ *             next power of two.
+ * @param rb Pointer to where the new ring buffer will be stored.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors.
+ */
+int sr_ringbuffer_new(unsigned int size, struct sr_ringbuffer **rb)
+{
+	unsigned int bufsize;
+
+	if (!rb || size == 0 || size > (1U << 31))
+		return SR_ERR_ARG;
+
+	for (bufsize = 1; bufsize < size; bufsize <<= 1)
+		;
+
+	if (!(*rb = g_try_malloc0(sizeof(struct sr_ringbuffer)))) {
+		sr_err("ringbuffer: %s: rb malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+
+	if (!((*rb)->buf = g_try_malloc(bufsize))) {
+		sr_err("ringbuffer: %s: buf malloc failed", __func__);
+		g_free(*rb);
+		return SR_ERR_MALLOC;
+	}
+	(*rb)->size = bufsize;
+	(*rb)->mask = bufsize - 1;
+
+	return SR_OK;
+}
+
+void sr_ringbuffer_destroy(struct sr_ringbuffer *rb)
+{
+	if (!rb)
+		return;
+
+	g_free(rb->buf);
+	g_free(rb);
+}
+
+/**
+ * Reserve space to write to (producer only).
+ *
+ * Returns a pointer to contiguous free space in the buffer. Nothing becomes
+ * visible to the consumer until sr_ringbuffer_commit() is called. Calling
+ * this again without committing returns the same space.
+ *
+ * @param rb The ring buffer.
+ * @param len On entry, the maximum number of bytes wanted. On return, the
+ *            number of contiguous bytes available at the returned address,
+ *            which may be less (or 0, if the buffer is full).
+ * @return Pointer to the reserved space.
+ */
+void *sr_ringbuffer_reserve(struct sr_ringbuffer *rb, unsigned int *len)
+{
+	guint head, used, avail;
+
+	head = (guint)rb->head;
+	used = head - rb->cached_tail;
+	if (used + *len > rb->size) {
+		/* Looks full, check where the consumer really is. */
+		rb->cached_tail = (guint)g_atomic_int_get(&rb->tail);
+		used = head - rb->cached_tail;
+	}
+
+	avail = MIN(rb->size - used, rb->size - (head & rb->mask));
+	*len = MIN(*len, avail);
+
+	return rb->buf + (head & rb->mask);
+}
+
+/**
+ * Publish reserved space to the consumer (producer only).
+ *
+ * @param rb The ring buffer.
+ * @param len The number of bytes written into the reserved space.
+ * @return TRUE if the consumer announced it was going to sleep with
+ *         sr_ringbuffer_wait_prepare(), and needs to be woken up.
+ */
+gboolean sr_ringbuffer_commit(struct sr_ringbuffer *rb, unsigned int len)
+{
+	g_atomic_int_set(&rb->head, (gint)((guint)rb->head + len));
+
+	if (!g_atomic_int_get(&rb->waiting))
+		return FALSE;
+
+	return g_atomic_int_compare_and_exchange(&rb->waiting, 1, 0);
+}
+
+/**
+ * Get the data available for reading (consumer only).
+ *
+ * @param rb The ring buffer.
+ * @param len On return, the number of contiguous bytes available for
+ *            reading at the returned address (0 if the buffer is empty).
+ * @return Pointer to the data.
+ */
+const void *sr_ringbuffer_peek(struct sr_ringbuffer *rb, unsigned int *len)
+{
+	guint tail;
+
+	tail = (guint)rb->tail;
+	if (rb->cached_head == tail)
+		rb->cached_head = (guint)g_atomic_int_get(&rb->head);
+
+	*len = MIN(rb->cached_head - tail, rb->size - (tail & rb->mask));
+
+	return rb->buf + (tail & rb->mask);
+}
+
+/**
+ * Hand space back to the producer (consumer only).
+ *
+ * @param rb The ring buffer.
+ * @param len The number of bytes consumed, at most what the last call to
+ *            sr_ringbuffer_peek() returned.
+ */
+void sr_ringbuffer_release(struct sr_ringbuffer *rb, unsigned int len)
+{
+	g_atomic_int_set(&rb->tail, (gint)((guint)rb->tail + len));
+}
+
+/**
+ * Announce that the consumer is about to wait for more data.
+ *
+ * After this, the next sr_ringbuffer_commit() returns TRUE so that the
+ * producer knows to wake up the consumer (e.g. by writing to a pipe the
+ * consumer polls on). This way the producer only needs to make a system
+ * call when the consumer is actually idle.
+ *
+ * @param rb The ring buffer.
+ * @return TRUE if the consumer may go to sleep, FALSE if data arrived in
+ *         the meantime, and the consumer should read that first.
+ */
+gboolean sr_ringbuffer_wait_prepare(struct sr_ringbuffer *rb)
+{
+	g_atomic_int_set(&rb->waiting, 1);
+
+	/* Data may have been committed before the flag became visible. */
+	if ((guint)g_atomic_int_get(&rb->head) != (guint)rb->tail) {
+		g_atomic_int_set(&rb->waiting, 0);
+		return FALSE;
+	}
+
+	return TRUE;
+}
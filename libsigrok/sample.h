@@ -0,0 +1,197 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIGROK_SAMPLE_H
+#define SIGROK_SAMPLE_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Helpers for reading logic samples of up to 64 probes out of a buffer.
+ *
+ * Unit sizes 1, 2, 4 and 8 each get their own loop, with fixed size loads
+ * the compiler can unroll and vectorize, instead of a memcpy() of
+ * unitsize bytes per sample. Other unit sizes take the generic path.
+ */
+
+/* Number of samples to load at once with sr_samples_load(). */
+#define SR_SAMPLE_BLOCK 256
+
+static inline uint64_t sr_sample_load(const void *p, int unitsize)
+{
+	uint64_t v64;
+	uint32_t v32;
+	uint16_t v16;
+
+	switch (unitsize) {
+	case 1:
+		return *(const uint8_t *)p;
+	case 2:
+		memcpy(&v16, p, 2);
+		return v16;
+	case 4:
+		memcpy(&v32, p, 4);
+		return v32;
+	case 8:
+		memcpy(&v64, p, 8);
+		return v64;
+	default:
+		v64 = 0;
+		memcpy(&v64, p, unitsize);
+		return v64;
+	}
+}
+
+static inline void sr_sample_store(void *p, uint64_t v, int unitsize)
+{
+	uint32_t v32;
+	uint16_t v16;
+
+	switch (unitsize) {
+	case 1:
+		*(uint8_t *)p = v;
+		break;
+	case 2:
+		v16 = v;
+		memcpy(p, &v16, 2);
+		break;
+	case 4:
+		v32 = v;
+		memcpy(p, &v32, 4);
+		break;
+	default:
+		memcpy(p, &v, unitsize);
+	}
+}
+
+/* Value (0 or 1) of a probe, counting from 0, in a sample. */
+static inline int sr_sample_bit(uint64_t sample, int probe)
+{
+	return (sample >> probe) & 1;
+}
+
+/* All probes below num_probes. */
+static inline uint64_t sr_sample_mask(int num_probes)
+{
+	return num_probes >= 64 ? ~0ULL : (1ULL << num_probes) - 1;
+}
+
+/*
+ * Return the lowest probe set in *diff, typically the XOR of two samples,
+ * and clear it. *diff must not be 0.
+ */
+static inline int sr_sample_next_change(uint64_t *diff)
+{
+	int probe;
+
+	probe = __builtin_ctzll(*diff);
+	*diff &= *diff - 1;
+
+	return probe;
+}
+
+#define SR_SAMPLE_KERNELS(bits)						\
+static inline void sr_samples_load_##bits(const uint8_t *data,		\
+		uint64_t num_units, uint64_t *samples)			\
+{									\
+	uint##bits##_t v;						\
+	uint64_t i;							\
+									\
+	for (i = 0; i < num_units; i++) {				\
+		memcpy(&v, data + i * sizeof(v), sizeof(v));		\
+		samples[i] = v;						\
+	}								\
+}									\
+									\
+static inline uint64_t sr_samples_span_##bits(const uint8_t *data,	\
+		uint64_t num_units, uint64_t sample)			\
+{									\
+	uint##bits##_t v;						\
+	uint64_t i;							\
+									\
+	for (i = 0; i < num_units; i++) {				\
+		memcpy(&v, data + i * sizeof(v), sizeof(v));		\
+		if (v ^ sample)						\
+			break;						\
+	}								\
+									\
+	return i;							\
+}
+
+SR_SAMPLE_KERNELS(8)
+SR_SAMPLE_KERNELS(16)
+SR_SAMPLE_KERNELS(32)
+SR_SAMPLE_KERNELS(64)
+
+/* Widen num_units samples from data into an array of uint64_t. */
+static inline void sr_samples_load(const void *data, int unitsize,
+				   uint64_t num_units, uint64_t *samples)
+{
+	uint64_t i;
+
+	switch (unitsize) {
+	case 1:
+		sr_samples_load_8(data, num_units, samples);
+		break;
+	case 2:
+		sr_samples_load_16(data, num_units, samples);
+		break;
+	case 4:
+		sr_samples_load_32(data, num_units, samples);
+		break;
+	case 8:
+		sr_samples_load_64(data, num_units, samples);
+		break;
+	default:
+		for (i = 0; i < num_units; i++)
+			samples[i] = sr_sample_load((const uint8_t *)data
+						    + i * unitsize, unitsize);
+	}
+}
+
+/*
+ * Return how many of the num_units samples at data are equal to sample,
+ * before the first one that differs.
+ */
+static inline uint64_t sr_samples_span(const void *data, int unitsize,
+				       uint64_t num_units, uint64_t sample)
+{
+	uint64_t i;
+
+	switch (unitsize) {
+	case 1:
+		return sr_samples_span_8(data, num_units, sample);
+	case 2:
+		return sr_samples_span_16(data, num_units, sample);
+	case 4:
+		return sr_samples_span_32(data, num_units, sample);
+	case 8:
+		return sr_samples_span_64(data, num_units, sample);
+	default:
+		for (i = 0; i < num_units; i++) {
+			if (sr_sample_load((const uint8_t *)data + i * unitsize,
+					   unitsize) != sample)
+				break;
+		}
+		return i;
+	}
+}
+
+#endif
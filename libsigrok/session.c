@@ -26,8 +26,10 @@
 #include <sigrok.h>
 #include <sigrok-internal.h>
 
-/* demo.c */
-extern GIOChannel channels[2];
+#ifdef HAVE_SYS_EPOLL_H
+#include <errno.h>
+#include <sys/epoll.h>
+#endif
 
 struct source {
 	int fd;
@@ -35,31 +37,105 @@ struct source {
 	int timeout;
 	sr_receive_data_callback cb;
 	void *user_data;
+	/* Slot in sources[] and pollfds[], or -1 once removed */
+	int index;
+	/* Loop iteration this source was last dispatched in */
+	unsigned int gen;
+	/* Next source on the same fd */
+	struct source *next;
+	/* Pending while the source waits for its timeout */
+	struct sr_timer timer;
+#ifdef _WIN32
+	/* Needed to poll the fd */
+	GIOChannel *channel;
+#endif
 };
 
-/* There can only be one session at a time. */
-struct sr_session *session;
-int num_sources = 0;
-
-struct source *sources = NULL;
-int source_timeout = -1;
+/*
+ * The session which the sr_session_*() functions work on. Every thread has
+ * its own, so that sessions can run in several threads at once.
+ */
+static __thread struct sr_session *session;
 
+static void source_free(struct source *s);
+static void free_dead_sources(struct sr_session_state *st);
 
+/**
+ * Create a new session, and make it the current one of this thread.
+ *
+ * @return The new session, or NULL if it could not be allocated.
+ */
 struct sr_session *sr_session_new(void)
 {
-	session = calloc(1, sizeof(struct sr_session));
+	struct sr_session *s;
+
+	if (!(s = g_try_malloc0(sizeof(struct sr_session)))) {
+		sr_err("session: %s: session malloc failed", __func__);
+		return NULL;
+	}
+	if (!(s->state = g_try_malloc0(sizeof(struct sr_session_state)))) {
+		sr_err("session: %s: state malloc failed", __func__);
+		g_free(s);
+		return NULL;
+	}
+	s->state->epoll_fd = -1;
+	s->state->stats_start = sr_timer_now_ns();
+	session = s;
 
 	return session;
 }
 
+/* Destroy the current session. */
 void sr_session_destroy(void)
 {
+	struct sr_session_state *st;
+	int i;
+
+	if (!session)
+		return;
+	st = session->state;
+
+	sr_session_merge_free(session);
+	sr_session_driver_clear(st);
+	sr_session_bus_async_clear(session);
+	sr_session_subscriptions_clear(session);
+	sr_session_stats_clear(st);
+	sr_datafeed_logic_unref(&st->pending_logic);
+	for (i = 0; i < st->num_sources; i++)
+		source_free(st->sources[i]);
+	free_dead_sources(st);
+	g_free(st->sources);
+	g_free(st->pollfds);
+	if (st->source_fds)
+		g_hash_table_destroy(st->source_fds);
+	if (st->epoll_fd != -1)
+		close(st->epoll_fd);
+	g_free(st);
 
 	g_slist_free(session->devices);
+	g_slist_free(session->datafeed_callbacks);
 
 	/* TODO: Loop over protocol decoders and free them. */
 
 	g_free(session);
+	session = NULL;
+}
+
+/**
+ * Make a session the current one of this thread, which the other
+ * sr_session_*() functions work on.
+ *
+ * A session must only be current in one thread at a time while it runs,
+ * and its devices' drivers run in that thread.
+ */
+void sr_session_set_current(struct sr_session *s)
+{
+	session = s;
+}
+
+struct sr_session *sr_session_get_current(void)
+{
+	return session;
 }
 
 void sr_session_device_clear(void)
@@ -102,56 +178,287 @@ void sr_session_pa_add(struct sr_analyzer *an)
 
 void sr_session_datafeed_callback_clear(void)
 {
+	struct sr_session_state *st;
+	GSList *l;
+
+	st = session->state;
 	g_slist_free(session->datafeed_callbacks);
 	session->datafeed_callbacks = NULL;
+	for (l = st->callback_timings; l; l = l->next)
+		g_free(l->data);
+	g_slist_free(st->callback_timings);
+	st->callback_timings = NULL;
+	sr_session_bus_async_clear(session);
+	sr_session_subscriptions_clear(session);
 }
 
 void sr_session_datafeed_callback_add(sr_datafeed_callback callback)
 {
+	struct sr_session_state *st;
+
+	st = session->state;
 	session->datafeed_callbacks =
 	    g_slist_append(session->datafeed_callbacks, callback);
+	/* Without a timing, the callback just isn't timed. */
+	st->callback_timings = g_slist_append(st->callback_timings,
+			g_try_malloc0(sizeof(struct sr_callback_timing)));
+}
+
+static void source_free(struct source *s)
+{
+#ifdef _WIN32
+	g_io_channel_unref(s->channel);
+#endif
+	g_free(s);
+}
+
+static void free_dead_sources(struct sr_session_state *st)
+{
+	GSList *l;
+
+	for (l = st->dead_sources; l; l = l->next)
+		source_free(l->data);
+	g_slist_free(st->dead_sources);
+	st->dead_sources = NULL;
+}
+
+/* (Re)start a timer to run out timeout ms from now. */
+static void timer_start(struct sr_session_state *st, struct sr_timer *timer,
+			int timeout)
+{
+	uint64_t now;
+
+	now = sr_timer_now();
+	sr_timer_del(timer);
+	/* Start the wheel at the current time, not at 0. */
+	if (!st->timers.num_timers)
+		sr_timer_wheel_init(&st->timers, now);
+	sr_timer_add(&st->timers, timer, now + timeout);
+}
+
+/* (Re)start the source's timeout from now. */
+static void arm_timer(struct sr_session_state *st, struct source *s)
+{
+	if (s->timeout > 0)
+		timer_start(st, &s->timer, s->timeout);
+}
+
+static void coalesce_flush(struct sr_session_state *st);
+
+static void dispatch(struct sr_session_state *st, struct source *s,
+		     int revents)
+{
+	uint64_t t;
+	int ret;
+
+	s->gen = st->loop_gen;
+	if (revents)
+		st->num_wakeups++;
+	else
+		st->num_timeouts++;
+	t = sr_trace_begin();
+	ret = s->cb(s->fd, revents, s->user_data);
+	sr_trace_end(revents ? "source" : "source timeout", t, s->fd);
+	if (!ret)
+		sr_session_source_remove(s->fd);
+	else if (s->index != -1)
+		arm_timer(st, s);
+}
+
+/* Invoke the callbacks of the sources with a timeout of 0. */
+static void dispatch_idle(struct sr_session_state *st)
+{
+	struct source *s;
+	int i;
+
+	for (i = st->num_sources - 1; i >= 0; i--) {
+		if (i >= st->num_sources)
+			continue;
+		s = st->sources[i];
+		if (s->timeout == 0 && s->gen != st->loop_gen)
+			dispatch(st, s, 0);
+	}
 }
 
-static void sr_session_run_poll()
+/* Poll timeout: none while there are sources to call every time. */
+static int poll_timeout(struct sr_session_state *st)
 {
-	GPollFD *fds, my_gpollfd;
+	if (st->num_idle)
+		return 0;
+
+	return sr_timer_next(&st->timers, sr_timer_now());
+}
+
+/* Invoke the callbacks of the sources whose timeout has run out. */
+static void dispatch_timers(struct sr_session_state *st)
+{
+	struct sr_timer *timer;
+	uint64_t now;
+
+	now = sr_timer_now();
+	while ((timer = sr_timer_expire(&st->timers, now))) {
+		if (timer == &st->pending_timer)
+			coalesce_flush(st);
+		else
+			dispatch(st, timer->data, 0);
+	}
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static uint32_t epoll_events(int events)
+{
+	uint32_t ev;
+
+	ev = 0;
+	if (events & G_IO_IN)
+		ev |= EPOLLIN;
+	if (events & G_IO_PRI)
+		ev |= EPOLLPRI;
+	if (events & G_IO_OUT)
+		ev |= EPOLLOUT;
+	if (events & G_IO_ERR)
+		ev |= EPOLLERR;
+	if (events & G_IO_HUP)
+		ev |= EPOLLHUP;
+	if (events & SR_SOURCE_EDGE)
+		ev |= EPOLLET;
+
+	return ev;
+}
+
+static int poll_revents(uint32_t ev)
+{
+	int revents;
+
+	revents = 0;
+	if (ev & EPOLLIN)
+		revents |= G_IO_IN;
+	if (ev & EPOLLPRI)
+		revents |= G_IO_PRI;
+	if (ev & EPOLLOUT)
+		revents |= G_IO_OUT;
+	if (ev & EPOLLERR)
+		revents |= G_IO_ERR;
+	if (ev & EPOLLHUP)
+		revents |= G_IO_HUP;
+
+	return revents;
+}
+
+static void epoll_disable(struct sr_session_state *st)
+{
+	sr_dbg("session: falling back to g_poll()");
+	close(st->epoll_fd);
+	st->epoll_fd = -1;
+	st->epoll_failed = TRUE;
+}
+
+/* Register a new source with epoll, or give up on epoll for it. */
+static void epoll_add(struct sr_session_state *st, struct source *s)
+{
+	struct epoll_event ev;
+
+	if (s->fd < 0 || st->epoll_failed)
+		return;
+
+	if (st->epoll_fd == -1 && (st->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		sr_dbg("session: epoll_create1: %s", strerror(errno));
+		st->epoll_failed = TRUE;
+		return;
+	}
+
+	/* epoll takes every fd only once, g_poll() doesn't mind. */
+	if (s->next) {
+		epoll_disable(st);
+		return;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = epoll_events(s->events);
+	ev.data.ptr = s;
+	if (epoll_ctl(st->epoll_fd, EPOLL_CTL_ADD, s->fd, &ev) == -1) {
+		/* Regular files, for example, can't be used with epoll. */
+		sr_dbg("session: epoll_ctl: %s", strerror(errno));
+		epoll_disable(st);
+	}
+}
+
+/*
+ * Run the session with epoll, until it is halted or a source comes
+ * along that epoll can't handle.
+ */
+static void sr_session_run_epoll(void)
+{
+	struct sr_session_state *st;
+	struct epoll_event events[16];
+	struct source *s;
+	uint64_t t;
 	int ret, i;
 
-	fds = NULL;
-	while (session->running) {
-		if (fds)
-			free(fds);
+	st = session->state;
+	while (session->running && st->epoll_fd != -1) {
+		t = sr_trace_begin();
+		ret = epoll_wait(st->epoll_fd, events, 16, poll_timeout(st));
+		sr_trace_end("poll", t, ret);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			sr_err("session: epoll_wait: %s", strerror(errno));
+			epoll_disable(st);
+			break;
+		}
 
-		/* Construct g_poll()'s array. */
-		fds = malloc(sizeof(GPollFD) * num_sources);
-		for (i = 0; i < num_sources; i++) {
-#ifdef _WIN32
-			g_io_channel_win32_make_pollfd(&channels[0],
-					sources[i].events, &my_gpollfd);
-#else
-			my_gpollfd.fd = sources[i].fd;
-			my_gpollfd.events = sources[i].events;
-			fds[i] = my_gpollfd;
-#endif
+		st->loop_gen++;
+		st->dispatching = TRUE;
+		for (i = 0; i < ret; i++) {
+			s = events[i].data.ptr;
+			/* An earlier callback may have removed it. */
+			if (s->index == -1)
+				continue;
+			dispatch(st, s, poll_revents(events[i].events));
 		}
+		dispatch_timers(st);
+		if (st->num_idle)
+			dispatch_idle(st);
+		st->dispatching = FALSE;
+		free_dead_sources(st);
+	}
+}
+#endif
+
+static void sr_session_run_poll(void)
+{
+	struct sr_session_state *st;
+	struct source *s;
+	uint64_t t;
+	int revents, ret, i;
 
-		ret = g_poll(fds, num_sources, source_timeout);
-
-		for (i = 0; i < num_sources; i++) {
-			if (fds[i].revents > 0 || (ret == 0
-				&& source_timeout == sources[i].timeout)) {
-				/*
-				 * Invoke the source's callback on an event,
-				 * or if the poll timeout out and this source
-				 * asked for that timeout.
-				 */
-				if (!sources[i].cb(fds[i].fd, fds[i].revents,
-						  sources[i].user_data))
-					sr_session_source_remove(sources[i].fd);
-			}
+	st = session->state;
+	while (session->running) {
+		t = sr_trace_begin();
+		ret = g_poll(st->pollfds, st->num_sources, poll_timeout(st));
+		sr_trace_end("poll", t, ret);
+
+		st->loop_gen++;
+		st->dispatching = TRUE;
+		for (i = st->num_sources - 1; i >= 0; i--) {
+			/* Callbacks may have removed sources since. */
+			if (i >= st->num_sources)
+				continue;
+			s = st->sources[i];
+			if (s->gen == st->loop_gen)
+				continue;
+			revents = st->pollfds[i].revents;
+			st->pollfds[i].revents = 0;
+			if (revents > 0)
+				dispatch(st, s, revents);
 		}
+		dispatch_timers(st);
+		if (st->num_idle)
+			dispatch_idle(st);
+		st->dispatching = FALSE;
+		free_dead_sources(st);
 	}
-	free(fds);
 
 }
 
@@ -159,13 +466,24 @@ int sr_session_start(void)
 {
 	struct sr_device *device;
 	GSList *l;
+	uint64_t t;
 	int ret;
 
 	sr_info("session: starting");
+	memset(&session->state->packet_stats, 0,
+	       sizeof(struct sr_packet_stats));
+	sr_session_stats_reset(session);
+	if (session->state->merge)
+		return sr_session_merge_start(session);
+
+	ret = SR_OK;
 	for (l = session->devices; l; l = l->next) {
 		device = l->data;
-		if ((ret = device->plugin->start_acquisition(
-				device->plugin_index, device)) != SR_OK)
+		t = sr_trace_begin();
+		ret = device->plugin->start_acquisition(device->plugin_index,
+							device);
+		sr_trace_end("start acquisition", t, device->plugin_index);
+		if (ret != SR_OK)
 			break;
 	}
 
@@ -174,18 +492,24 @@ int sr_session_start(void)
 
 void sr_session_run(void)
 {
+	struct sr_session_state *st;
 
 	sr_info("session: running");
+	st = session->state;
 	session->running = TRUE;
 
 	/* do we have real sources? */
-	if (num_sources == 1 && sources[0].fd == -1)
+	if (st->num_sources == 1 && st->sources[0]->fd == -1) {
 		/* dummy source, freewheel over it */
 		while (session->running)
-			sources[0].cb(-1, 0, sources[0].user_data);
-	else
-		/* real sources, use g_poll() main loop */
+			st->sources[0]->cb(-1, 0, st->sources[0]->user_data);
+	} else {
+		/* real sources, use the epoll or g_poll() main loop */
+#ifdef HAVE_SYS_EPOLL_H
+		sr_session_run_epoll();
+#endif
 		sr_session_run_poll();
+	}
 
 }
 
@@ -203,6 +527,11 @@ void sr_session_stop(void)
 	GSList *l;
 
 	sr_info("session: stopping");
+	if (session->state->merge) {
+		/* Run on until the devices have sent what they have. */
+		sr_session_merge_stop(session);
+		return;
+	}
 	session->running = FALSE;
 	for (l = session->devices; l; l = l->next) {
 		device = l->data;
@@ -239,69 +568,369 @@ static void datafeed_dump(struct sr_datafeed_packet *packet)
 
 }
 
-void sr_session_bus(struct sr_device *device, struct sr_datafeed_packet *packet)
+static void bus_send(struct sr_session_state *st, struct sr_device *device,
+		     struct sr_datafeed_packet *packet)
 {
-	GSList *l;
+	GSList *l, *timing;
 	sr_datafeed_callback cb;
+	struct sr_datafeed_logic *logic;
+	uint64_t t, tb;
+	int bucket;
+
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		bucket = logic->length ? 63 - __builtin_clzll(logic->length) : 0;
+		st->packet_stats.num_packets++;
+		st->packet_stats.num_bytes += logic->length;
+		st->packet_stats.size_buckets[MIN(bucket, SR_PACKET_SIZE_BUCKETS - 1)]++;
+	}
+	sr_session_stats_packet(st, device, packet);
+
+	if (sr_get_loglevel() >= SR_LOG_DBG)
+		datafeed_dump(packet);
 
 	/*
 	 * TODO: Send packet through PD pipe, and send the output of that to
 	 * the callbacks as well.
 	 */
-	for (l = session->datafeed_callbacks; l; l = l->next) {
+	tb = sr_trace_begin();
+	for (l = session->datafeed_callbacks, timing = st->callback_timings; l;
+	     l = l->next, timing = timing->next) {
 		cb = l->data;
-		datafeed_dump(packet);
+		t = st->timing ? sr_timer_now_ns() : sr_trace_begin();
 		cb(device, packet);
+		if (st->timing && timing->data)
+			sr_callback_timing_add(timing->data,
+					       sr_timer_now_ns() - t);
+		sr_trace_end("callback", t, packet->type);
+	}
+	sr_session_bus_subscribers(session, device, packet);
+	sr_session_bus_async(session, device, packet);
+	sr_trace_end("bus", tb, packet->type);
+}
+
+/* Send the pending logic packet, if any. */
+static void coalesce_flush(struct sr_session_state *st)
+{
+	if (!st->pending_logic.buffer)
+		return;
+
+	sr_timer_del(&st->pending_timer);
+	bus_send(st, st->pending_device, &st->pending);
+	sr_datafeed_logic_unref(&st->pending_logic);
+}
+
+/* Copy the pending samples into a buffer of our own, to add more to. */
+static int coalesce_copy(struct sr_session_state *st)
+{
+	struct sr_buffer *buf;
+
+	if (!(buf = sr_buffer_new(st->coalesce_bytes)))
+		return SR_ERR_MALLOC;
+	memcpy(buf->data, st->pending_logic.data, st->pending_logic.length);
+	sr_buffer_unref(st->pending_logic.buffer);
+	st->pending_logic.buffer = buf;
+	st->pending_logic.data = buf->data;
+	st->pending_copied = TRUE;
+
+	return SR_OK;
+}
+
+static void coalesce_logic(struct sr_session_state *st,
+			   struct sr_device *device,
+			   struct sr_datafeed_packet *packet)
+{
+	struct sr_datafeed_logic *logic;
+
+	logic = packet->payload;
+	if (st->pending_logic.buffer && (device != st->pending_device
+	    || logic->unitsize != st->pending_logic.unitsize
+	    || st->pending_logic.length + logic->length > st->coalesce_bytes))
+		coalesce_flush(st);
+
+	if (!st->pending_logic.buffer) {
+		if (logic->length >= st->coalesce_bytes) {
+			bus_send(st, device, packet);
+			return;
+		}
+		st->pending_logic = *logic;
+		st->pending_copied = FALSE;
+		if (logic->buffer)
+			sr_buffer_ref(logic->buffer);
+		else if (coalesce_copy(st) != SR_OK) {
+			bus_send(st, device, packet);
+			return;
+		}
+		st->pending_device = device;
+		st->pending = *packet;
+		st->pending.payload = &st->pending_logic;
+		if (st->coalesce_latency > 0)
+			timer_start(st, &st->pending_timer, st->coalesce_latency);
+		return;
+	}
+
+	/*
+	 * Samples right after the pending ones in the same buffer are
+	 * simply taken along, anything else is copied.
+	 */
+	if (!st->pending_copied && (logic->buffer != st->pending_logic.buffer
+	    || logic->data != (uint8_t *)st->pending_logic.data
+			      + st->pending_logic.length)
+	    && coalesce_copy(st) != SR_OK) {
+		coalesce_flush(st);
+		bus_send(st, device, packet);
+		return;
+	}
+	if (st->pending_copied)
+		memcpy((uint8_t *)st->pending_logic.data + st->pending_logic.length,
+		       logic->data, logic->length);
+	st->pending_logic.length += logic->length;
+	st->pending.duration += packet->duration;
+	st->packet_stats.num_merged++;
+}
+
+/**
+ * Merge consecutive logic packets from the same device into bigger ones,
+ * before they are sent to the datafeed callbacks.
+ *
+ * Packets are merged up to max_bytes, and held back no longer than
+ * max_latency ms (0 for no limit) while the session runs. Any other
+ * packet, such as SR_DF_TRIGGER or SR_DF_END, first sends what was held
+ * back, so nothing is merged across it.
+ *
+ * @param max_bytes Size of merged packets, or 0 to stop merging.
+ * @param max_latency Time in ms a packet may be held back, or 0.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ */
+int sr_session_coalesce(uint64_t max_bytes, int max_latency)
+{
+	struct sr_session_state *st;
+
+	if (max_latency < 0) {
+		sr_err("session: %s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	st = session->state;
+	coalesce_flush(st);
+	st->coalesce_bytes = max_bytes;
+	st->coalesce_latency = max_latency;
+
+	return SR_OK;
+}
+
+/**
+ * Get the number and sizes of the logic packets sent to the datafeed
+ * callbacks since the session was started.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ */
+int sr_session_get_packet_stats(struct sr_packet_stats *stats)
+{
+	if (!stats)
+		return SR_ERR_ARG;
+
+	*stats = session->state->packet_stats;
+
+	return SR_OK;
+}
+
+void sr_session_bus(struct sr_device *device, struct sr_datafeed_packet *packet)
+{
+	struct sr_session_state *st;
+
+	st = session->state;
+	if (!session->datafeed_callbacks && !st->consumers
+	    && !(st->subscribed_types & SR_DF_MASK(packet->type)))
+		/* Nobody wants this packet. */
+		return;
+
+	if (st->coalesce_bytes) {
+		if (packet->type == SR_DF_LOGIC) {
+			coalesce_logic(st, device, packet);
+			return;
+		}
+		coalesce_flush(st);
 	}
+
+	bus_send(st, device, packet);
+}
+
+/**
+ * Get a buffer for a driver to put at least size bytes of samples in.
+ *
+ * Fill it, and send it with sr_session_buffer_commit(); the datafeed
+ * callbacks can then keep the samples without copying them. The buffer
+ * comes with one reference, for the driver to drop with sr_buffer_unref()
+ * once it is done with it.
+ *
+ * @return The buffer, or NULL if it could not be allocated.
+ */
+struct sr_buffer *sr_session_buffer_acquire(uint64_t size)
+{
+	return sr_buffer_new(size);
+}
+
+/**
+ * Send samples from a buffer from sr_session_buffer_acquire() on the
+ * session bus.
+ *
+ * packet must be an SR_DF_LOGIC packet, whose data and length are within
+ * the buffer; a NULL data means the start of the buffer. The driver keeps
+ * its reference, so it can send more of the same buffer.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ */
+int sr_session_buffer_commit(struct sr_device *device,
+			     struct sr_datafeed_packet *packet,
+			     struct sr_buffer *buf)
+{
+	struct sr_datafeed_logic *logic;
+	uint8_t *start;
+
+	if (!packet || packet->type != SR_DF_LOGIC || !buf) {
+		sr_err("session: %s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	logic = packet->payload;
+	if (!logic->data)
+		logic->data = buf->data;
+	start = buf->data;
+	if ((uint8_t *)logic->data < start
+	    || (uint8_t *)logic->data - start + logic->length > buf->size) {
+		sr_err("session: %s: data not within buffer", __func__);
+		return SR_ERR_ARG;
+	}
+
+	logic->buffer = buf;
+	sr_session_bus(device, packet);
+	logic->buffer = NULL;
+
+	return SR_OK;
 }
 
 void sr_session_source_add(int fd, int events, int timeout,
 	        sr_receive_data_callback callback, void *user_data)
 {
-	struct source *new_sources, *s;
+	struct sr_session_state *st;
+	struct source **new_sources, *s;
+	GPollFD *new_pollfds;
+	int new_max;
 
-	new_sources = calloc(1, sizeof(struct source) * (num_sources + 1));
-
-	if (sources) {
-		memcpy(new_sources, sources,
-		       sizeof(struct source) * num_sources);
-		free(sources);
+	if (!session) {
+		sr_err("session: %s: no current session", __func__);
+		return;
 	}
+	st = session->state;
+
+	if (st->num_sources == st->max_sources) {
+		/* Grow both tables, or leave both as they are. */
+		new_max = st->max_sources ? st->max_sources * 2 : 8;
+		new_sources = g_try_malloc(sizeof(struct source *) * new_max);
+		new_pollfds = g_try_malloc(sizeof(GPollFD) * new_max);
+		if (!new_sources || !new_pollfds) {
+			sr_err("session: %s: sources malloc failed", __func__);
+			g_free(new_sources);
+			g_free(new_pollfds);
+			return;
+		}
+		if (st->num_sources) {
+			memcpy(new_sources, st->sources,
+			       sizeof(struct source *) * st->num_sources);
+			memcpy(new_pollfds, st->pollfds,
+			       sizeof(GPollFD) * st->num_sources);
+		}
+		g_free(st->sources);
+		g_free(st->pollfds);
+		st->sources = new_sources;
+		st->pollfds = new_pollfds;
+		st->max_sources = new_max;
+	}
+
+	if (!st->source_fds)
+		st->source_fds = g_hash_table_new(g_direct_hash, g_direct_equal);
 
-	s = &new_sources[num_sources++];
+	if (!(s = g_try_malloc0(sizeof(struct source)))) {
+		sr_err("session: %s: source malloc failed", __func__);
+		return;
+	}
 	s->fd = fd;
 	s->events = events;
 	s->timeout = timeout;
 	s->cb = callback;
 	s->user_data = user_data;
-	sources = new_sources;
+	s->index = st->num_sources;
+	/* Not dispatched before the next poll. */
+	s->gen = st->loop_gen;
+	s->next = g_hash_table_lookup(st->source_fds, GINT_TO_POINTER(fd));
+	g_hash_table_insert(st->source_fds, GINT_TO_POINTER(fd), s);
+	s->timer.data = s;
+	if (timeout == 0)
+		st->num_idle++;
+
+#ifdef _WIN32
+	s->channel = g_io_channel_win32_new_fd(fd);
+	g_io_channel_win32_make_pollfd(s->channel,
+			events & ~SR_SOURCE_EDGE, &st->pollfds[st->num_sources]);
+#else
+	st->pollfds[st->num_sources].fd = fd;
+	st->pollfds[st->num_sources].events = events & ~SR_SOURCE_EDGE;
+#endif
+	st->pollfds[st->num_sources].revents = 0;
+	st->sources[st->num_sources++] = s;
 
-	if (timeout != source_timeout && timeout > 0
-	    && (source_timeout == -1 || timeout < source_timeout))
-		source_timeout = timeout;
+#ifdef HAVE_SYS_EPOLL_H
+	epoll_add(st, s);
+#endif
+
+	arm_timer(st, s);
 }
 
 void sr_session_source_remove(int fd)
 {
-	struct source *new_sources;
-	int old, new;
+	struct sr_session_state *st;
+	struct source *s, *next, *last;
 
-	if (!sources)
+	/* Drivers clean up their sources, even after the session is gone. */
+	if (!session)
+		return;
+	st = session->state;
+	if (!st->source_fds || !(s = g_hash_table_lookup(st->source_fds,
+						     GINT_TO_POINTER(fd))))
 		return;
+	g_hash_table_remove(st->source_fds, GINT_TO_POINTER(fd));
 
-	new_sources = calloc(1, sizeof(struct source) * num_sources);
-	for (old = 0, new = 0; old < num_sources; old++)
-		if (sources[old].fd != fd)
-			memcpy(&new_sources[new++], &sources[old],
-			       sizeof(struct source));
+#ifdef HAVE_SYS_EPOLL_H
+	/* This fails harmlessly if the fd was already closed. */
+	if (st->epoll_fd != -1 && fd >= 0)
+		epoll_ctl(st->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
 
-	if (old != new) {
-		free(sources);
-		sources = new_sources;
-		num_sources--;
-	} else {
-		/* Target fd was not found. */
-		free(new_sources);
+	for (; s; s = next) {
+		next = s->next;
+		last = st->sources[--st->num_sources];
+		st->sources[s->index] = last;
+		st->pollfds[s->index] = st->pollfds[st->num_sources];
+		last->index = s->index;
+		s->index = -1;
+		sr_timer_del(&s->timer);
+		if (s->timeout == 0)
+			st->num_idle--;
+		st->dead_sources = g_slist_prepend(st->dead_sources, s);
 	}
-}
 
+	if (!st->dispatching)
+		free_dead_sources(st);
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (st->num_sources == 0) {
+		/* Start afresh with the next source. */
+		if (st->epoll_fd != -1)
+			close(st->epoll_fd);
+		st->epoll_fd = -1;
+		st->epoll_failed = FALSE;
+	}
+#endif
+}
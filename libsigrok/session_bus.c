@@ -0,0 +1,555 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Asynchronous datafeed callbacks.
+ *
+ * Every asynchronous callback gets a bounded queue and a thread of its own,
+ * which runs the callback on copies of the packets. A slow callback then
+ * no longer holds up the driver which sends the packets. When the queue is
+ * full, the callback's policy decides what happens to the next packet:
+ *
+ *  - SR_BUS_BLOCK: the sender waits for room in the queue.
+ *  - SR_BUS_DROP: logic packets are dropped, and counted. Other packets
+ *    are never dropped, the sender waits for those.
+ *  - SR_BUS_SPILL: packets are written to a temporary file, from which the
+ *    thread reads them back once it has emptied the queue. Everything
+ *    after the first spilled packet is spilled too, until the file has
+ *    been read back, so the packets still arrive in order.
+ *
+ * An SR_DF_END packet only returns from sr_session_bus() once every
+ * callback has seen it. Packets whose payload can't be copied are passed
+ * on by the sender itself, after the queue has been emptied. Logic packets
+ * are queued with a reference to their sr_buffer, and only copied when
+ * they come without one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+struct bus_item {
+	struct sr_device *device;
+	struct sr_datafeed_packet packet;
+};
+
+/* Spilled packet, followed by length bytes of payload. */
+struct spill_record {
+	struct sr_device *device;
+	uint64_t timeoffset;
+	uint64_t duration;
+	uint64_t length;
+	uint16_t type;
+	uint16_t unitsize;
+};
+
+struct consumer {
+	/* Session the callback was added to */
+	struct sr_session *session;
+	sr_datafeed_callback cb;
+	int policy;
+	GThread *thread;
+	GMutex *mutex;
+	/* Signalled when there is a packet for the thread, or it must quit */
+	GCond *ready;
+	/* Signalled when a packet was taken off the queue, or handled */
+	GCond *space;
+	struct bus_item **queue;
+	int size;
+	int head;
+	int count;
+	/* The thread is running the callback */
+	gboolean busy;
+	gboolean quit;
+	FILE *spill;
+	uint64_t spill_read;
+	uint64_t spill_write;
+	uint64_t spill_count;
+	uint64_t dropped;
+	uint64_t dropped_bytes;
+	uint64_t spilled;
+	struct sr_callback_timing timing;
+};
+
+/*
+ * Size of the payload of a packet, not counting logic samples, or -1 if
+ * it can't be copied.
+ */
+static int64_t payload_size(const struct sr_datafeed_packet *packet)
+{
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		return sizeof(struct sr_datafeed_header);
+	case SR_DF_LOGIC:
+		return sizeof(struct sr_datafeed_logic);
+	case SR_DF_END:
+	case SR_DF_TRIGGER:
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/* Allocate a packet with room for its payload in the same block. */
+static struct bus_item *item_new(uint16_t type, uint64_t size)
+{
+	struct bus_item *item;
+
+	if (!(item = g_try_malloc(sizeof(struct bus_item) + size))) {
+		sr_err("bus: %s: item malloc failed", __func__);
+		return NULL;
+	}
+	item->packet.type = type;
+	item->packet.payload = size ? item + 1 : NULL;
+
+	return item;
+}
+
+static void item_free(struct bus_item *item)
+{
+	if (!item)
+		return;
+	if (item->packet.type == SR_DF_LOGIC)
+		sr_datafeed_logic_unref(item->packet.payload);
+	g_free(item);
+}
+
+static struct bus_item *item_copy(struct sr_device *device,
+				  const struct sr_datafeed_packet *packet,
+				  uint64_t size)
+{
+	struct bus_item *item;
+
+	if (!(item = item_new(packet->type, size)))
+		return NULL;
+	item->device = device;
+	item->packet.timeoffset = packet->timeoffset;
+	item->packet.duration = packet->duration;
+
+	if (packet->type == SR_DF_LOGIC) {
+		if (sr_datafeed_logic_ref(packet->payload,
+					  item->packet.payload) != SR_OK) {
+			g_free(item);
+			return NULL;
+		}
+	} else if (size) {
+		memcpy(item->packet.payload, packet->payload, size);
+	}
+
+	return item;
+}
+
+/* Append a packet to the spill file. Called with the mutex held. */
+static int spill_write(struct consumer *c, struct sr_device *device,
+		       const struct sr_datafeed_packet *packet)
+{
+	struct spill_record rec;
+	const struct sr_datafeed_logic *logic;
+	const void *data;
+
+	if (!c->spill && !(c->spill = tmpfile())) {
+		sr_err("bus: %s: tmpfile failed", __func__);
+		return SR_ERR;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.device = device;
+	rec.type = packet->type;
+	rec.timeoffset = packet->timeoffset;
+	rec.duration = packet->duration;
+	if (packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		rec.length = logic->length;
+		rec.unitsize = logic->unitsize;
+		data = logic->data;
+	} else {
+		rec.length = payload_size(packet);
+		data = packet->payload;
+	}
+
+	if (fseek(c->spill, c->spill_write, SEEK_SET)
+	    || fwrite(&rec, sizeof(rec), 1, c->spill) != 1
+	    || (rec.length && fwrite(data, rec.length, 1, c->spill) != 1)) {
+		sr_err("bus: %s: write failed", __func__);
+		return SR_ERR;
+	}
+	c->spill_write += sizeof(rec) + rec.length;
+	c->spill_count++;
+	c->spilled++;
+
+	return SR_OK;
+}
+
+/*
+ * Read the oldest packet back from the spill file. Called with the mutex
+ * held. On errors the rest of the file is given up on.
+ */
+static struct bus_item *spill_read(struct consumer *c)
+{
+	struct spill_record rec;
+	struct bus_item *item;
+	struct sr_datafeed_logic *logic;
+	void *data;
+
+	item = NULL;
+	if (fseek(c->spill, c->spill_read, SEEK_SET)
+	    || fread(&rec, sizeof(rec), 1, c->spill) != 1) {
+		sr_err("bus: %s: read failed", __func__);
+		goto fail;
+	}
+
+	if (rec.type == SR_DF_LOGIC) {
+		if (!(item = item_new(rec.type,
+				      sizeof(struct sr_datafeed_logic))))
+			goto fail;
+		logic = item->packet.payload;
+		logic->length = rec.length;
+		logic->unitsize = rec.unitsize;
+		if (!(logic->buffer = sr_buffer_new(rec.length))) {
+			g_free(item);
+			item = NULL;
+			goto fail;
+		}
+		data = logic->data = logic->buffer->data;
+	} else {
+		if (!(item = item_new(rec.type, rec.length)))
+			goto fail;
+		data = item->packet.payload;
+	}
+	item->device = rec.device;
+	item->packet.timeoffset = rec.timeoffset;
+	item->packet.duration = rec.duration;
+	if (rec.length && fread(data, rec.length, 1, c->spill) != 1) {
+		sr_err("bus: %s: read failed", __func__);
+		goto fail;
+	}
+
+	c->spill_read += sizeof(rec) + rec.length;
+	if (--c->spill_count == 0) {
+		/* All read back, start over at the beginning of the file. */
+		c->spill_read = c->spill_write = 0;
+	}
+
+	return item;
+
+fail:
+	item_free(item);
+	c->dropped += c->spill_count;
+	c->spill_count = 0;
+	c->spill_read = c->spill_write = 0;
+
+	return NULL;
+}
+
+static gpointer consumer_thread(gpointer data)
+{
+	struct consumer *c;
+	struct bus_item *item;
+	gboolean timing;
+	uint64_t t;
+
+	c = data;
+	/* The callback may call the sr_session_*() functions. */
+	sr_session_set_current(c->session);
+	g_mutex_lock(c->mutex);
+	while (TRUE) {
+		while (!c->count && !c->spill_count && !c->quit)
+			g_cond_wait(c->ready, c->mutex);
+		/* The queue holds the older packets, then comes the file. */
+		if (c->count) {
+			item = c->queue[c->head];
+			c->head = (c->head + 1) % c->size;
+			c->count--;
+		} else if (c->spill_count) {
+			item = spill_read(c);
+		} else {
+			break;
+		}
+		c->busy = TRUE;
+		g_cond_broadcast(c->space);
+		g_mutex_unlock(c->mutex);
+
+		t = 0;
+		timing = c->session->state->timing;
+		if (item) {
+			t = timing ? sr_timer_now_ns() : sr_trace_begin();
+			c->cb(item->device, &item->packet);
+			sr_trace_end("async callback", t, item->packet.type);
+			if (timing)
+				t = sr_timer_now_ns() - t;
+			item_free(item);
+		}
+
+		g_mutex_lock(c->mutex);
+		if (item && timing)
+			sr_callback_timing_add(&c->timing, t);
+		c->busy = FALSE;
+		g_cond_broadcast(c->space);
+	}
+	g_mutex_unlock(c->mutex);
+
+	return NULL;
+}
+
+/* Wait until the thread has handled every packet sent to it so far. */
+static void consumer_drain(struct consumer *c)
+{
+	g_mutex_lock(c->mutex);
+	while (c->count || c->spill_count || c->busy)
+		g_cond_wait(c->space, c->mutex);
+	g_mutex_unlock(c->mutex);
+}
+
+static void consumer_send(struct consumer *c, struct sr_device *device,
+			  struct sr_datafeed_packet *packet)
+{
+	struct bus_item *item;
+	const struct sr_datafeed_logic *logic;
+	int64_t size;
+
+	if ((size = payload_size(packet)) < 0) {
+		/* Can't be queued, so pass it on in order from here. */
+		consumer_drain(c);
+		c->cb(device, packet);
+		return;
+	}
+
+	g_mutex_lock(c->mutex);
+	if (c->policy == SR_BUS_SPILL
+	    && (c->spill_count || c->count == c->size)
+	    && spill_write(c, device, packet) == SR_OK) {
+		g_cond_signal(c->ready);
+		g_mutex_unlock(c->mutex);
+		return;
+	}
+	if (c->policy == SR_BUS_DROP && c->count == c->size
+	    && packet->type == SR_DF_LOGIC) {
+		logic = packet->payload;
+		c->dropped++;
+		c->dropped_bytes += logic->length;
+		g_mutex_unlock(c->mutex);
+		return;
+	}
+	g_mutex_unlock(c->mutex);
+
+	/* This is the only thread adding packets, room stays room. */
+	if (!(item = item_copy(device, packet, size)))
+		return;
+
+	g_mutex_lock(c->mutex);
+	while (c->count == c->size || c->spill_count)
+		g_cond_wait(c->space, c->mutex);
+	c->queue[(c->head + c->count) % c->size] = item;
+	c->count++;
+	g_cond_signal(c->ready);
+	g_mutex_unlock(c->mutex);
+}
+
+static void consumer_free(struct consumer *c)
+{
+	if (c->thread) {
+		g_mutex_lock(c->mutex);
+		c->quit = TRUE;
+		g_cond_signal(c->ready);
+		g_mutex_unlock(c->mutex);
+		g_thread_join(c->thread);
+	}
+
+	if (c->dropped)
+		sr_info("bus: callback dropped %"PRIu64" packets, "
+			"%"PRIu64" bytes", c->dropped, c->dropped_bytes);
+	if (c->spill)
+		fclose(c->spill);
+	if (c->mutex)
+		g_mutex_free(c->mutex);
+	if (c->ready)
+		g_cond_free(c->ready);
+	if (c->space)
+		g_cond_free(c->space);
+	g_free(c->queue);
+	g_free(c);
+}
+
+static struct consumer *consumer_find(sr_datafeed_callback callback)
+{
+	struct sr_session *session;
+	GSList *l;
+	struct consumer *c;
+
+	if (!(session = sr_session_get_current()))
+		return NULL;
+
+	for (l = session->state->consumers; l; l = l->next) {
+		c = l->data;
+		if (c->cb == callback)
+			return c;
+	}
+
+	return NULL;
+}
+
+/**
+ * Add a datafeed callback which runs in a thread of its own.
+ *
+ * Up to max_packets packets are queued for the callback; policy is one of
+ * SR_BUS_BLOCK, SR_BUS_DROP or SR_BUS_SPILL, and decides what happens to
+ * packets when the queue is full. The callback gets copies of the packets,
+ * which are only valid until it returns.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG or SR_ERR_MALLOC upon errors.
+ */
+int sr_session_datafeed_callback_add_async(sr_datafeed_callback callback,
+					   int max_packets, int policy)
+{
+	struct sr_session *session;
+	struct consumer *c;
+
+	if (!(session = sr_session_get_current())) {
+		sr_err("bus: %s: no current session", __func__);
+		return SR_ERR;
+	}
+
+	if (!callback || max_packets <= 0 || policy < SR_BUS_BLOCK
+	    || policy > SR_BUS_SPILL) {
+		sr_err("bus: %s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!(c = g_try_malloc0(sizeof(struct consumer)))) {
+		sr_err("bus: %s: consumer malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	c->session = session;
+	c->cb = callback;
+	c->policy = policy;
+	c->size = max_packets;
+	if (!(c->queue = g_try_malloc(sizeof(struct bus_item *) * max_packets))) {
+		sr_err("bus: %s: queue malloc failed", __func__);
+		consumer_free(c);
+		return SR_ERR_MALLOC;
+	}
+
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+	c->mutex = g_mutex_new();
+	c->ready = g_cond_new();
+	c->space = g_cond_new();
+	if (!(c->thread = g_thread_create(consumer_thread, c, TRUE, NULL))) {
+		sr_err("bus: %s: g_thread_create failed", __func__);
+		consumer_free(c);
+		return SR_ERR;
+	}
+
+	session->state->consumers = g_slist_append(session->state->consumers,
+						   c);
+
+	return SR_OK;
+}
+
+/**
+ * Get the number of packets an asynchronous callback didn't get, because
+ * they were dropped or couldn't be read back from the spill file, and the
+ * number of packets which went through the spill file.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG if the callback isn't an
+ *         asynchronous one.
+ */
+int sr_session_datafeed_callback_stats(sr_datafeed_callback callback,
+				       uint64_t *dropped, uint64_t *spilled)
+{
+	struct consumer *c;
+
+	if (!(c = consumer_find(callback)))
+		return SR_ERR_ARG;
+
+	g_mutex_lock(c->mutex);
+	if (dropped)
+		*dropped = c->dropped;
+	if (spilled)
+		*spilled = c->spilled;
+	g_mutex_unlock(c->mutex);
+
+	return SR_OK;
+}
+
+/* Hand a packet to every asynchronous callback. */
+void sr_session_bus_async(struct sr_session *session,
+			  struct sr_device *device,
+			  struct sr_datafeed_packet *packet)
+{
+	GSList *l;
+
+	for (l = session->state->consumers; l; l = l->next)
+		consumer_send(l->data, device, packet);
+
+	if (packet->type == SR_DF_END) {
+		for (l = session->state->consumers; l; l = l->next)
+			consumer_drain(l->data);
+	}
+}
+
+/* Let the asynchronous callbacks finish their packets, then remove them. */
+void sr_session_bus_async_clear(struct sr_session *session)
+{
+	struct sr_session_state *st;
+	GSList *l;
+
+	st = session->state;
+	for (l = st->consumers; l; l = l->next)
+		consumer_free(l->data);
+	g_slist_free(st->consumers);
+	st->consumers = NULL;
+}
+
+/* Fill in the statistics of every asynchronous callback, return how many. */
+int sr_session_bus_async_stats(struct sr_session *session,
+			       struct sr_callback_stats *stats)
+{
+	struct consumer *c;
+	GSList *l;
+	int n;
+
+	n = 0;
+	for (l = session->state->consumers; l; l = l->next) {
+		c = l->data;
+		stats[n].callback = c->cb;
+		stats[n].async = TRUE;
+		g_mutex_lock(c->mutex);
+		sr_callback_timing_get(&c->timing, &stats[n++]);
+		g_mutex_unlock(c->mutex);
+	}
+
+	return n;
+}
+
+void sr_session_bus_async_stats_reset(struct sr_session *session)
+{
+	struct consumer *c;
+	GSList *l;
+
+	for (l = session->state->consumers; l; l = l->next) {
+		c = l->data;
+		g_mutex_lock(c->mutex);
+		memset(&c->timing, 0, sizeof(struct sr_callback_timing));
+		g_mutex_unlock(c->mutex);
+	}
+}
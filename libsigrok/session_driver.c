@@ -38,8 +38,6 @@ struct session_vdevice {
 	int num_probes;
 };
 
-static char *sessionfile = NULL;
-static GSList *device_instances = NULL;
 static int capabilities[] = {
 	SR_HWCAP_CAPTUREFILE,
 	SR_HWCAP_CAPTURE_UNITSIZE,
@@ -47,12 +45,33 @@ static int capabilities[] = {
 };
 
 
+/*
+ * The session file and its devices belong to the session it was loaded
+ * into, so every thread can load one of its own. The device threads of
+ * a threaded session use the main session's.
+ */
+static struct sr_session_state *driver_state(void)
+{
+	struct sr_session *session;
+
+	if (!(session = sr_session_get_current()))
+		return NULL;
+	while (session->state->parent)
+		session = session->state->parent;
+
+	return session->state;
+}
+
 static struct session_vdevice *get_vdevice_by_index(int device_index)
 {
+	struct sr_session_state *st;
 	struct sr_device_instance *sdi;
 	struct session_vdevice *vdevice;
 
-	if (!(sdi = sr_get_device_instance(device_instances, device_index)))
+	if (!(st = driver_state()))
+		return NULL;
+
+	if (!(sdi = sr_get_device_instance(st->file_devices, device_index)))
 		return NULL;
 
 	vdevice = sdi->priv;
@@ -62,12 +81,13 @@ static struct session_vdevice *get_vdevice_by_index(int device_index)
 
 static int feed_chunk(int fd, int revents, void *session_data)
 {
+	struct sr_session_state *st;
 	struct sr_device_instance *sdi;
 	struct session_vdevice *vdevice;
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
 	GSList *l;
-	void *buf;
+	struct sr_buffer *buf;
 	int ret, got_data;
 
 	/* Avoid compiler warnings. */
@@ -76,21 +96,24 @@ static int feed_chunk(int fd, int revents, void *session_data)
 
 	sr_dbg("session_driver: feed chunk");
 
+	if (!(st = driver_state()))
+		return FALSE;
+
 	got_data = FALSE;
-	for (l = device_instances; l; l = l->next) {
+	for (l = st->file_devices; l; l = l->next) {
 		sdi = l->data;
 		vdevice = sdi->priv;
 		if (!vdevice)
 			/* already done with this instance */
 			continue;
 
-		if (!(buf = g_try_malloc(CHUNKSIZE))) {
+		if (!(buf = sr_session_buffer_acquire(CHUNKSIZE))) {
 			sr_err("session: %s: buf malloc failed", __func__);
 			// return SR_ERR_MALLOC;
 			return FALSE;
 		}
 
-		ret = zip_fread(vdevice->capfile, buf, CHUNKSIZE);
+		ret = zip_fread(vdevice->capfile, buf->data, CHUNKSIZE);
 		if (ret > 0) {
 			got_data = TRUE;
 			packet.type = SR_DF_LOGIC;
@@ -99,8 +122,8 @@ static int feed_chunk(int fd, int revents, void *session_data)
 			packet.payload = &logic;
 			logic.length = ret;
 			logic.unitsize = vdevice->unitsize;
-			logic.data = buf;
-			sr_session_bus(session_data, &packet);
+			logic.data = buf->data;
+			sr_session_buffer_commit(session_data, &packet, buf);
 		} else {
 			/* done with this capture file */
 			zip_fclose(vdevice->capfile);
@@ -108,6 +131,7 @@ static int feed_chunk(int fd, int revents, void *session_data)
 			g_free(vdevice);
 			sdi->priv = NULL;
 		}
+		sr_buffer_unref(buf);
 	}
 
 	if (!got_data) {
@@ -123,33 +147,53 @@ static void hw_cleanup(void);
 
 static int hw_init(const char *deviceinfo)
 {
+	struct sr_session_state *st;
+
 	hw_cleanup();
 
-	sessionfile = g_strdup(deviceinfo);
+	if (!(st = driver_state()))
+		return SR_ERR;
+
+	st->sessionfile = g_strdup(deviceinfo);
 
 	return 0;
 }
 
-static void hw_cleanup(void)
+/* Free the session file and devices a session loaded. */
+void sr_session_driver_clear(struct sr_session_state *st)
 {
 	GSList *l;
 
-	for (l = device_instances; l; l = l->next)
+	for (l = st->file_devices; l; l = l->next)
 		sr_device_instance_free(l->data);
 
-	g_slist_free(device_instances);
-	device_instances = NULL;
+	g_slist_free(st->file_devices);
+	st->file_devices = NULL;
 
-	sr_session_source_remove(-1);
+	g_free(st->sessionfile);
+	st->sessionfile = NULL;
+}
+
+static void hw_cleanup(void)
+{
+	struct sr_session_state *st;
 
-	g_free(sessionfile);
+	if (!(st = driver_state()))
+		return;
 
+	sr_session_driver_clear(st);
+
+	sr_session_source_remove(-1);
 }
 
 static int hw_opendev(int device_index)
 {
+	struct sr_session_state *st;
 	struct sr_device_instance *sdi;
 
+	if (!(st = driver_state()))
+		return SR_ERR;
+
 	sdi = sr_device_instance_new(device_index, SR_ST_INITIALIZING,
 		NULL, NULL, NULL);
 	if (!sdi)
@@ -160,7 +204,7 @@ static int hw_opendev(int device_index)
 		return SR_ERR_MALLOC;
 	}
 
-	device_instances = g_slist_append(device_instances, sdi);
+	st->file_devices = g_slist_append(st->file_devices, sdi);
 
 	return SR_OK;
 }
@@ -231,15 +275,21 @@ static int hw_set_configuration(int device_index, int capability, void *value)
 
 static int hw_start_acquisition(int device_index, gpointer session_device_id)
 {
+	struct sr_session_state *st;
 	struct zip_stat zs;
 	struct session_vdevice *vdevice;
 	struct sr_datafeed_header *header;
 	struct sr_datafeed_packet *packet;
+	const char *sessionfile;
 	int err;
 
 	/* Avoid compiler warnings. */
 	(void)session_device_id;
 
+	if (!(st = driver_state()))
+		return SR_ERR;
+	sessionfile = st->sessionfile;
+
 	if (!(vdevice = get_vdevice_by_index(device_index)))
 		return SR_ERR;
 
@@ -21,13 +21,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <zip.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <sigrok.h>
 #include <sigrok-internal.h>
 
-extern struct sr_session *session;
 extern struct sr_device_plugin session_driver;
 
 int sr_session_load(const char *filename)
@@ -141,18 +141,86 @@ int sr_session_load(const char *filename)
 	return SR_OK;
 }
 
+/* State of a zip source streaming out a datastore. */
+struct datastore_source {
+	struct sr_datastore *ds;
+	uint64_t pos;
+};
+
+/*
+ * libzip source callback, which feeds the datastore to libzip a chunk at a
+ * time instead of from a single buffer holding the whole capture.
+ */
+static ssize_t datastore_source_cb(void *state, void *data, size_t len,
+				   enum zip_source_cmd cmd)
+{
+	struct datastore_source *src;
+	struct zip_stat *st;
+	const void *chunk;
+	uint64_t num_units;
+	int *errors;
+
+	src = state;
+
+	switch (cmd) {
+	case ZIP_SOURCE_OPEN:
+		/* In ring mode, older units may have been dropped. */
+		src->pos = sr_datastore_get_first_unit(src->ds);
+		return 0;
+	case ZIP_SOURCE_READ:
+		if (src->pos >= src->ds->num_units)
+			return 0;
+		if (sr_datastore_get_chunk(src->ds, src->pos, &chunk,
+					   &num_units) != SR_OK)
+			return -1;
+		num_units = MIN(num_units, len / src->ds->ds_unitsize);
+		memcpy(data, chunk, num_units * src->ds->ds_unitsize);
+		src->pos += num_units;
+		return num_units * src->ds->ds_unitsize;
+	case ZIP_SOURCE_CLOSE:
+		return 0;
+	case ZIP_SOURCE_STAT:
+		if (len < sizeof(struct zip_stat))
+			return -1;
+		st = data;
+		zip_stat_init(st);
+		st->mtime = time(NULL);
+		st->size = (src->ds->num_units
+			    - sr_datastore_get_first_unit(src->ds))
+			   * src->ds->ds_unitsize;
+#ifdef ZIP_STAT_SIZE
+		/* libzip 0.11 and later only look at the fields marked valid. */
+		st->valid |= ZIP_STAT_MTIME | ZIP_STAT_SIZE;
+#endif
+		return sizeof(struct zip_stat);
+	case ZIP_SOURCE_ERROR:
+		if (len < sizeof(int) * 2)
+			return -1;
+		errors = data;
+		errors[0] = ZIP_ER_READ;
+		errors[1] = 0;
+		return sizeof(int) * 2;
+	case ZIP_SOURCE_FREE:
+		g_free(src);
+		return 0;
+	}
+
+	return -1;
+}
+
 int sr_session_save(const char *filename)
 {
-	GSList *l, *p, *d;
+	GSList *l, *p;
 	FILE *meta;
 	struct sr_device *device;
 	struct sr_probe *probe;
 	struct sr_datastore *ds;
+	struct datastore_source *dssrc;
 	struct zip *zipfile;
 	struct zip_source *versrc, *metasrc, *logicsrc;
-	int bufcnt, devcnt, tmpfile, ret, error, probecnt;
+	int devcnt, tmpfile, ret, error, probecnt;
 	uint64_t samplerate;
-	char version[1], rawname[16], metafile[32], *buf, *s;
+	char version[1], rawname[16], metafile[32], *s;
 
 	/* Quietly delete it first, libzip wants replace ops otherwise. */
 	unlink(filename);
@@ -181,7 +249,7 @@ int sr_session_save(const char *filename)
 
 	/* all datastores in all devices */
 	devcnt = 1;
-	for (l = session->devices; l; l = l->next) {
+	for (l = sr_session_get_current()->devices; l; l = l->next) {
 		device = l->data;
 		/* metadata */
 		fprintf(meta, "[device %d]\n", devcnt);
@@ -213,18 +281,23 @@ int sr_session_save(const char *filename)
 				}
 			}
 
-			/* dump datastore into logic-n */
-			buf = malloc(ds->num_units * ds->ds_unitsize +
-				   DATASTORE_CHUNKSIZE);
-			bufcnt = 0;
-			for (d = ds->chunklist; d; d = d->next) {
-				memcpy(buf + bufcnt, d->data,
-				       DATASTORE_CHUNKSIZE);
-				bufcnt += DATASTORE_CHUNKSIZE;
+			/*
+			 * Stream the datastore into logic-n, without loading
+			 * it into memory all at once. libzip only reads from
+			 * the source in zip_close(), so the datastore must
+			 * stay around until then.
+			 */
+			if (!(dssrc = g_try_malloc0(sizeof(struct datastore_source)))) {
+				sr_err("session file: %s: dssrc malloc failed",
+				       __func__);
+				return SR_ERR_MALLOC;
 			}
-			if (!(logicsrc = zip_source_buffer(zipfile, buf,
-				       ds->num_units * ds->ds_unitsize, TRUE)))
+			dssrc->ds = ds;
+			if (!(logicsrc = zip_source_function(zipfile,
+					datastore_source_cb, dssrc))) {
+				g_free(dssrc);
 				return SR_ERR;
+			}
 			snprintf(rawname, 15, "logic-%d", devcnt);
 			if (zip_add(zipfile, rawname, logicsrc) == -1)
 				return SR_ERR;
@@ -0,0 +1,600 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Threaded sessions.
+ *
+ * In a threaded session every device gets a thread of its own, which runs
+ * the device's driver in a session of its own. The packets the driver sends
+ * are queued for the session's own thread, which merges the queues by
+ * timeoffset and sends the packets on its bus as usual.
+ *
+ * A packet is only sent once every device still running has queued one,
+ * since only then is it known that no device will send an earlier one, or
+ * when it has waited for max_latency ms. The packets of one device always
+ * stay in the order it sent them in.
+ *
+ * Many drivers leave the timeoffset of their packets at 0. Their samples
+ * are put in order by the number of samples the device sent before them
+ * and the samplerate in its header instead.
+ */
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#define pipe(fds) _pipe(fds, 4096, _O_BINARY)
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+/* Packets queued per device, before its driver has to wait. */
+#define MERGE_QUEUE_SIZE 256
+
+struct merge_item {
+	struct sr_device *device;
+	struct sr_datafeed_packet packet;
+	/* Where the packet goes in the merged order */
+	uint64_t key;
+	/* When it was queued, in ms */
+	uint64_t queued;
+	union {
+		struct sr_datafeed_header header;
+		struct sr_datafeed_logic logic;
+	} payload;
+};
+
+struct worker {
+	struct sr_merge *merge;
+	struct sr_device *device;
+	GThread *thread;
+	/* Written to, to have the thread stop the device */
+	int wakeup[2];
+	/* What start_acquisition() returned, or 1 until then */
+	int started;
+	GQueue *queue;
+	/* Key of the last packet queued; keys never go back */
+	uint64_t last_key;
+	/* From the device's header, 0 if unknown */
+	uint64_t samplerate;
+	/* Logic samples the device sent so far */
+	uint64_t samples;
+	/* End of the newest samples queued, in ps */
+	uint64_t last_end;
+	/* SR_DF_END was queued, or the thread is done */
+	gboolean ended;
+};
+
+struct sr_merge {
+	struct sr_session *session;
+	int max_latency;
+	GMutex *mutex;
+	/* Signalled when a device was started, or a packet was taken */
+	GCond *cond;
+	GSList *workers;
+	/* Written to when packets were queued */
+	int notify[2];
+	gboolean notified;
+	/* Throw away packets, the threads are being joined */
+	gboolean quit;
+	/* End of the newest samples of any device, in ps */
+	uint64_t newest;
+};
+
+/* The worker of this thread, if it is one. */
+static __thread struct worker *worker;
+
+static struct merge_item *item_copy(struct sr_device *device,
+				    const struct sr_datafeed_packet *packet)
+{
+	struct merge_item *item;
+	const struct sr_datafeed_header *header;
+
+	if (!(item = g_try_malloc(sizeof(struct merge_item)))) {
+		sr_err("merge: %s: item malloc failed", __func__);
+		return NULL;
+	}
+	item->device = device;
+	item->packet = *packet;
+	item->packet.payload = &item->payload;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		header = packet->payload;
+		item->payload.header = *header;
+		break;
+	case SR_DF_LOGIC:
+		if (sr_datafeed_logic_ref(packet->payload,
+					  &item->payload.logic) != SR_OK) {
+			g_free(item);
+			return NULL;
+		}
+		break;
+	case SR_DF_END:
+	case SR_DF_TRIGGER:
+		item->packet.payload = NULL;
+		break;
+	default:
+		sr_dbg("merge: can't queue packet type %d", packet->type);
+		g_free(item);
+		return NULL;
+	}
+
+	return item;
+}
+
+static void item_free(struct merge_item *item)
+{
+	if (item->packet.type == SR_DF_LOGIC)
+		sr_datafeed_logic_unref(&item->payload.logic);
+	g_free(item);
+}
+
+/* Wake up the session's thread. Called with the mutex held. */
+static void merge_notify(struct sr_merge *m)
+{
+	if (m->notified)
+		return;
+	m->notified = TRUE;
+	if (write(m->notify[1], "", 1) != 1)
+		sr_err("merge: %s: write failed", __func__);
+}
+
+/* The time of a number of samples, in ps. */
+static uint64_t samples_to_ps(uint64_t samples, uint64_t samplerate)
+{
+	return (samples / samplerate) * 1000000000000ULL
+		+ (uint64_t)((double)(samples % samplerate) * 1e12 / samplerate);
+}
+
+/* Datafeed callback of the workers' sessions. */
+static void worker_forward(struct sr_device *device,
+			   struct sr_datafeed_packet *packet)
+{
+	struct worker *w;
+	struct sr_merge *m;
+	struct sr_datafeed_header *header;
+	struct sr_datafeed_logic *logic;
+	struct merge_item *item;
+	uint64_t start, end, count;
+
+	w = worker;
+	m = w->merge;
+	if (packet->type == SR_DF_END)
+		/* The device is done, and so is this thread. */
+		sr_session_halt();
+	if (!(item = item_copy(device, packet)))
+		return;
+
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		header = packet->payload;
+		w->samplerate = header->samplerate;
+		item->key = w->last_key;
+		end = 0;
+		break;
+	case SR_DF_END:
+		/* After everything from every device. */
+		item->key = UINT64_MAX;
+		end = 0;
+		break;
+	default:
+		start = packet->timeoffset;
+		if (!start && w->samplerate)
+			start = samples_to_ps(w->samples, w->samplerate);
+		item->key = MAX(start, w->last_key);
+		end = start;
+		if (packet->type == SR_DF_LOGIC) {
+			logic = packet->payload;
+			count = logic->unitsize ? logic->length / logic->unitsize : 0;
+			w->samples += count;
+			if (packet->duration)
+				end += packet->duration;
+			else if (w->samplerate)
+				end += samples_to_ps(count, w->samplerate);
+		}
+	}
+	item->queued = sr_timer_now();
+
+	g_mutex_lock(m->mutex);
+	while (g_queue_get_length(w->queue) >= MERGE_QUEUE_SIZE && !m->quit)
+		g_cond_wait(m->cond, m->mutex);
+	if (m->quit) {
+		g_mutex_unlock(m->mutex);
+		item_free(item);
+		return;
+	}
+	g_queue_push_tail(w->queue, item);
+	w->last_key = item->key;
+	w->last_end = MAX(w->last_end, end);
+	m->newest = MAX(m->newest, w->last_end);
+	if (packet->type == SR_DF_END)
+		w->ended = TRUE;
+	merge_notify(m);
+	g_mutex_unlock(m->mutex);
+}
+
+/* The session's thread wants the device stopped. */
+static int worker_wakeup(int fd, int revents, void *user_data)
+{
+	struct worker *w;
+	char c;
+
+	/* Avoid compiler warnings. */
+	(void)revents;
+
+	w = user_data;
+	if (read(fd, &c, 1) != 1)
+		sr_err("merge: %s: read failed", __func__);
+	if (w->device->plugin && w->device->plugin->stop_acquisition)
+		w->device->plugin->stop_acquisition(w->device->plugin_index,
+						    w->device);
+	sr_session_halt();
+
+	return TRUE;
+}
+
+static gpointer worker_thread(gpointer data)
+{
+	struct worker *w;
+	struct sr_merge *m;
+	struct sr_device *device;
+	uint64_t t;
+	int ret;
+
+	w = worker = data;
+	m = w->merge;
+	device = w->device;
+
+	if (sr_session_new()) {
+		sr_session_get_current()->state->parent = m->session;
+		sr_session_datafeed_callback_add(worker_forward);
+		sr_session_source_add(w->wakeup[0], G_IO_IN, -1, worker_wakeup,
+				      w);
+		t = sr_trace_begin();
+		ret = device->plugin->start_acquisition(device->plugin_index,
+							device);
+		sr_trace_end("start acquisition", t, device->plugin_index);
+	} else {
+		ret = SR_ERR_MALLOC;
+	}
+
+	g_mutex_lock(m->mutex);
+	w->started = ret;
+	g_cond_broadcast(m->cond);
+	g_mutex_unlock(m->mutex);
+
+	if (ret == SR_OK)
+		sr_session_run();
+	sr_session_source_remove(w->wakeup[0]);
+	sr_session_destroy();
+
+	g_mutex_lock(m->mutex);
+	w->ended = TRUE;
+	merge_notify(m);
+	g_mutex_unlock(m->mutex);
+
+	return NULL;
+}
+
+static void worker_free(struct worker *w)
+{
+	struct merge_item *item;
+
+	if (w->queue) {
+		while ((item = g_queue_pop_head(w->queue)))
+			item_free(item);
+		g_queue_free(w->queue);
+	}
+	if (w->wakeup[0] != -1)
+		close(w->wakeup[0]);
+	if (w->wakeup[1] != -1)
+		close(w->wakeup[1]);
+	g_free(w);
+}
+
+static int worker_start(struct sr_merge *m, struct sr_device *device)
+{
+	struct worker *w;
+	int ret;
+
+	if (!(w = g_try_malloc0(sizeof(struct worker)))) {
+		sr_err("merge: %s: worker malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	w->merge = m;
+	w->device = device;
+	w->started = 1;
+	w->wakeup[0] = w->wakeup[1] = -1;
+	if (!(w->queue = g_queue_new()) || pipe(w->wakeup)) {
+		sr_err("merge: %s: pipe() failed", __func__);
+		w->wakeup[0] = w->wakeup[1] = -1;
+		worker_free(w);
+		return SR_ERR;
+	}
+	if (!(w->thread = g_thread_create(worker_thread, w, TRUE, NULL))) {
+		sr_err("merge: %s: g_thread_create failed", __func__);
+		worker_free(w);
+		return SR_ERR;
+	}
+	m->workers = g_slist_append(m->workers, w);
+
+	g_mutex_lock(m->mutex);
+	while (w->started == 1)
+		g_cond_wait(m->cond, m->mutex);
+	ret = w->started;
+	g_mutex_unlock(m->mutex);
+
+	return ret;
+}
+
+/* Stop and join the threads, and throw away what they queued. */
+static void workers_free(struct sr_merge *m)
+{
+	struct worker *w;
+	GSList *l;
+
+	g_mutex_lock(m->mutex);
+	m->quit = TRUE;
+	g_cond_broadcast(m->cond);
+	g_mutex_unlock(m->mutex);
+
+	for (l = m->workers; l; l = l->next) {
+		w = l->data;
+		if (write(w->wakeup[1], "", 1) != 1)
+			sr_err("merge: %s: write failed", __func__);
+		g_thread_join(w->thread);
+		worker_free(w);
+	}
+	g_slist_free(m->workers);
+	m->workers = NULL;
+	m->quit = FALSE;
+}
+
+/*
+ * Take the packet which comes next in the merged order off its queue, if
+ * it may be sent yet. Called with the mutex held.
+ */
+static struct merge_item *merge_next(struct sr_merge *m)
+{
+	struct worker *w, *next;
+	struct merge_item *item, *head;
+	gboolean complete, expired;
+	uint64_t now;
+	GSList *l;
+
+	now = sr_timer_now();
+	next = NULL;
+	item = NULL;
+	complete = TRUE;
+	expired = FALSE;
+	for (l = m->workers; l; l = l->next) {
+		w = l->data;
+		if (!(head = g_queue_peek_head(w->queue))) {
+			if (!w->ended)
+				complete = FALSE;
+			continue;
+		}
+		if (m->max_latency
+		    && now - head->queued >= (uint64_t)m->max_latency)
+			expired = TRUE;
+		if (!item || head->key < item->key) {
+			item = head;
+			next = w;
+		}
+	}
+	if (!item || (!complete && !expired))
+		return NULL;
+
+	return g_queue_pop_head(next->queue);
+}
+
+/* Note how far each device is behind the one furthest ahead. */
+static void merge_lag(struct sr_merge *m, struct sr_session_state *st)
+{
+	struct worker *w;
+	GSList *l;
+
+	for (l = m->workers; l; l = l->next) {
+		w = l->data;
+		if (!w->ended)
+			sr_session_stats_lag(st, w->device,
+					     m->newest - w->last_end);
+	}
+}
+
+/* Every device is done, and every packet has been sent. */
+static gboolean merge_done(struct sr_merge *m)
+{
+	struct worker *w;
+	GSList *l;
+
+	for (l = m->workers; l; l = l->next) {
+		w = l->data;
+		if (!w->ended || !g_queue_is_empty(w->queue))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Send the queued packets on, in the session's thread. */
+static int merge_receive(int fd, int revents, void *user_data)
+{
+	struct sr_session *session;
+	struct sr_merge *m;
+	struct merge_item *item;
+	gboolean done;
+	char c;
+
+	m = user_data;
+	session = sr_session_get_current();
+	if (revents && read(fd, &c, 1) != 1)
+		sr_err("merge: %s: read failed", __func__);
+
+	g_mutex_lock(m->mutex);
+	if (revents)
+		m->notified = FALSE;
+	while (session->running && (item = merge_next(m))) {
+		merge_lag(m, session->state);
+		g_cond_broadcast(m->cond);
+		g_mutex_unlock(m->mutex);
+
+		sr_session_bus(item->device, &item->packet);
+		item_free(item);
+
+		g_mutex_lock(m->mutex);
+	}
+	done = merge_done(m);
+	g_mutex_unlock(m->mutex);
+
+	if (done)
+		sr_session_halt();
+
+	return TRUE;
+}
+
+/* Start every device in a thread of its own. */
+int sr_session_merge_start(struct sr_session *session)
+{
+	struct sr_merge *m;
+	GSList *l;
+	int ret;
+
+	m = session->state->merge;
+	workers_free(m);
+	m->session = session;
+	m->newest = 0;
+
+	sr_session_source_remove(m->notify[0]);
+	sr_session_source_add(m->notify[0], G_IO_IN,
+			      m->max_latency ? m->max_latency : -1,
+			      merge_receive, m);
+
+	ret = SR_OK;
+	for (l = session->devices; l; l = l->next) {
+		if ((ret = worker_start(m, l->data)) != SR_OK)
+			break;
+	}
+
+	return ret;
+}
+
+/*
+ * Have every thread stop its device. The session runs on until they have
+ * all sent what they have.
+ */
+void sr_session_merge_stop(struct sr_session *session)
+{
+	struct worker *w;
+	GSList *l;
+
+	for (l = session->state->merge->workers; l; l = l->next) {
+		w = l->data;
+		if (write(w->wakeup[1], "", 1) != 1)
+			sr_err("merge: %s: write failed", __func__);
+	}
+}
+
+void sr_session_merge_free(struct sr_session *session)
+{
+	struct sr_merge *m;
+
+	if (!(m = session->state->merge))
+		return;
+
+	workers_free(m);
+	sr_session_source_remove(m->notify[0]);
+	close(m->notify[0]);
+	close(m->notify[1]);
+	g_mutex_free(m->mutex);
+	g_cond_free(m->cond);
+	g_free(m);
+	session->state->merge = NULL;
+}
+
+/**
+ * Run every device of the current session in a thread of its own, and
+ * merge their packets by timeoffset before they are sent on the bus.
+ *
+ * A packet is held back until every other device still running has sent
+ * a packet too, or for about max_latency ms (0 for no limit), so a device
+ * which doesn't send anything for a while doesn't hold up the others for
+ * longer than that. The session stops running once every device has sent
+ * its SR_DF_END.
+ *
+ * Packets are merged by their timeoffset. Where a driver leaves it at 0,
+ * the time of its samples is worked out from the samplerate in its
+ * SR_DF_HEADER and the number of samples it sent so far. If a driver
+ * sends neither, its packets can't be put in order with the others.
+ *
+ * Call this before sr_session_start().
+ *
+ * @param threaded TRUE for a threaded session, FALSE for the usual one.
+ * @param max_latency Time in ms a packet may be held back, or 0.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments, SR_ERR
+ *         or SR_ERR_MALLOC upon other errors.
+ */
+int sr_session_set_threaded(gboolean threaded, int max_latency)
+{
+	struct sr_session *session;
+	struct sr_merge *m;
+
+	if (!(session = sr_session_get_current())) {
+		sr_err("merge: %s: no current session", __func__);
+		return SR_ERR;
+	}
+
+	if (max_latency < 0) {
+		sr_err("merge: %s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	if (!threaded) {
+		sr_session_merge_free(session);
+		return SR_OK;
+	}
+
+	if ((m = session->state->merge)) {
+		m->max_latency = max_latency;
+		return SR_OK;
+	}
+
+	if (!(m = g_try_malloc0(sizeof(struct sr_merge)))) {
+		sr_err("merge: %s: merge malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	if (pipe(m->notify)) {
+		sr_err("merge: %s: pipe() failed", __func__);
+		g_free(m);
+		return SR_ERR;
+	}
+	if (!g_thread_supported())
+		g_thread_init(NULL);
+	m->mutex = g_mutex_new();
+	m->cond = g_cond_new();
+	m->max_latency = max_latency;
+	session->state->merge = m;
+
+	return SR_OK;
+}
@@ -0,0 +1,274 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Session statistics: what every device sent, and how long every datafeed
+ * callback took for it.
+ *
+ * Callback times go into a histogram with 4 buckets per power of two, so
+ * the 99th percentile is known to within 25% without keeping every time.
+ * Reading the clock around every callback isn't free, so callbacks are
+ * only timed after sr_session_set_timing().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+static int time_bucket(uint64_t ns)
+{
+	int log;
+
+	if (ns < 4)
+		return ns;
+	log = 63 - __builtin_clzll(ns);
+
+	return log * 4 + ((ns >> (log - 2)) & 3) - 4;
+}
+
+/* Largest time which falls into a bucket. */
+static uint64_t bucket_max(int bucket)
+{
+	int log, sub;
+
+	if (bucket < 4)
+		return bucket;
+	log = (bucket + 4) / 4;
+	sub = (bucket + 4) % 4;
+
+	return ((uint64_t)(4 + sub + 1) << (log - 2)) - 1;
+}
+
+void sr_callback_timing_add(struct sr_callback_timing *timing, uint64_t ns)
+{
+	if (!timing->num_calls || ns < timing->time_min)
+		timing->time_min = ns;
+	if (ns > timing->time_max)
+		timing->time_max = ns;
+	timing->num_calls++;
+	timing->time_total += ns;
+	timing->buckets[time_bucket(ns)]++;
+}
+
+void sr_callback_timing_get(const struct sr_callback_timing *timing,
+			    struct sr_callback_stats *stats)
+{
+	uint64_t n, rank;
+	int i;
+
+	stats->num_calls = timing->num_calls;
+	stats->time_total = timing->time_total;
+	stats->time_min = timing->time_min;
+	stats->time_max = timing->time_max;
+	stats->time_avg = stats->time_p99 = 0;
+	if (!timing->num_calls)
+		return;
+
+	stats->time_avg = timing->time_total / timing->num_calls;
+	rank = (timing->num_calls * 99 + 99) / 100;
+	for (i = 0, n = 0; i < SR_CALLBACK_TIME_BUCKETS; i++) {
+		if ((n += timing->buckets[i]) >= rank)
+			break;
+	}
+	stats->time_p99 = MIN(bucket_max(i), timing->time_max);
+}
+
+static struct sr_device_stats *device_stats(struct sr_session_state *st,
+					    struct sr_device *device)
+{
+	struct sr_device_stats *ds;
+	GSList *l;
+
+	for (l = st->device_stats; l; l = l->next) {
+		ds = l->data;
+		if (ds->device == device)
+			return ds;
+	}
+
+	if (!(ds = g_try_malloc0(sizeof(struct sr_device_stats))))
+		return NULL;
+	ds->device = device;
+	st->device_stats = g_slist_append(st->device_stats, ds);
+
+	return ds;
+}
+
+/* Count a packet sent to the datafeed callbacks. */
+void sr_session_stats_packet(struct sr_session_state *st,
+			     struct sr_device *device,
+			     const struct sr_datafeed_packet *packet)
+{
+	struct sr_device_stats *ds;
+	struct sr_datafeed_logic *logic;
+
+	if (!(ds = device_stats(st, device)))
+		return;
+
+	ds->num_packets++;
+	switch (packet->type) {
+	case SR_DF_TRIGGER:
+		ds->num_triggers++;
+		break;
+	case SR_DF_LOGIC:
+		logic = packet->payload;
+		ds->num_bytes += logic->length;
+		if (logic->unitsize)
+			ds->num_samples += logic->length / logic->unitsize;
+		break;
+	}
+}
+
+/* Note how far a device lags behind the others, in a threaded session. */
+void sr_session_stats_lag(struct sr_session_state *st,
+			  struct sr_device *device, uint64_t lag)
+{
+	struct sr_device_stats *ds;
+
+	if (!(ds = device_stats(st, device)))
+		return;
+
+	ds->lag = lag;
+	if (lag > ds->max_lag)
+		ds->max_lag = lag;
+}
+
+static void free_list(GSList **list)
+{
+	GSList *l;
+
+	for (l = *list; l; l = l->next)
+		g_free(l->data);
+	g_slist_free(*list);
+	*list = NULL;
+}
+
+/* Start counting afresh, when the session is started. */
+void sr_session_stats_reset(struct sr_session *session)
+{
+	struct sr_session_state *st;
+	GSList *l;
+
+	st = session->state;
+	free_list(&st->device_stats);
+
+	for (l = st->callback_timings; l; l = l->next) {
+		if (l->data)
+			memset(l->data, 0, sizeof(struct sr_callback_timing));
+	}
+
+	sr_session_subscriptions_stats_reset(session);
+	sr_session_bus_async_stats_reset(session);
+
+	st->num_wakeups = st->num_timeouts = 0;
+	st->stats_start = sr_timer_now_ns();
+}
+
+void sr_session_stats_clear(struct sr_session_state *st)
+{
+	free_list(&st->device_stats);
+	free_list(&st->callback_timings);
+}
+
+/**
+ * Turn timing of the datafeed callbacks of the current session on or off.
+ * While it is off, the callback times in sr_session_get_stats() stay 0.
+ *
+ * @return SR_OK upon success, SR_ERR if there is no current session.
+ */
+int sr_session_set_timing(gboolean enable)
+{
+	struct sr_session *session;
+
+	if (!(session = sr_session_get_current()))
+		return SR_ERR;
+
+	session->state->timing = enable;
+
+	return SR_OK;
+}
+
+/**
+ * Get statistics of the current session since it was started: what every
+ * device sent, and the time every datafeed callback, subscription and
+ * asynchronous callback took.
+ *
+ * Free the statistics with sr_session_stats_free().
+ *
+ * @return SR_OK upon success, SR_ERR_ARG or SR_ERR_MALLOC upon errors.
+ */
+int sr_session_get_stats(struct sr_session_stats *stats)
+{
+	struct sr_session *session;
+	struct sr_session_state *st;
+	struct sr_callback_stats *cs;
+	GSList *l, *t;
+	int n;
+
+	if (!stats || !(session = sr_session_get_current()))
+		return SR_ERR_ARG;
+	st = session->state;
+
+	memset(stats, 0, sizeof(struct sr_session_stats));
+	stats->elapsed = sr_timer_now_ns() - st->stats_start;
+	stats->num_wakeups = st->num_wakeups;
+	stats->num_timeouts = st->num_timeouts;
+
+	n = g_slist_length(st->device_stats);
+	if (n && !(stats->devices = g_try_malloc(n
+					* sizeof(struct sr_device_stats)))) {
+		sr_err("stats: %s: devices malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	for (l = st->device_stats; l; l = l->next)
+		stats->devices[stats->num_devices++] =
+			*(struct sr_device_stats *)l->data;
+
+	n = g_slist_length(session->datafeed_callbacks)
+	    + g_slist_length(st->subscriptions) + g_slist_length(st->consumers);
+	if (n && !(stats->callbacks = g_try_malloc0(n
+					* sizeof(struct sr_callback_stats)))) {
+		sr_err("stats: %s: callbacks malloc failed", __func__);
+		sr_session_stats_free(stats);
+		return SR_ERR_MALLOC;
+	}
+	for (l = session->datafeed_callbacks, t = st->callback_timings; l;
+	     l = l->next, t = t->next) {
+		cs = &stats->callbacks[stats->num_callbacks++];
+		cs->callback = l->data;
+		if (t->data)
+			sr_callback_timing_get(t->data, cs);
+	}
+	stats->num_callbacks += sr_session_subscriptions_stats(session,
+			stats->callbacks + stats->num_callbacks);
+	stats->num_callbacks += sr_session_bus_async_stats(session,
+			stats->callbacks + stats->num_callbacks);
+
+	return SR_OK;
+}
+
+void sr_session_stats_free(struct sr_session_stats *stats)
+{
+	g_free(stats->devices);
+	g_free(stats->callbacks);
+	stats->devices = NULL;
+	stats->callbacks = NULL;
+	stats->num_devices = stats->num_callbacks = 0;
+}
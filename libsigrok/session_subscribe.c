@@ -0,0 +1,399 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Datafeed subscriptions.
+ *
+ * A subscription is a datafeed callback which only gets the packet types
+ * it asked for and, if it gave a probe mask, logic packets with only
+ * those probes in them. Subscriptions with the same probe mask share a
+ * projection: the probes are picked out of each logic packet once, for
+ * all of them, and only if one of them wants logic packets at all.
+ * Packets no subscription wants are not looked at.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+#include <sample.h>
+
+struct projection {
+	uint64_t probe_mask;
+	int num_subscribers;
+	/* Packet types any of the subscribers wants */
+	int packet_types;
+	/* Plan for the unit size of the last logic packet */
+	struct sr_filter_plan *plan;
+	int in_unitsize;
+	int out_unitsize;
+	/* This packet, with only the probes in the mask */
+	gboolean ready;
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_header header;
+	struct sr_datafeed_logic logic;
+	/* Buffer of our own the probes were picked out into, if any */
+	struct sr_buffer *buf;
+};
+
+struct subscription {
+	sr_datafeed_callback cb;
+	int packet_types;
+	/* NULL if the subscriber wants all probes */
+	struct projection *proj;
+	struct sr_callback_timing timing;
+};
+
+static struct projection *projection_get(struct sr_session_state *st,
+					 uint64_t probe_mask)
+{
+	struct projection *proj;
+	GSList *l;
+
+	for (l = st->projections; l; l = l->next) {
+		proj = l->data;
+		if (proj->probe_mask == probe_mask) {
+			proj->num_subscribers++;
+			return proj;
+		}
+	}
+
+	if (!(proj = g_try_malloc0(sizeof(struct projection)))) {
+		sr_err("subscribe: %s: proj malloc failed", __func__);
+		return NULL;
+	}
+	proj->probe_mask = probe_mask;
+	proj->num_subscribers = 1;
+	st->projections = g_slist_append(st->projections, proj);
+
+	return proj;
+}
+
+static void projection_put(struct sr_session_state *st,
+			   struct projection *proj)
+{
+	if (--proj->num_subscribers)
+		return;
+
+	st->projections = g_slist_remove(st->projections, proj);
+	sr_filter_plan_destroy(proj->plan);
+	g_free(proj);
+}
+
+/* Work out which packet types are wanted, after a subscription changed. */
+static void update_types(struct sr_session_state *st)
+{
+	struct subscription *sub;
+	GSList *l;
+
+	for (l = st->projections; l; l = l->next)
+		((struct projection *)l->data)->packet_types = 0;
+
+	st->subscribed_types = 0;
+	for (l = st->subscriptions; l; l = l->next) {
+		sub = l->data;
+		st->subscribed_types |= sub->packet_types;
+		if (sub->proj)
+			sub->proj->packet_types |= sub->packet_types;
+	}
+}
+
+static struct subscription *subscription_find(struct sr_session_state *st,
+					      sr_datafeed_callback callback)
+{
+	struct subscription *sub;
+	GSList *l;
+
+	for (l = st->subscriptions; l; l = l->next) {
+		sub = l->data;
+		if (sub->cb == callback)
+			return sub;
+	}
+
+	return NULL;
+}
+
+static void subscription_free(struct sr_session_state *st,
+			      struct subscription *sub)
+{
+	if (sub->proj)
+		projection_put(st, sub->proj);
+	g_free(sub);
+}
+
+/**
+ * Add a datafeed callback which only gets the packets it needs.
+ *
+ * The callback gets packets of the types in packet_types, a combination
+ * of SR_DF_MASK(SR_DF_*) or SR_DF_ALL. With a probe_mask, where bit n
+ * stands for probe n + 1, logic packets only hold the probes in the mask,
+ * in order and packed into the smallest unit size they fit in, and the
+ * SR_DF_HEADER packet counts only those probes. A probe_mask of 0 gets
+ * all probes, untouched.
+ *
+ * Subscribing a callback again replaces its subscription.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG or SR_ERR_MALLOC upon errors.
+ */
+int sr_session_subscribe(sr_datafeed_callback callback, int packet_types,
+			 uint64_t probe_mask)
+{
+	struct sr_session *session;
+	struct sr_session_state *st;
+	struct subscription *sub;
+
+	if (!(session = sr_session_get_current())) {
+		sr_err("subscribe: %s: no current session", __func__);
+		return SR_ERR;
+	}
+	st = session->state;
+
+	if (!callback || !packet_types) {
+		sr_err("subscribe: %s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	sr_session_unsubscribe(callback);
+
+	if (!(sub = g_try_malloc0(sizeof(struct subscription)))) {
+		sr_err("subscribe: %s: sub malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	sub->cb = callback;
+	sub->packet_types = packet_types;
+	if (probe_mask && !(sub->proj = projection_get(st, probe_mask))) {
+		g_free(sub);
+		return SR_ERR_MALLOC;
+	}
+
+	st->subscriptions = g_slist_append(st->subscriptions, sub);
+	update_types(st);
+
+	return SR_OK;
+}
+
+/**
+ * Remove a callback added with sr_session_subscribe().
+ *
+ * @return SR_OK upon success, SR_ERR_ARG if the callback isn't subscribed.
+ */
+int sr_session_unsubscribe(sr_datafeed_callback callback)
+{
+	struct sr_session *session;
+	struct subscription *sub;
+
+	if (!(session = sr_session_get_current()))
+		return SR_ERR_ARG;
+
+	if (!(sub = subscription_find(session->state, callback)))
+		return SR_ERR_ARG;
+
+	session->state->subscriptions =
+		g_slist_remove(session->state->subscriptions, sub);
+	subscription_free(session->state, sub);
+	update_types(session->state);
+
+	return SR_OK;
+}
+
+static int plan_logic(struct projection *proj, int unitsize)
+{
+	int probelist[65], num_probes, ret;
+	uint64_t mask;
+
+	sr_filter_plan_destroy(proj->plan);
+	proj->plan = NULL;
+	proj->in_unitsize = unitsize;
+
+	num_probes = 0;
+	mask = proj->probe_mask & sr_sample_mask(unitsize * 8);
+	while (mask)
+		probelist[num_probes++] = sr_sample_next_change(&mask) + 1;
+	probelist[num_probes] = 0;
+	proj->out_unitsize = (num_probes + 7) / 8;
+	if (!num_probes)
+		return SR_OK;
+
+	if ((ret = sr_filter_plan_new(unitsize, proj->out_unitsize,
+				      probelist, &proj->plan)) != SR_OK)
+		sr_err("subscribe: %s: no filter plan: %d", __func__, ret);
+
+	return ret;
+}
+
+/* Pick the probes in the mask out of a logic packet. */
+static void project_logic(struct projection *proj,
+			  const struct sr_datafeed_logic *logic)
+{
+	struct sr_buffer *buf;
+	const unsigned char *data;
+	uint64_t length, num_units;
+
+	if (logic->unitsize < 1 || logic->unitsize > 8)
+		return;
+
+	if (!(~proj->probe_mask & sr_sample_mask(logic->unitsize * 8))) {
+		/* Every probe is wanted, the packet can be passed on. */
+		proj->logic = *logic;
+		proj->ready = TRUE;
+		return;
+	}
+
+	if (logic->unitsize != proj->in_unitsize
+	    && plan_logic(proj, logic->unitsize) != SR_OK)
+		return;
+	if (!proj->plan)
+		/* None of the probes are in this packet. */
+		return;
+
+	num_units = logic->length / logic->unitsize;
+	if (!(buf = sr_buffer_new(num_units * proj->out_unitsize)))
+		return;
+	if (num_units && sr_filter_plan_apply(proj->plan, logic->unitsize,
+			logic->data, logic->length, buf->data, buf->size,
+			&data, &length) != SR_OK) {
+		sr_buffer_unref(buf);
+		return;
+	}
+
+	proj->logic.length = num_units * proj->out_unitsize;
+	proj->logic.unitsize = proj->out_unitsize;
+	proj->logic.data = buf->data;
+	proj->logic.buffer = buf;
+	proj->buf = buf;
+	proj->ready = TRUE;
+}
+
+static void project(struct projection *proj,
+		    const struct sr_datafeed_packet *packet)
+{
+	const struct sr_datafeed_header *header;
+	uint64_t mask;
+
+	proj->packet = *packet;
+	switch (packet->type) {
+	case SR_DF_HEADER:
+		header = packet->payload;
+		proj->header = *header;
+		mask = proj->probe_mask & sr_sample_mask(header->num_logic_probes);
+		proj->header.num_logic_probes = __builtin_popcountll(mask);
+		proj->packet.payload = &proj->header;
+		proj->ready = TRUE;
+		break;
+	case SR_DF_LOGIC:
+		project_logic(proj, packet->payload);
+		proj->packet.payload = &proj->logic;
+		break;
+	default:
+		proj->ready = TRUE;
+	}
+}
+
+/* Hand a packet to every subscription which wants it. */
+void sr_session_bus_subscribers(struct sr_session *session,
+				struct sr_device *device,
+				struct sr_datafeed_packet *packet)
+{
+	struct sr_session_state *st;
+	struct subscription *sub;
+	struct projection *proj;
+	GSList *l;
+	uint64_t t;
+	int type;
+
+	st = session->state;
+	type = SR_DF_MASK(packet->type);
+	if (!(st->subscribed_types & type))
+		return;
+
+	/* Every projection is worked out once, for all its subscribers. */
+	for (l = st->projections; l; l = l->next) {
+		proj = l->data;
+		proj->ready = FALSE;
+		if (proj->packet_types & type) {
+			t = sr_trace_begin();
+			project(proj, packet);
+			sr_trace_end("projection", t, packet->type);
+		}
+	}
+
+	for (l = st->subscriptions; l; l = l->next) {
+		sub = l->data;
+		if (!(sub->packet_types & type))
+			continue;
+		if (sub->proj && !sub->proj->ready)
+			continue;
+		t = st->timing ? sr_timer_now_ns() : sr_trace_begin();
+		sub->cb(device, sub->proj ? &sub->proj->packet : packet);
+		if (st->timing)
+			sr_callback_timing_add(&sub->timing,
+					       sr_timer_now_ns() - t);
+		sr_trace_end("subscriber", t, packet->type);
+	}
+
+	for (l = st->projections; l; l = l->next) {
+		proj = l->data;
+		sr_buffer_unref(proj->buf);
+		proj->buf = NULL;
+	}
+}
+
+void sr_session_subscriptions_clear(struct sr_session *session)
+{
+	struct sr_session_state *st;
+	GSList *l;
+
+	st = session->state;
+	for (l = st->subscriptions; l; l = l->next)
+		subscription_free(st, l->data);
+	g_slist_free(st->subscriptions);
+	st->subscriptions = NULL;
+	update_types(st);
+}
+
+/* Fill in the statistics of every subscription, return how many. */
+int sr_session_subscriptions_stats(struct sr_session *session,
+				   struct sr_callback_stats *stats)
+{
+	struct subscription *sub;
+	GSList *l;
+	int n;
+
+	n = 0;
+	for (l = session->state->subscriptions; l; l = l->next) {
+		sub = l->data;
+		stats[n].callback = sub->cb;
+		stats[n].async = FALSE;
+		sr_callback_timing_get(&sub->timing, &stats[n++]);
+	}
+
+	return n;
+}
+
+void sr_session_subscriptions_stats_reset(struct sr_session *session)
+{
+	struct subscription *sub;
+	GSList *l;
+
+	for (l = session->state->subscriptions; l; l = l->next) {
+		sub = l->data;
+		memset(&sub->timing, 0, sizeof(struct sr_callback_timing));
+	}
+}
@@ -36,6 +36,250 @@
 /* Size of a datastore chunk in units */
 #define DATASTORE_CHUNKSIZE 512000
 
+struct sr_summary_level {
+	/* Completed blocks */
+	struct sr_summary *blocks;
+	uint64_t num_blocks;
+	uint64_t max_blocks;
+	/* Block being built, and how many units (level 0) or blocks of the
+	 * level below are in it so far */
+	struct sr_summary current;
+	uint64_t count;
+};
+
+struct sr_edge_level {
+	/* Number of edges per probe, for every completed block */
+	uint64_t *counts;
+	uint64_t num_blocks;
+	uint64_t max_blocks;
+};
+
+/* Shared ownership of a chunk, see sr_datastore_snapshot() */
+struct sr_chunk_ref;
+
+/* Everything a datastore keeps besides its units, private to libsigrok. */
+struct sr_datastore_state {
+	/* One of SR_DS_* */
+	int mode;
+	/* Chunk table, each chunk holds DATASTORE_CHUNKSIZE units */
+	gpointer *chunks;
+	unsigned int num_chunks;
+	unsigned int max_chunks;
+	/* SR_DS_FILE only: backing file, and which chunks are mapped in */
+	int fd;
+	uint64_t chunk_stride;
+	unsigned int max_mapped;
+	GQueue *mapped;
+	/* Each mapped chunk's link in the queue above, NULL if unmapped */
+	GList **mapped_links;
+	/* SR_DS_COMPRESSED and SR_DS_BITPLANE only: the last chunk
+	 * converted back to interleaved units */
+	gpointer cache;
+	int cache_index;
+	GTimer *timer;
+	struct sr_datastore_stats stats;
+	/* Summary pyramid, if enabled with sr_datastore_enable_summary() */
+	struct sr_summary_level *summary;
+	int num_summary_levels;
+	/* Edge index, if enabled with sr_datastore_enable_edge_index() */
+	struct sr_edge_level *edges;
+	int num_edge_levels;
+	uint64_t *edge_current;
+	uint64_t edge_count;
+	uint64_t edge_last;
+	/* Ring mode only: number of chunks to keep, see
+	 * sr_datastore_set_ring() */
+	unsigned int ring_chunks;
+	/* Oldest unit still held, units before it have been dropped */
+	uint64_t first_unit;
+	/* Chunks shared with snapshots, NULL for chunks which aren't */
+	struct sr_chunk_ref **chunk_refs;
+	/* Snapshots can't be written to */
+	gboolean readonly;
+};
+
+/*--- bitplane.c ------------------------------------------------------------*/
+
+void sr_bitplane_transpose(const uint8_t *in, int unitsize, uint64_t num_units,
+			   uint8_t *planes, uint64_t plane_size,
+			   uint64_t offset);
+void sr_bitplane_interleave(const uint8_t *planes, uint64_t plane_size,
+			    int unitsize, uint64_t num_units, uint8_t *out);
+void sr_bitplane_copy(uint8_t *dst, uint64_t dst_bit, const uint8_t *src,
+		      uint64_t src_bit, uint64_t n);
+void sr_bitplane_extract(const uint8_t *in, int unitsize, int probe,
+			 uint64_t num_units, uint8_t *bitmap, uint64_t dst_bit);
+
+/*--- mempool.c -------------------------------------------------------------*/
+
+void sr_mempool_cleanup(void);
+
+/*--- summary.c -------------------------------------------------------------*/
+
+int sr_summary_update(struct sr_datastore *ds, const uint8_t *data,
+		      uint64_t num_units);
+void sr_summary_free(struct sr_datastore *ds);
+
+/*--- edges.c ---------------------------------------------------------------*/
+
+int sr_edges_update(struct sr_datastore *ds, const uint8_t *data,
+		    uint64_t num_units);
+void sr_edges_free(struct sr_datastore *ds);
+
+/*--- timer.c ---------------------------------------------------------------*/
+
+#define SR_TIMER_LEVELS		4
+#define SR_TIMER_SLOT_BITS	6
+#define SR_TIMER_SLOTS		(1 << SR_TIMER_SLOT_BITS)
+
+struct sr_timer_wheel;
+
+struct sr_timer {
+	/* Absolute expiry time, in ms */
+	uint64_t expires;
+	void *data;
+	/* Where the timer is while pending */
+	struct sr_timer_wheel *wheel;
+	int level;
+	int slot;
+	struct sr_timer *next;
+	struct sr_timer **pprev;
+};
+
+struct sr_timer_wheel {
+	/* Next ms for which timers haven't been run yet */
+	uint64_t now;
+	struct sr_timer *slots[SR_TIMER_LEVELS][SR_TIMER_SLOTS];
+	/* Bitmap of the non-empty slots, per level */
+	uint64_t used[SR_TIMER_LEVELS];
+	/* Timers which expired, but haven't been returned yet */
+	struct sr_timer *expired;
+	unsigned int num_timers;
+};
+
+uint64_t sr_timer_now_ns(void);
+uint64_t sr_timer_now(void);
+void sr_timer_wheel_init(struct sr_timer_wheel *wheel, uint64_t now);
+void sr_timer_add(struct sr_timer_wheel *wheel, struct sr_timer *timer,
+		  uint64_t expires);
+void sr_timer_del(struct sr_timer *timer);
+gboolean sr_timer_pending(const struct sr_timer *timer);
+struct sr_timer *sr_timer_expire(struct sr_timer_wheel *wheel, uint64_t now);
+int sr_timer_next(struct sr_timer_wheel *wheel, uint64_t now);
+
+/*--- session.c -------------------------------------------------------------*/
+
+struct source;
+struct sr_merge;
+
+/* 4 buckets per power of two of ns, see session_stats.c */
+#define SR_CALLBACK_TIME_BUCKETS 252
+
+struct sr_callback_timing {
+	uint64_t num_calls;
+	uint64_t time_total;
+	uint64_t time_min;
+	uint64_t time_max;
+	uint64_t buckets[SR_CALLBACK_TIME_BUCKETS];
+};
+
+/* Everything a session keeps while it runs, private to libsigrok. */
+struct sr_session_state {
+	/* Sources, with a GPollFD for each at the same index */
+	struct source **sources;
+	GPollFD *pollfds;
+	int num_sources;
+	int max_sources;
+	/* Source timeouts, and the coalescing latency */
+	struct sr_timer_wheel timers;
+	/* fd -> chain of sources on that fd */
+	GHashTable *source_fds;
+	/* Sources removed while dispatching, freed after the loop iteration */
+	GSList *dead_sources;
+	gboolean dispatching;
+	unsigned int loop_gen;
+	int epoll_fd;
+	gboolean epoll_failed;
+	/* Coalescing of logic packets */
+	uint64_t coalesce_bytes;
+	int coalesce_latency;
+	struct sr_device *pending_device;
+	struct sr_datafeed_packet pending;
+	struct sr_datafeed_logic pending_logic;
+	gboolean pending_copied;
+	struct sr_timer pending_timer;
+	struct sr_packet_stats packet_stats;
+	/* Asynchronous datafeed callbacks, see session_bus.c */
+	GSList *consumers;
+	/* Subscriptions and their probe projections, see session_subscribe.c */
+	GSList *subscriptions;
+	GSList *projections;
+	/* Packet types any subscription wants */
+	int subscribed_types;
+	/* Statistics since the session was started, see session_stats.c */
+	uint64_t stats_start;
+	uint64_t num_wakeups;
+	uint64_t num_timeouts;
+	/* struct sr_device_stats per device */
+	GSList *device_stats;
+	/* struct sr_callback_timing per datafeed callback, in the same order */
+	GSList *callback_timings;
+	/* Whether callbacks are timed, see sr_session_set_timing() */
+	gboolean timing;
+	/* Sources with a timeout of 0, called on every loop iteration */
+	int num_idle;
+	/* Threads and queues of a threaded session, see session_merge.c */
+	struct sr_merge *merge;
+	/* In a device thread of a threaded session, the main session */
+	struct sr_session *parent;
+	/* Session file and devices loaded from it, see session_driver.c */
+	char *sessionfile;
+	GSList *file_devices;
+};
+
+/*--- session_bus.c ---------------------------------------------------------*/
+
+void sr_session_bus_async(struct sr_session *session,
+			  struct sr_device *device,
+			  struct sr_datafeed_packet *packet);
+void sr_session_bus_async_clear(struct sr_session *session);
+int sr_session_bus_async_stats(struct sr_session *session,
+			       struct sr_callback_stats *stats);
+void sr_session_bus_async_stats_reset(struct sr_session *session);
+
+/*--- session_subscribe.c ---------------------------------------------------*/
+
+void sr_session_bus_subscribers(struct sr_session *session,
+				struct sr_device *device,
+				struct sr_datafeed_packet *packet);
+void sr_session_subscriptions_clear(struct sr_session *session);
+int sr_session_subscriptions_stats(struct sr_session *session,
+				   struct sr_callback_stats *stats);
+void sr_session_subscriptions_stats_reset(struct sr_session *session);
+
+/*--- session_stats.c -------------------------------------------------------*/
+
+void sr_callback_timing_add(struct sr_callback_timing *timing, uint64_t ns);
+void sr_callback_timing_get(const struct sr_callback_timing *timing,
+			    struct sr_callback_stats *stats);
+void sr_session_stats_packet(struct sr_session_state *st,
+			     struct sr_device *device,
+			     const struct sr_datafeed_packet *packet);
+void sr_session_stats_reset(struct sr_session *session);
+void sr_session_stats_clear(struct sr_session_state *st);
+void sr_session_stats_lag(struct sr_session_state *st,
+			  struct sr_device *device, uint64_t lag);
+
+/*--- session_driver.c ------------------------------------------------------*/
+
+void sr_session_driver_clear(struct sr_session_state *st);
+
+/*--- session_merge.c -------------------------------------------------------*/
+
+int sr_session_merge_start(struct sr_session *session);
+void sr_session_merge_stop(struct sr_session *session);
+void sr_session_merge_free(struct sr_session *session);
+
 /*--- hwplugin.c ------------------------------------------------------------*/
 
 int load_hwplugins(void);
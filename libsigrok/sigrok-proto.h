@@ -33,9 +33,74 @@ int sr_get_loglevel(void);
 /*--- datastore.c -----------------------------------------------------------*/
 
 int sr_datastore_new(int unitsize, struct sr_datastore **ds);
+int sr_datastore_new_file(int unitsize, const char *dir, uint64_t max_resident,
+			  struct sr_datastore **ds);
+int sr_datastore_new_compressed(int unitsize, struct sr_datastore **ds);
+int sr_datastore_new_bitplane(int unitsize, struct sr_datastore **ds);
+int sr_datastore_snapshot(struct sr_datastore *ds,
+			  struct sr_datastore **snapshot);
+int sr_datastore_set_ring(struct sr_datastore *ds, uint64_t max_units);
+uint64_t sr_datastore_get_ring_size(struct sr_datastore *ds);
+uint64_t sr_datastore_get_first_unit(struct sr_datastore *ds);
 int sr_datastore_destroy(struct sr_datastore *ds);
-void sr_datastore_put(struct sr_datastore *ds, void *data, unsigned int length,
-		      int in_unitsize, int *probelist);
+int sr_datastore_put(struct sr_datastore *ds, const void *data,
+		     uint64_t length, int in_unitsize, int *probelist);
+int sr_datastore_get_chunk(struct sr_datastore *ds, uint64_t start,
+			   const void **data, uint64_t *num_units);
+int sr_datastore_get_range(struct sr_datastore *ds, uint64_t start,
+			   uint64_t count, void *buf);
+int sr_datastore_get_probe(struct sr_datastore *ds, int probe, uint64_t start,
+			   uint64_t count, uint8_t *bitmap);
+int sr_datastore_get_stats(struct sr_datastore *ds,
+			   struct sr_datastore_stats *stats);
+
+/*--- summary.c -------------------------------------------------------------*/
+
+int sr_datastore_enable_summary(struct sr_datastore *ds);
+int sr_datastore_get_summary(struct sr_datastore *ds, int level,
+			     uint64_t block, struct sr_summary *summary);
+int sr_datastore_summarize(struct sr_datastore *ds, uint64_t start,
+			   uint64_t count, struct sr_summary *summary);
+
+/*--- edges.c ---------------------------------------------------------------*/
+
+int sr_datastore_enable_edge_index(struct sr_datastore *ds);
+int sr_datastore_next_edge(struct sr_datastore *ds, int probe, uint64_t from,
+			   uint64_t *pos);
+int sr_datastore_prev_edge(struct sr_datastore *ds, int probe, uint64_t from,
+			   uint64_t *pos);
+int sr_datastore_count_edges(struct sr_datastore *ds, int probe,
+			     uint64_t start, uint64_t count,
+			     uint64_t *num_edges);
+
+/*--- buffer.c --------------------------------------------------------------*/
+
+struct sr_buffer *sr_buffer_new(uint64_t size);
+struct sr_buffer *sr_buffer_wrap(void *data, uint64_t size,
+		void (*release) (void *data, void *user_data),
+		void *user_data);
+struct sr_buffer *sr_buffer_ref(struct sr_buffer *buf);
+void sr_buffer_unref(struct sr_buffer *buf);
+int sr_datafeed_logic_ref(const struct sr_datafeed_logic *logic,
+			  struct sr_datafeed_logic *ref);
+void sr_datafeed_logic_unref(struct sr_datafeed_logic *logic);
+
+/*--- mempool.c -------------------------------------------------------------*/
+
+void *sr_mempool_alloc(size_t size);
+void sr_mempool_free(void *mem, size_t size);
+int sr_mempool_set_hugetlb(gboolean enable);
+int sr_mempool_get_stats(struct sr_mempool_stats *pool_stats);
+
+/*--- ringbuffer.c ----------------------------------------------------------*/
+
+int sr_ringbuffer_new(unsigned int size, struct sr_ringbuffer **rb);
+void sr_ringbuffer_destroy(struct sr_ringbuffer *rb);
+void *sr_ringbuffer_reserve(struct sr_ringbuffer *rb, unsigned int *len);
+gboolean sr_ringbuffer_commit(struct sr_ringbuffer *rb, unsigned int len);
+const void *sr_ringbuffer_peek(struct sr_ringbuffer *rb, unsigned int *len);
+void sr_ringbuffer_release(struct sr_ringbuffer *rb, unsigned int len);
+gboolean sr_ringbuffer_wait_prepare(struct sr_ringbuffer *rb);
 
 /*--- device.c --------------------------------------------------------------*/
 
@@ -63,6 +128,21 @@ gboolean sr_device_has_hwcap(struct sr_device *device, int hwcap);
 int sr_filter_probes(int in_unitsize, int out_unitsize, int *probelist,
 		     const unsigned char *data_in, uint64_t length_in,
 		     char **data_out, uint64_t *length_out);
+int sr_filter_plan_new(int in_unitsize, int out_unitsize,
+		       const int *probelist, struct sr_filter_plan **plan);
+int sr_filter_plan_apply(struct sr_filter_plan *plan, int in_unitsize,
+			 const unsigned char *data_in, uint64_t length_in,
+			 unsigned char *buf, uint64_t buf_size,
+			 const unsigned char **data_out, uint64_t *length_out);
+void sr_filter_plan_destroy(struct sr_filter_plan *plan);
+
+/*--- trace.c ---------------------------------------------------------------*/
+
+int sr_trace_start(int events_per_thread);
+void sr_trace_stop(void);
+uint64_t sr_trace_begin(void);
+void sr_trace_end(const char *name, uint64_t start, int64_t arg);
+int sr_trace_save(const char *filename);
 
 /*--- hwplugin.c ------------------------------------------------------------*/
 
@@ -103,6 +183,8 @@ typedef void (*sr_datafeed_callback) (struct sr_device *device,
 int sr_session_load(const char *filename);
 struct sr_session *sr_session_new(void);
 void sr_session_destroy(void);
+void sr_session_set_current(struct sr_session *session);
+struct sr_session *sr_session_get_current(void);
 void sr_session_device_clear(void);
 int sr_session_device_add(struct sr_device *device);
 
@@ -115,6 +197,13 @@ void sr_session_pa_add(struct sr_analyzer *pa);
 /* Datafeed setup */
 void sr_session_datafeed_callback_clear(void);
 void sr_session_datafeed_callback_add(sr_datafeed_callback callback);
+int sr_session_datafeed_callback_add_async(sr_datafeed_callback callback,
+					   int max_packets, int policy);
+int sr_session_datafeed_callback_stats(sr_datafeed_callback callback,
+				       uint64_t *dropped, uint64_t *spilled);
+int sr_session_subscribe(sr_datafeed_callback callback, int packet_types,
+			 uint64_t probe_mask);
+int sr_session_unsubscribe(sr_datafeed_callback callback);
 
 /* Session control */
 int sr_session_start(void);
@@ -123,6 +212,16 @@ void sr_session_halt(void);
 void sr_session_stop(void);
 void sr_session_bus(struct sr_device *device,
 		    struct sr_datafeed_packet *packet);
+int sr_session_coalesce(uint64_t max_bytes, int max_latency);
+int sr_session_set_threaded(gboolean threaded, int max_latency);
+int sr_session_get_packet_stats(struct sr_packet_stats *stats);
+int sr_session_set_timing(gboolean enable);
+int sr_session_get_stats(struct sr_session_stats *stats);
+void sr_session_stats_free(struct sr_session_stats *stats);
+struct sr_buffer *sr_session_buffer_acquire(uint64_t size);
+int sr_session_buffer_commit(struct sr_device *device,
+			     struct sr_datafeed_packet *packet,
+			     struct sr_buffer *buf);
 int sr_session_save(const char *filename);
 void sr_session_source_add(int fd, int events, int timeout,
 	        sr_receive_data_callback callback, void *user_data);
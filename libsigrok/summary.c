@@ -0,0 +1,293 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Multi-resolution summaries of the samples in a datastore.
+ *
+ * Level 0 summarizes blocks of 2^SUMMARY_SHIFT units, and every level above
+ * that summarizes pairs of blocks of the level below. For every block the
+ * first and last unit is kept, along with a mask of the probes which changed
+ * anywhere inside the block. This is all a zoomed-out display needs to draw
+ * a block of samples in one pixel, so it can be rendered with one lookup per
+ * pixel instead of looking at every sample.
+ *
+ * The summaries are kept up to date as data is put into the datastore.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+/* Initial number of blocks allocated for a level, doubled when full. */
+#define SUMMARY_INITIAL_BLOCKS 64
+
+static void summary_combine(struct sr_summary *s, const struct sr_summary *next)
+{
+	s->transitions |= next->transitions | (s->last ^ next->first);
+	s->last = next->last;
+}
+
+/* Append a completed block to a level, and fold it into the level above. */
+static int summary_push(struct sr_datastore *ds, int level,
+			const struct sr_summary *block)
+{
+	struct sr_summary_level *lvl, *up;
+	struct sr_summary *blocks;
+	uint64_t max_blocks;
+
+	for (; level < SR_SUMMARY_MAX_LEVELS; level++) {
+		lvl = &ds->state->summary[level];
+		if (lvl->num_blocks == lvl->max_blocks) {
+			max_blocks = lvl->max_blocks ? lvl->max_blocks * 2
+						     : SUMMARY_INITIAL_BLOCKS;
+			if (!(blocks = g_try_realloc(lvl->blocks,
+					max_blocks * sizeof(struct sr_summary)))) {
+				sr_err("summary: %s: blocks realloc failed",
+				       __func__);
+				return SR_ERR_MALLOC;
+			}
+			lvl->blocks = blocks;
+			lvl->max_blocks = max_blocks;
+		}
+		lvl->blocks[lvl->num_blocks++] = *block;
+		lvl->count = 0;
+		if (level + 1 > ds->state->num_summary_levels)
+			ds->state->num_summary_levels = level + 1;
+
+		if (level + 1 == SR_SUMMARY_MAX_LEVELS)
+			break;
+
+		up = &ds->state->summary[level + 1];
+		if (up->count++ == 0) {
+			up->current = *block;
+			break;
+		}
+		/* The block above is complete now as well. */
+		summary_combine(&up->current, block);
+		block = &up->current;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Start maintaining summaries for a datastore.
+ *
+ * This must be called before any data is put into the datastore, and is
+ * not supported in ring mode.
+ *
+ * @param ds The datastore.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments,
+ *         SR_ERR_MALLOC upon memory allocation errors, SR_ERR if the
+ *         datastore already contains data.
+ */
+int sr_datastore_enable_summary(struct sr_datastore *ds)
+{
+	if (!ds || ds->ds_unitsize > 8 || ds->state->ring_chunks)
+		return SR_ERR_ARG;
+
+	if (ds->num_units)
+		return SR_ERR;
+
+	if (ds->state->summary)
+		return SR_OK;
+
+	if (!(ds->state->summary = g_try_malloc0(SR_SUMMARY_MAX_LEVELS
+					  * sizeof(struct sr_summary_level)))) {
+		sr_err("summary: %s: summary malloc failed", __func__);
+		return SR_ERR_MALLOC;
+	}
+	ds->state->num_summary_levels = 0;
+
+	return SR_OK;
+}
+
+/* Update the summaries with units just put into the datastore. */
+int sr_summary_update(struct sr_datastore *ds, const uint8_t *data,
+		      uint64_t num_units)
+{
+	struct sr_summary_level *lvl;
+	uint64_t unit, i;
+	int ret;
+
+	lvl = &ds->state->summary[0];
+	unit = 0;
+	for (i = 0; i < num_units; i++) {
+		memcpy(&unit, data + i * ds->ds_unitsize, ds->ds_unitsize);
+		if (lvl->count++ == 0) {
+			lvl->current.first = unit;
+			lvl->current.transitions = 0;
+		} else {
+			lvl->current.transitions |= lvl->current.last ^ unit;
+		}
+		lvl->current.last = unit;
+		if (lvl->count == 1 << SR_SUMMARY_SHIFT) {
+			if ((ret = summary_push(ds, 0, &lvl->current)) != SR_OK)
+				return ret;
+		}
+	}
+
+	return SR_OK;
+}
+
+void sr_summary_free(struct sr_datastore *ds)
+{
+	int i;
+
+	if (!ds->state->summary)
+		return;
+
+	for (i = 0; i < SR_SUMMARY_MAX_LEVELS; i++)
+		g_free(ds->state->summary[i].blocks);
+	g_free(ds->state->summary);
+	ds->state->summary = NULL;
+}
+
+/**
+ * Get the summary of a single block at a given level.
+ *
+ * A block at level n covers 2^(SR_SUMMARY_SHIFT + n) units, starting at
+ * unit block * 2^(SR_SUMMARY_SHIFT + n). Only complete blocks are available.
+ *
+ * @param ds The datastore.
+ * @param level The level, from 0 to ds->state->num_summary_levels - 1.
+ * @param block The number of the block within that level.
+ * @param summary Pointer to where the summary will be stored.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or if the
+ *         block isn't available (yet).
+ */
+int sr_datastore_get_summary(struct sr_datastore *ds, int level,
+			     uint64_t block, struct sr_summary *summary)
+{
+	if (!ds || !ds->state->summary || !summary)
+		return SR_ERR_ARG;
+
+	if (level < 0 || level >= ds->state->num_summary_levels)
+		return SR_ERR_ARG;
+
+	if (block >= ds->state->summary[level].num_blocks)
+		return SR_ERR_ARG;
+
+	*summary = ds->state->summary[level].blocks[block];
+
+	return SR_OK;
+}
+
+/* Fold raw units into a summary. */
+static int summarize_raw(struct sr_datastore *ds, uint64_t start,
+			 uint64_t count, struct sr_summary *summary,
+			 gboolean *valid)
+{
+	const uint8_t *data;
+	uint64_t unit, num_units, i;
+	int ret;
+
+	unit = 0;
+	while (count) {
+		if ((ret = sr_datastore_get_chunk(ds, start, (const void **)&data,
+						  &num_units)) != SR_OK)
+			return ret;
+		num_units = MIN(num_units, count);
+		for (i = 0; i < num_units; i++) {
+			memcpy(&unit, data + i * ds->ds_unitsize,
+			       ds->ds_unitsize);
+			if (!*valid) {
+				summary->first = summary->last = unit;
+				summary->transitions = 0;
+				*valid = TRUE;
+			} else {
+				summary->transitions |= summary->last ^ unit;
+				summary->last = unit;
+			}
+		}
+		start += num_units;
+		count -= num_units;
+	}
+
+	return SR_OK;
+}
+
+/**
+ * Get the summary of an arbitrary range of units.
+ *
+ * The range is covered with the largest available blocks. Only the units
+ * before the first and after the last level 0 block covered are looked at
+ * individually, so this takes O(log n) lookups regardless of the size of
+ * the range.
+ *
+ * @param ds The datastore.
+ * @param start The first unit of the range.
+ * @param count The number of units in the range.
+ * @param summary Pointer to where the summary will be stored.
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments or if the
+ *         range is empty or lies (partially) beyond the end of the data.
+ */
+int sr_datastore_summarize(struct sr_datastore *ds, uint64_t start,
+			   uint64_t count, struct sr_summary *summary)
+{
+	struct sr_summary_level *lvl;
+	uint64_t end, size, next;
+	gboolean valid;
+	int level, ret;
+
+	if (!ds || !ds->state->summary || !summary || !count)
+		return SR_ERR_ARG;
+
+	end = start + count;
+	if (end > ds->num_units || end < start)
+		return SR_ERR_ARG;
+
+	valid = FALSE;
+	while (start < end) {
+		/* Find the largest block starting here which fits. */
+		for (level = ds->state->num_summary_levels - 1; level >= 0;
+		     level--) {
+			lvl = &ds->state->summary[level];
+			size = 1ULL << (SR_SUMMARY_SHIFT + level);
+			if (start % size == 0 && start + size <= end
+			    && start / size < lvl->num_blocks)
+				break;
+		}
+
+		if (level >= 0) {
+			if (!valid) {
+				*summary = lvl->blocks[start / size];
+				valid = TRUE;
+			} else {
+				summary_combine(summary,
+						&lvl->blocks[start / size]);
+			}
+			start += size;
+			continue;
+		}
+
+		/* No block fits, do the units up to the next block by hand. */
+		size = 1ULL << SR_SUMMARY_SHIFT;
+		next = MIN((start / size + 1) * size, end);
+		if ((ret = summarize_raw(ds, start, next - start, summary,
+					 &valid)) != SR_OK)
+			return ret;
+		start = next;
+	}
+
+	return SR_OK;
+}
@@ -0,0 +1,284 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hierarchical timer wheel, used by the session loop for source timeouts.
+ *
+ * Time is counted in milliseconds. Level 0 has a slot for each of the
+ * next 64 ms, level 1 a slot for each of the next 64 blocks of 64 ms,
+ * and so on. Whenever level 0 wraps around, the next slot of level 1 is
+ * spread out over level 0, and likewise further up. Adding and removing
+ * a timer is O(1), and a bitmap of the slots in use per level finds the
+ * next expiry without walking the wheel.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <glib.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+#define SLOT_MASK (SR_TIMER_SLOTS - 1)
+
+/* Current time in ns, from the monotonic clock if there is one. */
+uint64_t sr_timer_now_ns(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+	GTimeVal tv;
+
+	g_get_current_time(&tv);
+	return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+/* Current time in ms. */
+uint64_t sr_timer_now(void)
+{
+	return sr_timer_now_ns() / 1000000;
+}
+
+void sr_timer_wheel_init(struct sr_timer_wheel *wheel, uint64_t now)
+{
+	memset(wheel, 0, sizeof(struct sr_timer_wheel));
+	wheel->now = now;
+}
+
+static void list_add(struct sr_timer **head, struct sr_timer *timer)
+{
+	timer->next = *head;
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+	timer->pprev = head;
+	*head = timer;
+}
+
+/* Put a timer into the slot its expiry falls in. */
+static void place(struct sr_timer_wheel *wheel, struct sr_timer *timer)
+{
+	uint64_t expires, delta;
+	int level, slot;
+
+	expires = timer->expires;
+	if (expires < wheel->now) {
+		/* That tick has been run already, so it is due now. */
+		list_add(&wheel->expired, timer);
+		timer->level = -1;
+		return;
+	}
+	delta = expires - wheel->now;
+
+	for (level = 0; level < SR_TIMER_LEVELS - 1; level++) {
+		if (delta < 1ULL << ((level + 1) * SR_TIMER_SLOT_BITS))
+			break;
+	}
+	if (level == SR_TIMER_LEVELS - 1
+	    && delta >= 1ULL << (SR_TIMER_LEVELS * SR_TIMER_SLOT_BITS)) {
+		/* Too far out: park it at the end, it is cascaded in time. */
+		expires = wheel->now
+			  + (1ULL << (SR_TIMER_LEVELS * SR_TIMER_SLOT_BITS)) - 1;
+	}
+
+	slot = (expires >> (level * SR_TIMER_SLOT_BITS)) & SLOT_MASK;
+	timer->level = level;
+	timer->slot = slot;
+	list_add(&wheel->slots[level][slot], timer);
+	wheel->used[level] |= 1ULL << slot;
+}
+
+/**
+ * Arm a timer to expire at the given time, in ms.
+ *
+ * The timer must not be pending already.
+ */
+void sr_timer_add(struct sr_timer_wheel *wheel, struct sr_timer *timer,
+		  uint64_t expires)
+{
+	timer->expires = expires;
+	timer->wheel = wheel;
+	place(wheel, timer);
+	wheel->num_timers++;
+}
+
+/* Disarm a timer. Does nothing if it isn't pending. */
+void sr_timer_del(struct sr_timer *timer)
+{
+	struct sr_timer_wheel *wheel;
+
+	if (!timer->pprev)
+		return;
+
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->pprev = NULL;
+
+	wheel = timer->wheel;
+	if (timer->level >= 0
+	    && !wheel->slots[timer->level][timer->slot])
+		wheel->used[timer->level] &= ~(1ULL << timer->slot);
+	wheel->num_timers--;
+}
+
+gboolean sr_timer_pending(const struct sr_timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+/* Move a whole slot into another list, or back into the wheel. */
+static struct sr_timer *take_slot(struct sr_timer_wheel *wheel, int level,
+				  int slot)
+{
+	struct sr_timer *list;
+
+	list = wheel->slots[level][slot];
+	wheel->slots[level][slot] = NULL;
+	wheel->used[level] &= ~(1ULL << slot);
+
+	return list;
+}
+
+static void cascade(struct sr_timer_wheel *wheel)
+{
+	struct sr_timer *timer, *next;
+	int level, slot;
+
+	for (level = 1; level < SR_TIMER_LEVELS; level++) {
+		slot = (wheel->now >> (level * SR_TIMER_SLOT_BITS)) & SLOT_MASK;
+		for (timer = take_slot(wheel, level, slot); timer; timer = next) {
+			next = timer->next;
+			place(wheel, timer);
+		}
+		/* Only go up a level when this one wrapped around as well. */
+		if (slot)
+			break;
+	}
+}
+
+/**
+ * Return the next timer that expired by the given time, in ms, or NULL.
+ *
+ * The timer is no longer pending when returned. Call this until it
+ * returns NULL; timers may be added and removed in between.
+ */
+struct sr_timer *sr_timer_expire(struct sr_timer_wheel *wheel, uint64_t now)
+{
+	struct sr_timer *timer, *next;
+	int slot;
+
+	while (!wheel->expired && wheel->now <= now) {
+		if (!wheel->num_timers) {
+			/* Nothing to run, so just catch up. */
+			wheel->now = now + 1;
+			break;
+		}
+		slot = wheel->now & SLOT_MASK;
+		if (!slot)
+			cascade(wheel);
+		if (!wheel->used[0]) {
+			/* Level 0 is empty, skip ahead to the next cascade. */
+			wheel->now = MIN((wheel->now | SLOT_MASK) + 1, now + 1);
+			continue;
+		}
+		for (timer = take_slot(wheel, 0, slot); timer; timer = next) {
+			next = timer->next;
+			list_add(&wheel->expired, timer);
+			/* No longer in a slot. */
+			timer->level = -1;
+		}
+		wheel->now++;
+	}
+
+	if (!(timer = wheel->expired))
+		return NULL;
+	sr_timer_del(timer);
+
+	return timer;
+}
+
+/* Earliest expiry of the timers in a slot. */
+static uint64_t slot_min(struct sr_timer_wheel *wheel, int level, int slot)
+{
+	struct sr_timer *timer;
+	uint64_t min;
+
+	min = UINT64_MAX;
+	for (timer = wheel->slots[level][slot]; timer; timer = timer->next) {
+		if (timer->expires < min)
+			min = timer->expires;
+	}
+
+	return min;
+}
+
+/**
+ * Return how many ms from now the next timer expires: 0 if one is due
+ * already, -1 if there are none.
+ */
+int sr_timer_next(struct sr_timer_wheel *wheel, uint64_t now)
+{
+	uint64_t next, t, used, block;
+	int level, shift, start, i;
+
+	if (wheel->expired)
+		return 0;
+	if (!wheel->num_timers)
+		return -1;
+
+	next = UINT64_MAX;
+	for (level = 0; level < SR_TIMER_LEVELS; level++) {
+		if (!(used = wheel->used[level]))
+			continue;
+		/*
+		 * Slots are in time order from the next one to be run or
+		 * cascaded. Timers parked in the last slot of the top level
+		 * may expire later than their slot suggests, so look on
+		 * until the slots start after the earliest expiry found.
+		 */
+		shift = level * SR_TIMER_SLOT_BITS;
+		block = wheel->now >> shift;
+		if (wheel->now & ((1ULL << shift) - 1))
+			block++;
+		start = block & SLOT_MASK;
+		used = (used >> start)
+		       | (start ? used << (SR_TIMER_SLOTS - start) : 0);
+		while (used) {
+			i = __builtin_ctzll(used);
+			if ((block + i) << shift >= next)
+				break;
+			t = slot_min(wheel, level, (start + i) & SLOT_MASK);
+			if (t < next)
+				next = t;
+			used &= used - 1;
+		}
+	}
+
+	if (next <= now)
+		return 0;
+	if (next - now > G_MAXINT)
+		return G_MAXINT;
+
+	return next - now;
+}
@@ -0,0 +1,234 @@
+/*
+ * This file is part of the sigrok project.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Trace recorder.
+ *
+ * While tracing, the session loop, the bus and the filters record how long
+ * each source callback, datafeed callback and so on took. Every thread
+ * writes its events into a ring of its own, without taking any locks; once
+ * a ring is full, the oldest events are overwritten. sr_trace_save() then
+ * writes all of them out in the Chrome trace event format, which
+ * chrome://tracing and Perfetto can show.
+ *
+ * When tracing is off, sr_trace_begin() only checks a flag.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sigrok.h>
+#include <sigrok-internal.h>
+
+struct trace_event {
+	const char *name;
+	/* ns since the trace was started */
+	uint64_t start;
+	uint64_t duration;
+	int64_t arg;
+};
+
+struct trace_ring {
+	int tid;
+	unsigned int size;
+	/* Number of events ever written; only the last size are kept */
+	uint64_t head;
+	struct trace_event *events;
+};
+
+static int trace_enabled = FALSE;
+static GStaticMutex rings_lock = G_STATIC_MUTEX_INIT;
+static GSList *rings = NULL;
+static unsigned int ring_size;
+/* Bumped every time tracing starts, to let threads know to get new rings */
+static unsigned int trace_gen = 0;
+static uint64_t trace_start;
+
+static __thread struct trace_ring *ring;
+static __thread unsigned int ring_gen;
+
+static void rings_free(void)
+{
+	struct trace_ring *r;
+	GSList *l;
+
+	for (l = rings; l; l = l->next) {
+		r = l->data;
+		g_free(r->events);
+		g_free(r);
+	}
+	g_slist_free(rings);
+	rings = NULL;
+}
+
+/* Give the calling thread a ring for the current trace. */
+static struct trace_ring *ring_new(void)
+{
+	struct trace_ring *r;
+
+	if (!(r = g_try_malloc0(sizeof(struct trace_ring))))
+		return NULL;
+	if (!(r->events = g_try_malloc(ring_size
+				       * sizeof(struct trace_event)))) {
+		g_free(r);
+		return NULL;
+	}
+	r->size = ring_size;
+
+	g_static_mutex_lock(&rings_lock);
+	r->tid = g_slist_length(rings) + 1;
+	rings = g_slist_append(rings, r);
+	g_static_mutex_unlock(&rings_lock);
+
+	return r;
+}
+
+/**
+ * Start recording a trace, discarding any previous one.
+ *
+ * Start and save traces while no session runs.
+ *
+ * @param events_per_thread Number of events to keep for every thread.
+ *
+ * @return SR_OK upon success, SR_ERR_ARG upon invalid arguments.
+ */
+int sr_trace_start(int events_per_thread)
+{
+	if (events_per_thread <= 0) {
+		sr_err("trace: %s: invalid argument", __func__);
+		return SR_ERR_ARG;
+	}
+
+	trace_enabled = FALSE;
+	g_static_mutex_lock(&rings_lock);
+	rings_free();
+	ring_size = events_per_thread;
+	trace_gen++;
+	g_static_mutex_unlock(&rings_lock);
+
+	trace_start = sr_timer_now_ns();
+	trace_enabled = TRUE;
+
+	return SR_OK;
+}
+
+/* Stop recording. The events recorded so far are kept for sr_trace_save(). */
+void sr_trace_stop(void)
+{
+	trace_enabled = FALSE;
+}
+
+/**
+ * Get the start time of an event, or 0 if tracing is off. Pass it to
+ * sr_trace_end() once the event is over.
+ */
+uint64_t sr_trace_begin(void)
+{
+	if (G_LIKELY(!trace_enabled))
+		return 0;
+
+	return sr_timer_now_ns();
+}
+
+/**
+ * Record an event which started at start, as returned by sr_trace_begin().
+ *
+ * @param name Name of the event, which must stay valid until the trace has
+ *             been saved; normally a string literal.
+ * @param start Start time of the event. Nothing is recorded if this is 0.
+ * @param arg A number which is saved with the event.
+ */
+void sr_trace_end(const char *name, uint64_t start, int64_t arg)
+{
+	struct trace_event *ev;
+	uint64_t now, head;
+
+	if (G_LIKELY(!start) || !trace_enabled)
+		return;
+
+	now = sr_timer_now_ns();
+	if (!ring || ring_gen != trace_gen) {
+		ring_gen = trace_gen;
+		if (!(ring = ring_new()))
+			return;
+	}
+
+	/* Only this thread writes to its ring. */
+	head = ring->head;
+	ev = &ring->events[head % ring->size];
+	ev->name = name;
+	ev->start = start > trace_start ? start - trace_start : 0;
+	ev->duration = now - start;
+	ev->arg = arg;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Save the recorded events in the Chrome trace event format.
+ *
+ * @return SR_OK upon success, SR_ERR upon errors.
+ */
+int sr_trace_save(const char *filename)
+{
+	struct trace_ring *r;
+	struct trace_event *ev;
+	GSList *l;
+	FILE *f;
+	uint64_t head, i;
+	const char *sep;
+
+	if (!(f = g_fopen(filename, "w"))) {
+		sr_err("trace: %s: failed to open %s", __func__, filename);
+		return SR_ERR;
+	}
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	sep = "";
+	g_static_mutex_lock(&rings_lock);
+	for (l = rings; l; l = l->next) {
+		r = l->data;
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			"\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+			sep, r->tid, r->tid);
+		sep = ",\n";
+
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		for (i = head > r->size ? head - r->size : 0; i < head; i++) {
+			ev = &r->events[i % r->size];
+			fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"sigrok\","
+				"\"ph\":\"X\",\"ts\":%" PRIu64 ".%03" PRIu64 ","
+				"\"dur\":%" PRIu64 ".%03" PRIu64 ",\"pid\":1,"
+				"\"tid\":%d,\"args\":{\"arg\":%" PRId64 "}}",
+				sep, ev->name, ev->start / 1000,
+				ev->start % 1000, ev->duration / 1000,
+				ev->duration % 1000, r->tid, ev->arg);
+		}
+	}
+	g_static_mutex_unlock(&rings_lock);
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	if (fclose(f) != 0) {
+		sr_err("trace: %s: failed to write %s", __func__, filename);
+		return SR_ERR;
+	}
+
+	return SR_OK;
+}